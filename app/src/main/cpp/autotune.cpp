@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cstdio>
+#include "autotune.h"
+
+// model_hash cpu_signature n_threads n_threads_batch n_batch n_ubatch prefill_tps decode_tps
+static const char* TUNE_LINE_FORMAT = "%016llx %016llx %d %d %u %u %.2f %.2f\n";
+
+std::string TuneConfig::describe() const {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "threads=%d/%d n_batch=%u n_ubatch=%u prefill=%.1f tok/s decode=%.1f tok/s",
+             n_threads, n_threads_batch, n_batch, n_ubatch, prefill_tps, decode_tps);
+    return buf;
+}
+
+uint64_t cpuSignature(const CpuTopology& topology) {
+    uint64_t hash = 1469598103934665603ULL;
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    };
+    mix(topology.cores.size());
+    for (const CpuCore& core : topology.cores) {
+        mix(core.capacity);
+        mix(core.max_freq_khz);
+    }
+    return hash;
+}
+
+std::vector<int> tuneThreadCandidates(const CpuTopology& topology, int n_cpus) {
+    n_cpus = std::max(1, n_cpus);
+    const int n_perf = topology.performance.empty() ? n_cpus : (int) topology.performance.size();
+
+    std::vector<int> candidates = {n_perf / 2, n_perf - 1, n_perf, n_cpus};
+    for (int& n : candidates) n = std::max(1, std::min(n, n_cpus));
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    return candidates;
+}
+
+std::vector<uint32_t> tuneUbatchCandidates(uint32_t max_ubatch, uint32_t min_size) {
+    std::vector<uint32_t> candidates;
+    min_size = std::max(1u, min_size);
+    for (uint32_t n_ubatch = max_ubatch; n_ubatch >= min_size; n_ubatch /= 2) {
+        candidates.push_back(n_ubatch);
+    }
+    return candidates;
+}
+
+static bool parseLine(const char* line, uint64_t& model_hash, uint64_t& cpu_signature, TuneConfig& config) {
+    unsigned long long model = 0, cpu = 0;
+    if (sscanf(line, "%llx %llx %d %d %u %u %lf %lf", &model, &cpu, &config.n_threads, &config.n_threads_batch,
+               &config.n_batch, &config.n_ubatch, &config.prefill_tps, &config.decode_tps) != 8) {
+        return false;
+    }
+    model_hash = model;
+    cpu_signature = cpu;
+    return config.valid();
+}
+
+bool loadTuneConfig(const std::string& path, uint64_t model_hash, uint64_t cpu_signature, TuneConfig& config) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return false;
+
+    char line[256];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f)) {
+        uint64_t model = 0, cpu = 0;
+        TuneConfig entry;
+        if (parseLine(line, model, cpu, entry) && model == model_hash && cpu == cpu_signature) {
+            config = entry;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+bool saveTuneConfig(const std::string& path, uint64_t model_hash, uint64_t cpu_signature, const TuneConfig& config) {
+    if (!config.valid()) return false;
+
+    // Keep the results of other models and CPUs
+    std::vector<std::string> kept;
+    FILE* in = fopen(path.c_str(), "r");
+    if (in) {
+        char line[256];
+        while (fgets(line, sizeof(line), in)) {
+            uint64_t model = 0, cpu = 0;
+            TuneConfig entry;
+            if (parseLine(line, model, cpu, entry) && !(model == model_hash && cpu == cpu_signature)) {
+                kept.push_back(line);
+            }
+        }
+        fclose(in);
+    }
+
+    const std::string tmp_path = path + ".tmp";
+    FILE* out = fopen(tmp_path.c_str(), "w");
+    if (!out) return false;
+    bool ok = true;
+    for (const std::string& line : kept) {
+        ok = ok && fputs(line.c_str(), out) >= 0;
+    }
+    ok = ok && fprintf(out, TUNE_LINE_FORMAT, (unsigned long long) model_hash, (unsigned long long) cpu_signature,
+                       config.n_threads, config.n_threads_batch, config.n_batch, config.n_ubatch,
+                       config.prefill_tps, config.decode_tps) > 0;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cpu_topology.h"
+
+// Launch settings measured for one model on one CPU
+struct TuneConfig {
+    int n_threads = 0;               // decode
+    int n_threads_batch = 0;         // prefill
+    uint32_t n_batch = 0;
+    uint32_t n_ubatch = 0;
+    double prefill_tps = 0;          // tokens/s of the winning prefill configuration
+    double decode_tps = 0;           // tokens/s of the winning decode thread count
+
+    bool valid() const { return n_threads > 0 && n_threads_batch > 0 && n_batch > 0 && n_ubatch > 0; }
+    std::string describe() const;
+};
+
+// Fingerprint of the cores a result was measured on: their count, capacities
+// and maximum frequencies. Changes with a different SoC, not with the load.
+uint64_t cpuSignature(const CpuTopology& topology);
+
+// Thread counts worth timing: half the performance cores, all but one of them,
+// all of them, and every online core
+std::vector<int> tuneThreadCandidates(const CpuTopology& topology, int n_cpus);
+
+// n_ubatch sizes halving from max_ubatch down to min_size
+std::vector<uint32_t> tuneUbatchCandidates(uint32_t max_ubatch, uint32_t min_size = 32);
+
+// Results live in a small text file with one line per model and CPU; saving
+// replaces the matching line and rewrites the file through a temporary copy
+bool loadTuneConfig(const std::string& path, uint64_t model_hash, uint64_t cpu_signature, TuneConfig& config);
+bool saveTuneConfig(const std::string& path, uint64_t model_hash, uint64_t cpu_signature, const TuneConfig& config);
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include "context_planner.h"
+
+static const uint32_t BATCH_CANDIDATES[] = {128, 64, 32};
+
+uint64_t readAvailableMemoryBytes() {
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (f) {
+        char line[128];
+        unsigned long long kb = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+                fclose(f);
+                return (uint64_t) kb * 1024;
+            }
+        }
+        fclose(f);
+    }
+
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    return pages > 0 && page_size > 0 ? (uint64_t) pages * (uint64_t) page_size : 0;
+}
+
+static uint64_t kvBytes(const ContextPlanInput& in, uint32_t n_ctx, ggml_type type) {
+    if (in.n_head <= 0) return 0;
+    const int64_t n_embd_kv = in.n_head_kv * (in.n_embd / in.n_head);
+    return (uint64_t) in.n_layer * n_ctx * 2 * ggml_row_size(type, n_embd_kv);
+}
+
+// Output logits for a full batch, per-ubatch activations, and the KQ matrix
+// when flash attention is off (quantized KV types run with flash attention).
+static uint64_t computeBytes(const ContextPlanInput& in, uint32_t n_ctx, uint32_t n_batch, ggml_type type) {
+    uint64_t logits = (uint64_t) in.n_vocab * n_batch * sizeof(float);
+    uint64_t activations = (uint64_t) n_batch * in.n_embd * sizeof(float) * 16;
+    uint64_t attention = type == GGML_TYPE_F16 ? (uint64_t) n_batch * n_ctx * in.n_head * sizeof(float) : 0;
+    return logits + activations + attention;
+}
+
+ContextPlan planContext(const ContextPlanInput& in) {
+    ContextPlan plan;
+    plan.model_bytes = in.model_bytes;
+    plan.budget_bytes = in.budget_bytes > 0 ? in.budget_bytes
+                                            : (uint64_t) (in.available_bytes * in.budget_fraction);
+
+    uint32_t max_ctx = in.max_ctx;
+    if (in.n_ctx_train > 0 && (uint64_t) in.n_ctx_train < max_ctx) {
+        max_ctx = (uint32_t) in.n_ctx_train;
+    }
+    const uint32_t min_ctx = std::min(in.min_ctx, max_ctx);
+    const std::vector<ggml_type> kv_types = in.kv_types.empty() ? std::vector<ggml_type>{GGML_TYPE_F16} : in.kv_types;
+
+    uint32_t n_ctx = max_ctx;
+    while (true) {
+        for (ggml_type type : kv_types) {
+            for (uint32_t n_batch : BATCH_CANDIDATES) {
+                uint64_t kv = kvBytes(in, n_ctx, type);
+                uint64_t compute = computeBytes(in, n_ctx, n_batch, type);
+                if (in.model_bytes + kv + compute > plan.budget_bytes) continue;
+
+                plan.n_ctx = n_ctx;
+                plan.n_batch = n_batch;
+                plan.n_ubatch = n_batch;
+                plan.kv_type = type;
+                plan.kv_bytes = kv;
+                plan.compute_bytes = compute;
+                plan.fits = true;
+                return plan;
+            }
+        }
+        if (n_ctx <= min_ctx) break;
+        n_ctx = std::max(n_ctx / 2, min_ctx);  // halve, but always try min_ctx last
+    }
+
+    // Nothing fits: take the smallest configuration and let the caller decide
+    plan.n_ctx = min_ctx;
+    plan.n_batch = BATCH_CANDIDATES[sizeof(BATCH_CANDIDATES) / sizeof(BATCH_CANDIDATES[0]) - 1];
+    plan.n_ubatch = plan.n_batch;
+    plan.kv_type = kv_types.back();
+    plan.kv_bytes = kvBytes(in, plan.n_ctx, plan.kv_type);
+    plan.compute_bytes = computeBytes(in, plan.n_ctx, plan.n_batch, plan.kv_type);
+    plan.fits = false;
+    return plan;
+}
+
+std::string ContextPlan::describe() const {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "n_ctx=%u n_batch=%u n_ubatch=%u kv=%s kv_bytes=%.1fMiB compute=%.1fMiB model=%.1fMiB budget=%.1fMiB%s",
+             n_ctx, n_batch, n_ubatch, ggml_type_name(kv_type),
+             kv_bytes / 1048576.0, compute_bytes / 1048576.0, model_bytes / 1048576.0,
+             budget_bytes / 1048576.0, fits ? "" : " (over budget)");
+    return buf;
+}
@@ -0,0 +1,53 @@
+#ifndef CONTEXT_PLANNER_H
+#define CONTEXT_PLANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "include/ggml.h"
+
+// Model dimensions and memory limits the plan is computed from
+struct ContextPlanInput {
+    uint64_t model_bytes = 0;        // llama_model_size
+    int64_t n_layer = 0;
+    int64_t n_head = 0;
+    int64_t n_head_kv = 0;
+    int64_t n_embd = 0;
+    int64_t n_vocab = 0;
+    int64_t n_ctx_train = 0;
+
+    uint64_t available_bytes = 0;    // free system memory (see readAvailableMemoryBytes)
+    uint64_t budget_bytes = 0;       // explicit total budget; 0 = budget_fraction of available_bytes
+    double budget_fraction = 0.6;
+
+    uint32_t max_ctx = 16384;
+    uint32_t min_ctx = 2048;
+
+    // KV types to consider, highest precision first
+    std::vector<ggml_type> kv_types = {GGML_TYPE_F16};
+};
+
+struct ContextPlan {
+    uint32_t n_ctx = 0;
+    uint32_t n_batch = 0;
+    uint32_t n_ubatch = 0;
+    ggml_type kv_type = GGML_TYPE_F16;
+
+    uint64_t kv_bytes = 0;
+    uint64_t compute_bytes = 0;      // rough graph + output buffer estimate
+    uint64_t model_bytes = 0;
+    uint64_t budget_bytes = 0;
+    bool fits = false;               // false when even the smallest plan exceeds the budget
+
+    std::string describe() const;
+};
+
+// MemAvailable from /proc/meminfo, falling back to free physical pages
+uint64_t readAvailableMemoryBytes();
+
+// Largest context first, then the most precise KV type, then the largest batch
+// that keeps weights + KV cache + compute buffers inside the budget.
+ContextPlan planContext(const ContextPlanInput& input);
+
+#endif // CONTEXT_PLANNER_H
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include "cpu_topology.h"
+
+// Speed levels closer than this ratio count as one cluster
+static const double SAME_CLUSTER_RATIO = 0.8;
+
+static bool readUint64(const std::string& path, uint64_t& value) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return false;
+    unsigned long long v = 0;
+    bool ok = fscanf(f, "%llu", &v) == 1;
+    fclose(f);
+    if (ok) value = v;
+    return ok;
+}
+
+std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+        int first = 0, last = 0, n = 0;
+        if (sscanf(p, "%d-%d%n", &first, &last, &n) == 2) {
+            for (int id = first; id <= last; ++id) cpus.push_back(id);
+            p += n;
+        } else if (sscanf(p, "%d%n", &first, &n) == 1) {
+            cpus.push_back(first);
+            p += n;
+        } else {
+            ++p;
+        }
+        while (*p == ',' || *p == '\n' || *p == ' ') ++p;
+    }
+    return cpus;
+}
+
+static std::vector<int> onlineCpus(const std::string& dir) {
+    FILE* f = fopen((dir + "/online").c_str(), "r");
+    if (f) {
+        char buf[256] = {0};
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        std::vector<int> cpus = parseCpuList(std::string(buf, n));
+        if (!cpus.empty()) return cpus;
+    }
+
+    // No online list: every cpuN directory
+    std::vector<int> cpus;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            int id = 0;
+            char rest = 0;
+            if (sscanf(entry->d_name, "cpu%d%c", &id, &rest) == 1) cpus.push_back(id);
+        }
+        closedir(d);
+    }
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+CpuTopology probeCpuTopology(const std::string& dir) {
+    CpuTopology topo;
+    bool have_capacity = false;
+    for (int id : onlineCpus(dir)) {
+        const std::string cpu_dir = dir + "/cpu" + std::to_string(id);
+        CpuCore core;
+        core.id = id;
+        uint64_t value = 0;
+        if (readUint64(cpu_dir + "/cpu_capacity", value)) {
+            core.capacity = (uint32_t) value;
+            have_capacity = have_capacity || value > 0;
+        }
+        if (readUint64(cpu_dir + "/cpufreq/cpuinfo_max_freq", value)) {
+            core.max_freq_khz = value;
+        }
+        topo.cores.push_back(core);
+    }
+
+    auto score = [have_capacity](const CpuCore& c) -> uint64_t {
+        return have_capacity ? c.capacity : c.max_freq_khz;
+    };
+
+    // Distinct speed levels, fastest first; cut at the largest relative drop
+    std::vector<uint64_t> levels;
+    for (const CpuCore& c : topo.cores) levels.push_back(score(c));
+    std::sort(levels.rbegin(), levels.rend());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+
+    uint64_t threshold = 0;
+    double worst_ratio = SAME_CLUSTER_RATIO;
+    for (size_t i = 0; i + 1 < levels.size(); ++i) {
+        const double ratio = levels[i] > 0 ? (double) levels[i + 1] / levels[i] : 1.0;
+        if (ratio < worst_ratio) {
+            worst_ratio = ratio;
+            threshold = levels[i];
+        }
+    }
+
+    for (const CpuCore& c : topo.cores) {
+        if (score(c) >= threshold) topo.performance.push_back(c.id);
+    }
+    return topo;
+}
+
+void fillCpuMask(const std::vector<int>& cpus, bool* mask, size_t mask_size) {
+    for (int id : cpus) {
+        if (id >= 0 && (size_t) id < mask_size) mask[id] = true;
+    }
+}
+
+bool pinCurrentThread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int id : cpus) {
+        if (id >= 0 && id < CPU_SETSIZE) CPU_SET(id, &set);
+    }
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+std::string CpuTopology::describe() const {
+    std::string out;
+    char buf[96];
+    for (const CpuCore& c : cores) {
+        const bool perf = std::find(performance.begin(), performance.end(), c.id) != performance.end();
+        snprintf(buf, sizeof(buf), "%scpu%d(cap=%u, %.2fGHz%s)", out.empty() ? "" : " ", c.id, c.capacity,
+                 c.max_freq_khz / 1e6, perf ? ", perf" : "");
+        out += buf;
+    }
+    return out.empty() ? "no cpu information" : out;
+}
@@ -0,0 +1,38 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CpuCore {
+    int id = 0;
+    uint32_t capacity = 0;           // cpu_capacity (arm/arm64), 0 if the kernel has none
+    uint64_t max_freq_khz = 0;       // cpufreq/cpuinfo_max_freq, 0 if unavailable
+};
+
+struct CpuTopology {
+    std::vector<CpuCore> cores;      // online cores
+    std::vector<int> performance;    // ids of the fastest cores, all of them on symmetric CPUs
+
+    bool heterogeneous() const { return !performance.empty() && performance.size() < cores.size(); }
+    std::string describe() const;
+};
+
+// Reads the online cores with their capacity and maximum frequency from sysfs.
+// Cores are ranked by capacity when the kernel reports it, else by frequency;
+// the performance set ends at the largest step down between speed levels
+// (e.g. prime + big cores, without the little ones).
+CpuTopology probeCpuTopology(const std::string& sysfs_cpu_dir = "/sys/devices/system/cpu");
+
+// Expands a kernel cpu list such as "0-3,5,7-8" (cpu/online) into ids
+std::vector<int> parseCpuList(const std::string& list);
+
+// Sets mask[id] for every core in cpus (ids past mask_size are ignored)
+void fillCpuMask(const std::vector<int>& cpus, bool* mask, size_t mask_size);
+
+// Restricts the calling thread to cpus; false if none is valid or the kernel refuses
+bool pinCurrentThread(const std::vector<int>& cpus);
+
+#endif // CPU_TOPOLOGY_H
@@ -0,0 +1,96 @@
+#include <android/log.h>
+#include <exception>
+#include "inference_thread.h"
+
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "InferenceThread", __VA_ARGS__)
+
+// Requests tend to come in bursts (generate, then the stats getters), so the
+// thread yields this many times on an empty queue before it goes to sleep
+static const int IDLE_SPINS = 64;
+
+InferenceThread::InferenceThread(Task on_start, Task on_exit)
+        : m_head(new Node()), m_sleeping(false), m_stopping(false), m_completed(0) {
+    m_tail = m_head.load();
+    m_thread = std::thread(&InferenceThread::run, this, std::move(on_start), std::move(on_exit));
+}
+
+InferenceThread::~InferenceThread() {
+    m_stopping.store(true);
+    wake();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    delete m_tail;
+}
+
+void InferenceThread::post(Task task) {
+    Node* node = new Node();
+    node->task = std::move(task);
+    Node* prev = m_head.exchange(node);
+    prev->next.store(node);
+
+    if (m_sleeping.load()) {
+        wake();
+    }
+}
+
+bool InferenceThread::pop(Task& task) {
+    Node* next = m_tail->next.load();
+    if (!next) return false;
+
+    task = std::move(next->task);
+    delete m_tail;
+    m_tail = next;
+    return true;
+}
+
+bool InferenceThread::hasPending() const {
+    return m_tail->next.load() != nullptr;
+}
+
+void InferenceThread::wake() {
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    m_sleeping.store(false);
+    m_wake.notify_one();
+}
+
+void InferenceThread::run(const Task& on_start, const Task& on_exit) {
+    if (on_start) on_start();
+
+    Task task;
+    int idle = 0;
+    while (true) {
+        if (pop(task)) {
+            try {
+                task();
+            } catch (const std::exception& e) {
+                LOGE("Exception in queued task: %s", e.what());
+            } catch (...) {
+                LOGE("Unknown exception in queued task");
+            }
+            task = Task();
+            m_completed.fetch_add(1, std::memory_order_relaxed);
+            idle = 0;
+            continue;
+        }
+
+        if (m_stopping.load()) break;
+        if (idle++ < IDLE_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Announce the sleep before the last look at the queue; a producer
+        // linking a node after that look sees the flag and wakes us
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_sleeping.store(true);
+        if (hasPending() || m_stopping.load()) {
+            m_sleeping.store(false);
+            continue;
+        }
+        m_wake.wait(lock, [this]() { return !m_sleeping.load(); });
+        idle = 0;
+    }
+
+    if (on_exit) on_exit();
+}
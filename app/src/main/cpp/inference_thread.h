@@ -0,0 +1,69 @@
+#ifndef INFERENCE_THREAD_H
+#define INFERENCE_THREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// One long-lived thread that owns the model and runs every request in the
+// order it was queued. Callers on any thread push into a lock-free
+// multi-producer queue; a mutex is only taken to wake the thread when it was
+// idle long enough to go to sleep.
+class InferenceThread {
+public:
+    typedef std::function<void()> Task;
+
+    // on_start / on_exit run on the new thread itself (e.g. JVM attach, affinity)
+    explicit InferenceThread(Task on_start = Task(), Task on_exit = Task());
+    // Runs whatever is still queued, then joins
+    ~InferenceThread();
+
+    InferenceThread(const InferenceThread&) = delete;
+    InferenceThread& operator=(const InferenceThread&) = delete;
+
+    // Fire and forget; exceptions are logged and dropped
+    void post(Task task);
+
+    // Queues fn and returns a future for its result or exception
+    template <typename F>
+    auto submit(F fn) -> std::future<decltype(fn())> {
+        typedef decltype(fn()) Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(fn));
+        std::future<Result> result = task->get_future();
+        post([task]() { (*task)(); });
+        return result;
+    }
+
+    bool isCurrentThread() const { return std::this_thread::get_id() == m_thread.get_id(); }
+    uint64_t completedTasks() const { return m_completed.load(std::memory_order_relaxed); }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        Task task;
+    };
+
+    void run(const Task& on_start, const Task& on_exit);
+    bool pop(Task& task);
+    bool hasPending() const;
+    void wake();
+
+    // Vyukov MPSC list: producers swap themselves in at m_head, the consumer
+    // walks from m_tail, which always points at an already consumed node
+    std::atomic<Node*> m_head;
+    Node* m_tail;
+
+    std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_stopping;
+    std::atomic<uint64_t> m_completed;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    std::thread m_thread;
+};
+
+#endif // INFERENCE_THREAD_H
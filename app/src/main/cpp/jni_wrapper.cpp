@@ -1,42 +1,271 @@
 #include <jni.h>
+#include <cstdio>
 #include <android/log.h>
+#include <atomic>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include "inference_thread.h"
 #include "llama_wrapper.h"
+#include "text_encoding.h"
 
 #define LOG_TAG "JNIWrapper"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
-// Global instance of LlamaWrapper
-static std::unique_ptr<LlamaWrapper> g_llamaWrapper;
+// Global instance of LlamaWrapper. Only the inference thread uses it; other
+// threads may only take an atomic copy to cancel the running request.
+static std::shared_ptr<LlamaWrapper> g_llamaWrapper;
 
-// Helper function to convert jstring to std::string
+// The settings below are likewise only read and written on the inference thread
+// Memory budget for the context planner; survives re-initialization with another model
+static uint64_t g_memoryBudgetBytes = 0;
+// Prompt-lookup draft length, re-applied to every model load
+static int g_promptLookupDraft = 0;
+// Decode / prefill thread counts; 0 keeps the wrapper's defaults
+static int g_decodeThreads = 0;
+static int g_batchThreads = 0;
+// Autotune results file; empty disables the autotuner
+static std::string g_autotuneFile;
+// Sampling profile for the next requests, also applied to newly loaded models
+static SamplingProfile g_samplingProfile;
+// Bumped for every typed draft; queued drafts that were superseded are skipped
+static std::atomic<uint64_t> g_draftSerial(0);
+
+// Results of the last request, published by the inference thread after every
+// queued task so the stat getters read them without waiting behind the queue
+struct StatsSnapshot {
+    bool loaded = false;    // a wrapper exists, possibly without a model
+    bool initialized = false;
+    int last_reused_tokens = 0;
+    LlamaWrapper::StopReason last_stop_reason = LlamaWrapper::STOP_NONE;
+    SessionCache::Stats session_cache;
+    std::vector<LlamaWrapper::PrefillChunkTiming> prefill_timings;
+    LlamaWrapper::SpeculativeStats speculative;
+    size_t kv_cache_bytes = 0;
+    ContextPlan context_plan;
+    TuneConfig tune_config;
+    CpuTopology cpu_topology;
+};
+static std::mutex g_statsMutex;
+static StatsSnapshot g_stats;
+// Cleanups posted but not yet run; until they have, no model is reported even
+// when a request still running ahead of them publishes its stats
+static std::atomic<int> g_pendingCleanups(0);
+
+static JavaVM* g_javaVm = nullptr;
+// JNIEnv of the inference thread, for token listeners called while generating
+static JNIEnv* g_inferenceEnv = nullptr;
+
+// Started on first use and never destroyed: joining an attached thread from a
+// static destructor at process exit could hang. The thread is attached to the
+// JVM for token callbacks and kept on the performance cores, where ggml runs
+// its share of every graph.
+static InferenceThread& inferenceThread() {
+    static InferenceThread* thread = new InferenceThread(
+            []() {
+                CpuTopology topology = probeCpuTopology();
+                if (topology.heterogeneous() && !pinCurrentThread(topology.performance)) {
+                    LOGE("Could not pin the inference thread to the performance cores");
+                }
+                JavaVMAttachArgs args = {JNI_VERSION_1_6, "llama-inference", nullptr};
+                if (!g_javaVm || g_javaVm->AttachCurrentThreadAsDaemon(&g_inferenceEnv, &args) != JNI_OK) {
+                    g_inferenceEnv = nullptr;
+                    LOGE("Could not attach the inference thread, token streaming disabled");
+                }
+            },
+            []() {
+                if (g_javaVm && g_inferenceEnv) g_javaVm->DetachCurrentThread();
+                g_inferenceEnv = nullptr;
+            });
+    return *thread;
+}
+
+// Inference thread only
+static void publishStats() {
+    StatsSnapshot stats;
+    if (g_llamaWrapper) {
+        const LlamaWrapper& wrapper = *g_llamaWrapper;
+        stats.loaded = true;
+        stats.initialized = wrapper.isInitialized() && g_pendingCleanups.load() == 0;
+        stats.last_reused_tokens = wrapper.getLastReusedTokens();
+        stats.last_stop_reason = wrapper.getLastStopReason();
+        stats.session_cache = wrapper.getSessionCacheStats();
+        stats.prefill_timings = wrapper.getLastPrefillTimings();
+        stats.speculative = wrapper.getLastSpeculativeStats();
+        stats.kv_cache_bytes = wrapper.getKvCacheBytes();
+        stats.context_plan = wrapper.getContextPlan();
+        if (stats.initialized) {
+            stats.tune_config = wrapper.getTuneConfig();
+            stats.cpu_topology = wrapper.getCpuTopology();
+        }
+    }
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    g_stats = std::move(stats);
+}
+
+// Any thread; the lock is only held for the copy, never across a request
+static StatsSnapshot readStats() {
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    return g_stats;
+}
+
+// Publishes when the queued task ends, before a waiting caller is released
+struct PublishStatsOnExit {
+    ~PublishStatsOnExit() { publishStats(); }
+};
+
+// Runs fn on the inference thread and waits for it; exceptions are rethrown
+// here. Calls made from the inference thread itself (token listeners) run inline.
+template <typename F>
+static auto runOnInferenceThread(F fn) -> decltype(fn()) {
+    InferenceThread& thread = inferenceThread();
+    if (thread.isCurrentThread()) return fn();
+    return thread.submit([fn]() {
+        PublishStatsOnExit publish;
+        return fn();
+    }).get();
+}
+
+// Queues fn behind the running request without waiting for it
+template <typename F>
+static void postToInferenceThread(F fn) {
+    InferenceThread& thread = inferenceThread();
+    if (thread.isCurrentThread()) {
+        fn();
+    } else {
+        thread.post([fn]() {
+            PublishStatsOnExit publish;
+            fn();
+        });
+    }
+}
+
+// Global reference keeping a listener alive for the inference thread while the
+// calling JNI thread waits for the request
+struct ListenerRef {
+    JNIEnv* env;
+    jobject ref;
+    ListenerRef(JNIEnv* e, jobject listener) : env(e), ref(listener ? e->NewGlobalRef(listener) : nullptr) {}
+    ~ListenerRef() {
+        if (ref) env->DeleteGlobalRef(ref);
+    }
+};
+
+// Helper function to convert jstring to std::string (UTF-8)
 std::string jstring_to_string(JNIEnv* env, jstring jstr) {
     if (jstr == nullptr) return "";
 
-    const char* chars = env->GetStringUTFChars(jstr, nullptr);
-    if (chars == nullptr) return "";
+    // Read as UTF-16: GetStringUTFChars would hand llama.cpp modified UTF-8,
+    // with emoji split into two 3-byte surrogates
+    const jsize length = env->GetStringLength(jstr);
+    std::u16string chars((size_t) length, u'\0');
+    env->GetStringRegion(jstr, 0, length, reinterpret_cast<jchar*>(&chars[0]));
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return "";
+    }
+    return utf16ToUtf8(chars.data(), chars.size());
+}
+
+// Builds a Java string from UTF-8 text; NewStringUTF only accepts modified UTF-8
+// and fails (or aborts under CheckJNI) on the 4-byte sequences of emoji
+static jstring string_to_jstring(JNIEnv* env, const std::string& text) {
+    const std::u16string chars = utf8ToUtf16(text);
+    return env->NewString(reinterpret_cast<const jchar*>(chars.data()), (jsize) chars.size());
+}
+
+// Forwards each decoded piece to listener.onToken(String). Generation runs on the
+// inference thread, so env is that thread's and listener a global reference.
+static LlamaWrapper::TokenCallback makeTokenCallback(JNIEnv* env, jobject listener) {
+    if (env == nullptr || listener == nullptr) return LlamaWrapper::TokenCallback();
 
-    std::string result(chars);
-    env->ReleaseStringUTFChars(jstr, chars);
-    return result;
+    jclass listener_class = env->GetObjectClass(listener);
+    jmethodID on_token = env->GetMethodID(listener_class, "onToken", "(Ljava/lang/String;)V");
+    env->DeleteLocalRef(listener_class);
+    if (on_token == nullptr) {
+        env->ExceptionClear();
+        LOGE("Token listener has no onToken(String) method");
+        return LlamaWrapper::TokenCallback();
+    }
+
+    return [env, listener, on_token](const std::string& piece) {
+        jstring jpiece = string_to_jstring(env, piece);
+        if (jpiece == nullptr) {
+            env->ExceptionClear();
+            return;
+        }
+        env->CallVoidMethod(listener, on_token, jpiece);
+        env->DeleteLocalRef(jpiece);
+        if (env->ExceptionCheck()) {
+            LOGE("Exception thrown by token listener");
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+        }
+    };
+}
+
+// Forwards autotune progress to listener.onProgress(int, int) on the inference thread
+static LlamaWrapper::ProgressCallback makeProgressCallback(JNIEnv* env, jobject listener) {
+    if (env == nullptr || listener == nullptr) return LlamaWrapper::ProgressCallback();
+
+    jclass listener_class = env->GetObjectClass(listener);
+    jmethodID on_progress = env->GetMethodID(listener_class, "onProgress", "(II)V");
+    env->DeleteLocalRef(listener_class);
+    if (on_progress == nullptr) {
+        env->ExceptionClear();
+        LOGE("Progress listener has no onProgress(int, int) method");
+        return LlamaWrapper::ProgressCallback();
+    }
+
+    return [env, listener, on_progress](int done, int total) {
+        env->CallVoidMethod(listener, on_progress, (jint) done, (jint) total);
+        if (env->ExceptionCheck()) {
+            LOGE("Exception thrown by progress listener");
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+        }
+    };
 }
 
 extern "C" {
 
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+    g_javaVm = vm;
+    return JNI_VERSION_1_6;
+}
+
 JNIEXPORT jboolean JNICALL
-Java_com_example_localaiindia_LlamaService_nativeInitialize(JNIEnv* env, jobject thiz, jstring modelPath) {
+Java_com_example_localaiindia_LlamaService_nativeInitialize(JNIEnv* env, jobject thiz, jstring modelPath, jint kvPrecision) {
     try {
         LOGI("JNI nativeInitialize called");
 
         std::string model_path = jstring_to_string(env, modelPath);
         LOGI("Model path: %s", model_path.c_str());
 
-        // Create new wrapper instance
-        g_llamaWrapper = std::make_unique<LlamaWrapper>();
+        bool success = runOnInferenceThread([&]() {
+            // Free the previous model here; a cancel may still hold a copy of its wrapper
+            if (g_llamaWrapper) {
+                g_llamaWrapper->cleanup();
+            }
 
-        bool success = g_llamaWrapper->initialize(model_path);
+            // Create new wrapper instance
+            std::shared_ptr<LlamaWrapper> wrapper = std::make_shared<LlamaWrapper>();
+            wrapper->setMemoryBudget(g_memoryBudgetBytes);
+            wrapper->setSamplingProfile(g_samplingProfile);
+            wrapper->setAutotuneFile(g_autotuneFile);
+            if (g_decodeThreads > 0 && g_batchThreads > 0) {
+                wrapper->setThreadCounts(g_decodeThreads, g_batchThreads);
+            }
+            std::atomic_store(&g_llamaWrapper, wrapper);
+
+            bool initialized = wrapper->initialize(model_path, static_cast<LlamaWrapper::KvPrecision>(kvPrecision));
+            if (initialized) {
+                wrapper->setPromptLookup(g_promptLookupDraft);
+            }
+            return initialized;
+        });
         LOGI("Initialization result: %s", success ? "SUCCESS" : "FAILED");
 
         return success ? JNI_TRUE : JNI_FALSE;
@@ -51,20 +280,21 @@ Java_com_example_localaiindia_LlamaService_nativeInitialize(JNIEnv* env, jobject
 }
 
 JNIEXPORT jstring JNICALL
-Java_com_example_localaiindia_LlamaService_nativeGenerateResponse(JNIEnv* env, jobject thiz, jstring prompt) {
+Java_com_example_localaiindia_LlamaService_nativeGenerateResponse(JNIEnv* env, jobject thiz, jstring prompt, jobject listener) {
     try {
-        if (!g_llamaWrapper) {
-            LOGE("LlamaWrapper not initialized");
-            return env->NewStringUTF("Error: Model not initialized");
-        }
-
         std::string input_prompt = jstring_to_string(env, prompt);
-        LOGI("Generating response for prompt length: %zu", input_prompt.length());
-
-        std::string response = g_llamaWrapper->generateResponse(input_prompt);
+        ListenerRef listener_ref(env, listener);
+        std::string response = runOnInferenceThread([&]() -> std::string {
+            if (!g_llamaWrapper) {
+                LOGE("LlamaWrapper not initialized");
+                return "Error: Model not initialized";
+            }
+            LOGI("Generating response for prompt length: %zu", input_prompt.length());
+            return g_llamaWrapper->generateResponse(input_prompt, makeTokenCallback(g_inferenceEnv, listener_ref.ref));
+        });
         LOGI("Generated response length: %zu", response.length());
 
-        return env->NewStringUTF(response.c_str());
+        return string_to_jstring(env, response);
 
     } catch (const std::exception& e) {
         LOGE("Exception in nativeGenerateResponse: %s", e.what());
@@ -75,15 +305,537 @@ Java_com_example_localaiindia_LlamaService_nativeGenerateResponse(JNIEnv* env, j
     }
 }
 
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeRegenerateResponse(JNIEnv* env, jobject thiz, jstring prompt, jobject listener) {
+    try {
+        std::string input_prompt = jstring_to_string(env, prompt);
+        ListenerRef listener_ref(env, listener);
+        std::string response = runOnInferenceThread([&]() -> std::string {
+            if (!g_llamaWrapper) {
+                LOGE("LlamaWrapper not initialized");
+                return "Error: Model not initialized";
+            }
+            LOGI("Regenerating response for prompt length: %zu", input_prompt.length());
+            return g_llamaWrapper->regenerateResponse(input_prompt, makeTokenCallback(g_inferenceEnv, listener_ref.ref));
+        });
+        LOGI("Regenerated response length: %zu", response.length());
+
+        return string_to_jstring(env, response);
+
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeRegenerateResponse: %s", e.what());
+        return env->NewStringUTF("Error generating response");
+    } catch (...) {
+        LOGE("Unknown exception in nativeRegenerateResponse");
+        return env->NewStringUTF("Error generating response");
+    }
+}
+
+JNIEXPORT jint JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetLastReusedTokens(JNIEnv* env, jobject thiz) {
+    try {
+        return readStats().last_reused_tokens;
+    } catch (...) {
+        return 0;
+    }
+}
+
+// Bypasses the queue: the request to cancel is the one occupying the inference thread
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeCancelGeneration(JNIEnv* env, jobject thiz) {
+    try {
+        std::shared_ptr<LlamaWrapper> wrapper = std::atomic_load(&g_llamaWrapper);
+        if (wrapper) {
+            wrapper->cancelGeneration();
+        }
+    } catch (...) {
+        LOGE("Unknown exception in nativeCancelGeneration");
+    }
+}
+
+JNIEXPORT jint JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetLastStopReason(JNIEnv* env, jobject thiz) {
+    try {
+        return (jint) readStats().last_stop_reason;
+    } catch (...) {
+        return (jint) LlamaWrapper::STOP_NONE;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeResetConversation(JNIEnv* env, jobject thiz) {
+    try {
+        postToInferenceThread([]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->resetConversation();
+            }
+        });
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeResetConversation: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception in nativeResetConversation");
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeStartNewChat(JNIEnv* env, jobject thiz) {
+    try {
+        postToInferenceThread([]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->startNewChat();
+            }
+        });
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeStartNewChat: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception in nativeStartNewChat");
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSaveSession(JNIEnv* env, jobject thiz, jstring dir, jstring sessionId) {
+    try {
+        std::string dir_path = jstring_to_string(env, dir);
+        std::string session_id = jstring_to_string(env, sessionId);
+        bool saved = runOnInferenceThread([&]() {
+            return g_llamaWrapper && g_llamaWrapper->saveSession(dir_path, session_id);
+        });
+        return saved ? JNI_TRUE : JNI_FALSE;
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeSaveSession: %s", e.what());
+        return JNI_FALSE;
+    } catch (...) {
+        LOGE("Unknown exception in nativeSaveSession");
+        return JNI_FALSE;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_example_localaiindia_LlamaService_nativeRestoreSession(JNIEnv* env, jobject thiz, jstring dir, jstring sessionId) {
+    try {
+        std::string dir_path = jstring_to_string(env, dir);
+        std::string session_id = jstring_to_string(env, sessionId);
+        bool restored = runOnInferenceThread([&]() {
+            return g_llamaWrapper && g_llamaWrapper->restoreSession(dir_path, session_id);
+        });
+        return restored ? JNI_TRUE : JNI_FALSE;
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeRestoreSession: %s", e.what());
+        return JNI_FALSE;
+    } catch (...) {
+        LOGE("Unknown exception in nativeRestoreSession");
+        return JNI_FALSE;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeDeleteSession(JNIEnv* env, jobject thiz, jstring dir, jstring sessionId) {
+    try {
+        std::string dir_path = jstring_to_string(env, dir);
+        std::string session_id = jstring_to_string(env, sessionId);
+        postToInferenceThread([dir_path, session_id]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->deleteSession(dir_path, session_id);
+            }
+        });
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeDeleteSession: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception in nativeDeleteSession");
+    }
+}
+
+// Returns at once; the prefill runs when the inference thread is idle
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativePrefillDraft(JNIEnv* env, jobject thiz, jstring sessionId, jstring partialText) {
+    try {
+        std::string session_id = jstring_to_string(env, sessionId);
+        std::string text = jstring_to_string(env, partialText);
+        const uint64_t serial = ++g_draftSerial;
+        postToInferenceThread([serial, session_id, text]() {
+            if (serial != g_draftSerial.load() || !g_llamaWrapper) return;
+            g_llamaWrapper->prefillDraft(session_id, text);
+        });
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativePrefillDraft: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception in nativePrefillDraft");
+    }
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeBenchmarkSessionFormats(JNIEnv* env, jobject thiz, jstring dir) {
+    try {
+        std::string dir_path = jstring_to_string(env, dir);
+        std::string report = runOnInferenceThread([&]() -> std::string {
+            return g_llamaWrapper ? g_llamaWrapper->benchmarkSessionFormats(dir_path) : "Error: Model not initialized";
+        });
+        return string_to_jstring(env, report);
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeBenchmarkSessionFormats: %s", e.what());
+        return env->NewStringUTF("Error running session benchmark");
+    } catch (...) {
+        LOGE("Unknown exception in nativeBenchmarkSessionFormats");
+        return env->NewStringUTF("Error running session benchmark");
+    }
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeBenchmarkDetokenizer(JNIEnv* env, jobject thiz, jint iterations) {
+    try {
+        std::string report = runOnInferenceThread([iterations]() -> std::string {
+            return g_llamaWrapper ? g_llamaWrapper->benchmarkDetokenizer(iterations) : "Error: Model not initialized";
+        });
+        return string_to_jstring(env, report);
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeBenchmarkDetokenizer: %s", e.what());
+        return env->NewStringUTF("Error running detokenizer benchmark");
+    } catch (...) {
+        LOGE("Unknown exception in nativeBenchmarkDetokenizer");
+        return env->NewStringUTF("Error running detokenizer benchmark");
+    }
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeBenchmarkSampling(JNIEnv* env, jobject thiz, jint iterations) {
+    try {
+        std::string report = runOnInferenceThread([iterations]() -> std::string {
+            return g_llamaWrapper ? g_llamaWrapper->benchmarkSampling(iterations) : "Error: Model not initialized";
+        });
+        return string_to_jstring(env, report);
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeBenchmarkSampling: %s", e.what());
+        return env->NewStringUTF("Error running sampling benchmark");
+    } catch (...) {
+        LOGE("Unknown exception in nativeBenchmarkSampling");
+        return env->NewStringUTF("Error running sampling benchmark");
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetSessionCacheBudget(JNIEnv* env, jobject thiz, jlong bytes) {
+    try {
+        if (bytes < 0) return;
+        postToInferenceThread([bytes]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->setSessionCacheBudget((size_t) bytes);
+            }
+        });
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeSetSessionCacheBudget: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception in nativeSetSessionCacheBudget");
+    }
+}
+
+// Returns [hits, misses, evictions, bytesHeld, entries, budgetBytes]
+JNIEXPORT jlongArray JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetSessionCacheStats(JNIEnv* env, jobject thiz) {
+    jlong values[6] = {0, 0, 0, 0, 0, 0};
+    try {
+        const StatsSnapshot snapshot = readStats();
+        const SessionCache::Stats& stats = snapshot.session_cache;
+        if (snapshot.loaded) {
+            values[0] = (jlong) stats.hits;
+            values[1] = (jlong) stats.misses;
+            values[2] = (jlong) stats.evictions;
+            values[3] = (jlong) stats.bytes_held;
+            values[4] = (jlong) stats.entries;
+            values[5] = (jlong) stats.budget_bytes;
+        }
+    } catch (...) {
+        LOGE("Unknown exception in nativeGetSessionCacheStats");
+    }
+
+    jlongArray result = env->NewLongArray(6);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, 6, values);
+    }
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetPrefillChunkSize(JNIEnv* env, jobject thiz, jint nTokens) {
+    try {
+        postToInferenceThread([nTokens]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->setPrefillChunkSize(nTokens);
+            }
+        });
+    } catch (...) {
+        LOGE("Unknown exception in nativeSetPrefillChunkSize");
+    }
+}
+
+// Returns [tokens0, ms0, tokens1, ms1, ...] for the chunks of the last prefill
+JNIEXPORT jfloatArray JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetLastPrefillTimings(JNIEnv* env, jobject thiz) {
+    std::vector<jfloat> values;
+    try {
+        for (const auto& chunk : readStats().prefill_timings) {
+            values.push_back((jfloat) chunk.n_tokens);
+            values.push_back((jfloat) chunk.ms);
+        }
+    } catch (...) {
+        LOGE("Unknown exception in nativeGetLastPrefillTimings");
+    }
+
+    jfloatArray result = env->NewFloatArray((jsize) values.size());
+    if (result && !values.empty()) {
+        env->SetFloatArrayRegion(result, 0, (jsize) values.size(), values.data());
+    }
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetThreadCounts(JNIEnv* env, jobject thiz, jint decodeThreads, jint batchThreads) {
+    try {
+        if (decodeThreads <= 0 || batchThreads <= 0) return;
+        postToInferenceThread([decodeThreads, batchThreads]() {
+            g_decodeThreads = decodeThreads;
+            g_batchThreads = batchThreads;
+            if (g_llamaWrapper && g_llamaWrapper->isInitialized()) {
+                g_llamaWrapper->setThreadCounts(decodeThreads, batchThreads);
+            }
+        });
+    } catch (...) {
+        LOGE("Unknown exception in nativeSetThreadCounts");
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetAutotuneFile(JNIEnv* env, jobject thiz, jstring path) {
+    try {
+        std::string file = jstring_to_string(env, path);
+        LOGI("Autotune file: %s", file.empty() ? "(disabled)" : file.c_str());
+        postToInferenceThread([file]() { g_autotuneFile = file; });
+    } catch (...) {
+        LOGE("Unknown exception in nativeSetAutotuneFile");
+    }
+}
+
+// Measures the loaded model; cancelled like a generation. Returns the settings
+// found, or an empty string when tuning failed or was cancelled.
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeAutotune(JNIEnv* env, jobject thiz, jobject listener) {
+    try {
+        ListenerRef listener_ref(env, listener);
+        std::string tuning = runOnInferenceThread([&]() -> std::string {
+            if (!g_llamaWrapper || !g_llamaWrapper->isInitialized()) {
+                LOGE("LlamaWrapper not initialized");
+                return "";
+            }
+            if (!g_llamaWrapper->autotune(makeProgressCallback(g_inferenceEnv, listener_ref.ref))) {
+                return "";
+            }
+            return g_llamaWrapper->getTuneConfig().describe();
+        });
+        return string_to_jstring(env, tuning);
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeAutotune: %s", e.what());
+        return env->NewStringUTF("");
+    } catch (...) {
+        LOGE("Unknown exception in nativeAutotune");
+        return env->NewStringUTF("");
+    }
+}
+
+// Settings the autotuner picked for the loaded model, empty when it was not tuned
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetTuneConfig(JNIEnv* env, jobject thiz) {
+    try {
+        const TuneConfig tuning = readStats().tune_config;
+        return string_to_jstring(env, tuning.valid() ? tuning.describe() : "");
+    } catch (...) {
+        LOGE("Unknown exception in nativeGetTuneConfig");
+        return env->NewStringUTF("");
+    }
+}
+
+// Works without a loaded model so the probe can be checked on any device
+JNIEXPORT jstring JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetCpuTopology(JNIEnv* env, jobject thiz) {
+    try {
+        StatsSnapshot snapshot = readStats();
+        const CpuTopology topology = snapshot.initialized ? snapshot.cpu_topology : probeCpuTopology();
+        char header[96];
+        snprintf(header, sizeof(header), "%zu cores, %zu performance%s: ", topology.cores.size(),
+                 topology.performance.size(), topology.heterogeneous() ? "" : " (symmetric)");
+        return string_to_jstring(env, header + topology.describe());
+    } catch (...) {
+        LOGE("Unknown exception in nativeGetCpuTopology");
+        return env->NewStringUTF("Error reading CPU topology");
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetMemoryBudget(JNIEnv* env, jobject thiz, jlong bytes) {
+    const uint64_t budget = bytes > 0 ? (uint64_t) bytes : 0;
+    LOGI("Memory budget set to %lld bytes (0 = automatic)", (long long) budget);
+    postToInferenceThread([budget]() { g_memoryBudgetBytes = budget; });
+}
+
+// Returns [nCtx, nBatch, nUbatch, kvPrecision, kvBytes, computeBytes, modelBytes, budgetBytes, fits]
+JNIEXPORT jlongArray JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetContextPlan(JNIEnv* env, jobject thiz) {
+    jlong values[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    try {
+        const StatsSnapshot snapshot = readStats();
+        const ContextPlan& plan = snapshot.context_plan;
+        if (snapshot.loaded) {
+            values[0] = (jlong) plan.n_ctx;
+            values[1] = (jlong) plan.n_batch;
+            values[2] = (jlong) plan.n_ubatch;
+            values[3] = plan.kv_type == GGML_TYPE_Q4_0 ? LlamaWrapper::KV_Q4_0
+                      : plan.kv_type == GGML_TYPE_Q8_0 ? LlamaWrapper::KV_Q8_0 : LlamaWrapper::KV_F16;
+            values[4] = (jlong) plan.kv_bytes;
+            values[5] = (jlong) plan.compute_bytes;
+            values[6] = (jlong) plan.model_bytes;
+            values[7] = (jlong) plan.budget_bytes;
+            values[8] = plan.fits ? 1 : 0;
+        }
+    } catch (...) {
+        LOGE("Unknown exception in nativeGetContextPlan");
+    }
+
+    jlongArray result = env->NewLongArray(9);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, 9, values);
+    }
+    return result;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_example_localaiindia_LlamaService_nativeLoadDraftModel(JNIEnv* env, jobject thiz, jstring modelPath, jint nDraft) {
+    try {
+        std::string model_path = jstring_to_string(env, modelPath);
+        bool loaded = runOnInferenceThread([&]() {
+            if (!g_llamaWrapper) {
+                LOGE("LlamaWrapper not initialized");
+                return false;
+            }
+            return g_llamaWrapper->loadDraftModel(model_path, nDraft);
+        });
+        return loaded ? JNI_TRUE : JNI_FALSE;
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeLoadDraftModel: %s", e.what());
+        return JNI_FALSE;
+    } catch (...) {
+        LOGE("Unknown exception in nativeLoadDraftModel");
+        return JNI_FALSE;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeUnloadDraftModel(JNIEnv* env, jobject thiz) {
+    try {
+        postToInferenceThread([]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->unloadDraftModel();
+            }
+        });
+    } catch (...) {
+        LOGE("Unknown exception in nativeUnloadDraftModel");
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetSamplingProfile(JNIEnv* env, jobject thiz,
+        jfloat temperature, jint topK, jfloat topP, jfloat minP, jint penaltyLastN,
+        jfloat penaltyRepeat, jfloat penaltyFreq, jfloat penaltyPresent, jlong seed) {
+    try {
+        SamplingProfile profile;
+        profile.temperature = temperature;
+        profile.top_k = topK;
+        profile.top_p = topP;
+        profile.min_p = minP;
+        profile.penalty_last_n = penaltyLastN;
+        profile.penalty_repeat = penaltyRepeat;
+        profile.penalty_freq = penaltyFreq;
+        profile.penalty_present = penaltyPresent;
+        profile.seed = seed < 0 ? 0xFFFFFFFF : (uint32_t) seed;
+
+        bool applied = runOnInferenceThread([&]() {
+            g_samplingProfile = profile;
+            return !g_llamaWrapper || g_llamaWrapper->setSamplingProfile(profile);
+        });
+        return applied ? JNI_TRUE : JNI_FALSE;
+    } catch (const std::exception& e) {
+        LOGE("Exception in nativeSetSamplingProfile: %s", e.what());
+        return JNI_FALSE;
+    } catch (...) {
+        LOGE("Unknown exception in nativeSetSamplingProfile");
+        return JNI_FALSE;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_example_localaiindia_LlamaService_nativeSetPromptLookup(JNIEnv* env, jobject thiz, jint nDraft) {
+    try {
+        const int n_draft = nDraft > 0 ? nDraft : 0;
+        postToInferenceThread([n_draft]() {
+            g_promptLookupDraft = n_draft;
+            if (g_llamaWrapper && g_llamaWrapper->isInitialized()) {
+                g_llamaWrapper->setPromptLookup(n_draft);
+            }
+        });
+    } catch (...) {
+        LOGE("Unknown exception in nativeSetPromptLookup");
+    }
+}
+
+// Returns [drafted, accepted, generated, ms] for the last response
+JNIEXPORT jfloatArray JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetSpeculativeStats(JNIEnv* env, jobject thiz) {
+    jfloat values[4] = {0, 0, 0, 0};
+    try {
+        const StatsSnapshot snapshot = readStats();
+        const LlamaWrapper::SpeculativeStats& stats = snapshot.speculative;
+        if (snapshot.loaded) {
+            values[0] = (jfloat) stats.drafted;
+            values[1] = (jfloat) stats.accepted;
+            values[2] = (jfloat) stats.generated;
+            values[3] = (jfloat) stats.ms;
+        }
+    } catch (...) {
+        LOGE("Unknown exception in nativeGetSpeculativeStats");
+    }
+
+    jfloatArray result = env->NewFloatArray(4);
+    if (result) {
+        env->SetFloatArrayRegion(result, 0, 4, values);
+    }
+    return result;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_example_localaiindia_LlamaService_nativeGetKvCacheBytes(JNIEnv* env, jobject thiz) {
+    try {
+        return (jlong) readStats().kv_cache_bytes;
+    } catch (...) {
+        return 0;
+    }
+}
+
 JNIEXPORT void JNICALL
 Java_com_example_localaiindia_LlamaService_nativeCleanup(JNIEnv* env, jobject thiz) {
     try {
         LOGI("JNI nativeCleanup called");
-        if (g_llamaWrapper) {
-            g_llamaWrapper->cleanup();
-            g_llamaWrapper.reset();
+        // Reported before returning, so nativeIsInitialized never sees the old model
+        g_pendingCleanups.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(g_statsMutex);
+            g_stats.initialized = false;
         }
-        LOGI("Cleanup completed");
+        // Runs after the request in flight; a cancel issued before this call stops it early
+        postToInferenceThread([]() {
+            if (g_llamaWrapper) {
+                g_llamaWrapper->cleanup();
+                std::atomic_store(&g_llamaWrapper, std::shared_ptr<LlamaWrapper>());
+            }
+            g_pendingCleanups.fetch_sub(1);
+            LOGI("Cleanup completed");
+        });
     } catch (const std::exception& e) {
         LOGE("Exception in nativeCleanup: %s", e.what());
     } catch (...) {
@@ -94,8 +846,7 @@ Java_com_example_localaiindia_LlamaService_nativeCleanup(JNIEnv* env, jobject th
 JNIEXPORT jboolean JNICALL
 Java_com_example_localaiindia_LlamaService_nativeIsInitialized(JNIEnv* env, jobject thiz) {
     try {
-        bool initialized = g_llamaWrapper && g_llamaWrapper->isInitialized();
-        return initialized ? JNI_TRUE : JNI_FALSE;
+        return readStats().initialized ? JNI_TRUE : JNI_FALSE;
     } catch (...) {
         return JNI_FALSE;
     }
@@ -2,18 +2,86 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include <stdexcept>
 #include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <random>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "include/ggml-cpu.h"
 #include "include/llama.h"
 #include "llama_wrapper.h"
+#include "autotune.h"
+#include "cpu_topology.h"
+#include "logits_topk.h"
+#include "session_file.h"
+#include "stop_matcher.h"
+#include "stream_detokenizer.h"
 
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, "LlamaWrapper", __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "LlamaWrapper", __VA_ARGS__)
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "LlamaWrapper", __VA_ARGS__)
 
+// Sequence holding the system prompt snapshot; chats use the ones after it
+static const llama_seq_id SYSTEM_SEQ_ID = 0;
+static const llama_seq_id FIRST_CHAT_SEQ_ID = 1;
+
+// Chats kept decoded in the KV cache at the same time, each in its own sequence
+static const size_t MAX_RESIDENT_CHATS = 4;
+
+// Leading tokens that always stay in the KV cache when the context is shifted
+// (StreamingLLM attention sinks); the system prompt is kept as well when longer.
+static const size_t ATTENTION_SINK_TOKENS = 4;
+
+// Token count difference tolerated between target and draft vocabularies
+// (added special tokens); the shared ids must still match exactly
+static const int32_t MAX_DRAFT_VOCAB_DIFFERENCE = 128;
+
+// The sampling fast path is used while the candidates are at most this
+// fraction (1/n) of the vocabulary; beyond that the full array is as cheap
+static const size_t FAST_SAMPLE_MAX_VOCAB_SHARE = 8;
+
+// Upper bound on prompt-lookup drafts per step; long copied spans are still
+// consumed a few tokens at a time while a wrong guess costs little
+static const int MAX_PROMPT_LOOKUP_DRAFT = 16;
+
+// Autotune workload: a short prompt, then a short run of single-token steps
+static const size_t AUTOTUNE_PREFILL_TOKENS = 128;
+static const int AUTOTUNE_DECODE_STEPS = 16;
+static const uint32_t AUTOTUNE_CTX = 512;
+
+// New tokens per response, reserved in the context along with the prompt
+static const int MAX_RESPONSE_TOKENS = 256;
+
+// Draft prefill: tokens held back at the end of the settled text, since the
+// next keystroke may merge into them, and new tokens decoded per call so a
+// large paste cannot hold up a message that is sent meanwhile
+static const size_t DRAFT_HOLDBACK_TOKENS = 1;
+static const size_t MAX_DRAFT_PREFILL_TOKENS = 128;
+
+// RAM held by inactive chat states before the least recently used one goes to disk
+static const size_t DEFAULT_SESSION_CACHE_BYTES = 128u * 1024 * 1024;
+
 LlamaWrapper::LlamaWrapper()
         : m_initialized(false), m_model(nullptr), m_context(nullptr), m_sampler(nullptr),
-          m_current_model_type(MODEL_UNKNOWN), m_n_ctx(16384), m_n_threads(4) {  // UPDATED: 16K context, 4 threads
+          m_model_hash(0), m_current_model_type(MODEL_UNKNOWN), m_n_ctx(16384), m_n_threads(4), m_n_threads_batch(4),
+          m_thread_counts_set(false),
+          m_threadpool(nullptr), m_threadpool_batch(nullptr), m_kv_cache_bytes(0),
+          m_memory_budget_bytes(0),
+          m_last_turn_start(0), m_last_reused_tokens(0), m_draft_prefill_len(0), m_system_snapshot_ready(false),
+          m_batch(nullptr), m_prefill_chunk(0),
+          m_active_chat(0), m_chat_seq(FIRST_CHAT_SEQ_ID), m_chat_clock(0), m_last_stop_reason(STOP_NONE),
+          m_generating(false), m_cancel_requested(false), m_partial_rollback(false), m_draft_model(nullptr), m_draft_context(nullptr),
+          m_n_draft(0), m_n_lookup_draft(0),
+          m_session_cache(DEFAULT_SESSION_CACHE_BYTES,
+                          [this](const std::string& sessionId, SessionCache::Entry& entry) {
+                              queueSessionWrite(entry.dir, sessionId, std::move(entry.info), std::move(entry.state));
+                          }) {
     LOGI("LlamaWrapper constructor called");
 }
 
@@ -22,7 +90,7 @@ LlamaWrapper::~LlamaWrapper() {
     cleanup();
 }
 
-bool LlamaWrapper::initialize(const std::string& modelPath) {
+bool LlamaWrapper::initialize(const std::string& modelPath, KvPrecision kvPrecision) {
     LOGI("=== Starting model initialization ===");
     m_modelPath = modelPath;
     cleanup();
@@ -48,58 +116,113 @@ bool LlamaWrapper::initialize(const std::string& modelPath) {
 
         LOGI("Model loaded successfully");
         m_current_model_type = detectModelType(modelPath);
+        m_model_hash = computeModelHash(modelPath);
 
-        // UPDATED: 16K context parameters
         llama_context_params ctx_params = llama_context_default_params();
 
-        // Adjust context parameters based on model type (as shown in your screenshot)
-        switch (m_current_model_type) {
-            case MODEL_LFM2:
-                ctx_params.n_ctx = 16384;
-                ctx_params.n_batch = 128;
-                ctx_params.n_threads = 4;
-                break;
-            case MODEL_PHI4:
-                ctx_params.n_ctx = 16384;
-                ctx_params.n_batch = 128;
-                ctx_params.n_threads = 4;
-                break;
-            case MODEL_QWEN:
-                ctx_params.n_ctx = 8192;
-                ctx_params.n_batch = 64;
-                ctx_params.n_threads = 4;
-                break;
-            case MODEL_DEEPSEEK:
-                ctx_params.n_ctx = 16384;
-                ctx_params.n_batch = 128;
-                ctx_params.n_threads = 4;
-                break;
-            default:
-                ctx_params.n_ctx = 16384;
-                ctx_params.n_batch = 128;
-                ctx_params.n_threads = 4;
-                break;
+        // Context length, batch and KV type come from the memory plan
+        const bool auto_precision = kvPrecision == KV_AUTO;
+        if (auto_precision) {
+            kvPrecision = defaultKvPrecision(m_current_model_type);
+        }
+        m_context_plan = planContextForModel(kvPrecision, auto_precision);
+        LOGI("Context plan: %s", m_context_plan.describe().c_str());
+        if (!m_context_plan.fits) {
+            LOGI("No configuration fits the memory budget, using the smallest one");
         }
 
-        ctx_params.n_threads_batch = ctx_params.n_threads;
+        ctx_params.n_ctx = m_context_plan.n_ctx;
+        ctx_params.n_batch = m_context_plan.n_batch;
+        ctx_params.n_ubatch = m_context_plan.n_ubatch;
+        // One thread per performance core unless the counts were set explicitly;
+        // a thread on a little core would gate every matmul
+        m_cpu_topology = probeCpuTopology();
+        LOGI("CPU topology: %s", m_cpu_topology.describe().c_str());
+        if (!m_thread_counts_set && !m_cpu_topology.performance.empty()) {
+            m_n_threads = (int) m_cpu_topology.performance.size();
+            m_n_threads_batch = m_n_threads;
+        }
+
+        // Batch sizes and thread counts measured earlier by autotune() for this
+        // model on this CPU, within what the memory plan allows; explicit thread
+        // counts still win
+        m_tune_config = TuneConfig();
+        if (!m_autotune_path.empty() &&
+            loadTuneConfig(m_autotune_path, m_model_hash, cpuSignature(m_cpu_topology), m_tune_config)) {
+            LOGI("Loaded tuning: %s", m_tune_config.describe().c_str());
+        }
+        if (m_tune_config.valid()) {
+            ctx_params.n_batch = std::min(m_tune_config.n_batch, m_context_plan.n_batch);
+            ctx_params.n_ubatch = std::min(m_tune_config.n_ubatch, ctx_params.n_batch);
+            m_context_plan.n_batch = ctx_params.n_batch;
+            m_context_plan.n_ubatch = ctx_params.n_ubatch;
+            if (!m_thread_counts_set) {
+                m_n_threads = m_tune_config.n_threads;
+                m_n_threads_batch = m_tune_config.n_threads_batch;
+            }
+        }
+
+        ctx_params.n_threads = m_n_threads;
+        ctx_params.n_threads_batch = m_n_threads_batch;
         ctx_params.no_perf = true;
         ctx_params.embeddings = false;
 
+        // Resident chats plus the system prompt snapshot share one pool of cells, so
+        // seq_cp is a metadata-only copy and an idle chat costs only its own tokens
+        ctx_params.n_seq_max = 1 + MAX_RESIDENT_CHATS;
+        ctx_params.kv_unified = true;
+
         // Create context
-        m_context = llama_init_from_model(m_model, ctx_params);
+        m_context = createContext(ctx_params, m_context_plan.kv_type);
         if (!m_context) {
             LOGE("Failed to create llama context");
             cleanup();
             return false;
         }
 
-        LOGI("Context created successfully with 16K context");
+        if (!createThreadPools()) {
+            LOGI("Persistent threadpools unavailable, ggml creates threads per decode");
+        }
+
+        m_n_ctx = (int) llama_n_ctx(m_context);
+        m_session_tokens.clear();
+        m_ngram_drafter.clear();
+        resetResidentChats();
+        m_kv_cache_bytes = estimateKvCacheBytes(ctx_params);
+        LOGI("KV cache: K %s, V %s, flash_attn %d, ~%.1f MiB",
+             ggml_type_name(ctx_params.type_k), ggml_type_name(ctx_params.type_v),
+             ctx_params.flash_attn, m_kv_cache_bytes / (1024.0 * 1024.0));
+
+        // One batch reused for every prompt chunk; a chunk never exceeds n_batch
+        const int n_batch = (int) llama_n_batch(m_context);
+        m_batch = new llama_batch(llama_batch_init(n_batch, 0, 1));
+        if (m_prefill_chunk <= 0 || m_prefill_chunk > n_batch) {
+            m_prefill_chunk = n_batch;
+        }
+        LOGI("Prefill chunk %d tokens (n_batch %d, n_ubatch %u)", m_prefill_chunk, n_batch, llama_n_ubatch(m_context));
+        LOGI("Context created successfully with %d context", m_n_ctx);
+
+        // Sampler chain for the current profile, owned by m_sampler_chains
+        m_sampler = m_sampler_chains.get(m_sampling_profile);
+        if (!m_sampler) {
+            LOGE("Failed to build sampler chain");
+            cleanup();
+            return false;
+        }
+        LOGI("Sampler initialized: %s", m_sampling_profile.describe().c_str());
 
-        // Initialize sampler chain
-        auto sparams = llama_sampler_chain_default_params();
-        m_sampler = llama_sampler_chain_init(sparams);
-        llama_sampler_chain_add(m_sampler, llama_sampler_init_greedy());
-        LOGI("Sampler initialized successfully");
+        // Markers such as <|user|> and <|im_start|> are special tokens that
+        // render as empty text, so those are also matched by token id
+        const std::vector<std::string> stop_sequences = getStopSequences();
+        m_stop_matcher.setStopStrings(stop_sequences);
+        m_stop_tokens.clear();
+        for (const std::string& stop : stop_sequences) {
+            std::vector<llama_token> ids = tokenize(stop, false, true);
+            if (ids.size() == 1) {
+                m_stop_tokens.push_back(ids[0]);
+            }
+        }
+        LOGD("%zu stop strings, %zu as single tokens", stop_sequences.size(), m_stop_tokens.size());
 
         // Verify model
         const struct llama_vocab* vocab = llama_model_get_vocab(m_model);
@@ -117,6 +240,16 @@ bool LlamaWrapper::initialize(const std::string& modelPath) {
         }
 
         LOGI("Vocabulary size: %d tokens", vocab_size);
+
+        // Speculative decoding needs to drop rejected draft tokens from the KV cache
+        m_partial_rollback = probePartialRemoval(m_context, 0);
+        LOGI("Partial KV rollback %s", m_partial_rollback ? "supported" : "not supported");
+
+        if (!prepareSystemSnapshot()) {
+            LOGD("System prompt snapshot unavailable, new chats will decode it");
+        }
+        pauseThreadPools();
+
         m_initialized = true;
         LOGI("=== Model initialization completed successfully ===");
         return true;
@@ -128,36 +261,78 @@ bool LlamaWrapper::initialize(const std::string& modelPath) {
     }
 }
 
-std::string LlamaWrapper::generateResponse(const std::string& prompt) {
+std::string LlamaWrapper::generateResponse(const std::string& prompt, const TokenCallback& on_piece) {
+    return runTurn(prompt, false, on_piece);
+}
+
+// Replaces the last user turn (edited message or regenerate) and answers it again.
+// Only the part of the conversation that differs from the KV cache is decoded.
+std::string LlamaWrapper::regenerateResponse(const std::string& prompt, const TokenCallback& on_piece) {
+    return runTurn(prompt, true, on_piece);
+}
+
+std::string LlamaWrapper::runTurn(const std::string& prompt, bool replace_last_turn, const TokenCallback& on_piece) {
     if (!m_initialized || !m_model || !m_context || !m_sampler) {
         LOGE("Model not properly initialized");
         return "Error: Model not initialized";
     }
 
+    // A cancel only applies to the request in flight when it was made
+    struct GeneratingScope {
+        LlamaWrapper& w;
+        explicit GeneratingScope(LlamaWrapper& wrapper) : w(wrapper) {
+            w.m_cancel_requested.store(false);
+            w.m_generating.store(true);
+            w.resumeThreadPools();
+        }
+        ~GeneratingScope() {
+            w.pauseThreadPools();
+            w.m_generating.store(false);
+            w.m_cancel_requested.store(false);
+        }
+    } generating(*this);
+
     try {
         LOGI("Generating response for prompt: %.50s...", prompt.c_str());
 
-        // Allow longer prompts with 16K context
-        std::string limited_prompt = prompt;
-        const size_t MAX_PROMPT_LENGTH = 1000;  // INCREASED for 16K context
-        if (limited_prompt.length() > MAX_PROMPT_LENGTH) {
-            limited_prompt = limited_prompt.substr(0, MAX_PROMPT_LENGTH);
-            LOGD("Prompt truncated to %zu characters", MAX_PROMPT_LENGTH);
+        const int max_new_tokens = MAX_RESPONSE_TOKENS;
+
+        // Drop the cached conversation if the KV cache no longer matches it
+        syncSessionWithMemory();
+
+        // A prefilled draft is not history; generateText keeps whatever part of
+        // it matches the prompt
+        size_t history_len = m_session_tokens.size() - m_draft_prefill_len;
+        m_draft_prefill_len = 0;
+        if (replace_last_turn && m_last_turn_start <= history_len) {
+            history_len = m_last_turn_start;
         }
 
-        std::vector<llama_token> prompt_tokens = tokenize(limited_prompt, true);
-        if (prompt_tokens.empty()) {
+        bool first_turn = history_len == 0;
+        std::vector<llama_token> turn_tokens = buildTurnTokens(prompt, first_turn);
+        if (turn_tokens.empty()) {
             LOGE("Failed to tokenize prompt");
             return "Error: Failed to process prompt";
         }
 
-        if (prompt_tokens.size() > 512) {  // INCREASED from 64
-            prompt_tokens.resize(512);
-            LOGD("Token count limited to 512 tokens");
+        std::vector<llama_token> sequence_tokens(m_session_tokens.begin(), m_session_tokens.begin() + history_len);
+
+        // Make room by dropping the oldest turns instead of starting over
+        size_t n_total = history_len + turn_tokens.size() + max_new_tokens;
+        if (n_total > (size_t) m_n_ctx) {
+            size_t n_discarded = shiftContext(sequence_tokens, n_total - m_n_ctx);
+            history_len = sequence_tokens.size();
+            if (n_discarded == 0 || history_len + turn_tokens.size() + max_new_tokens > (size_t) m_n_ctx) {
+                LOGE("Prompt does not fit in the context (%zu tokens)", turn_tokens.size());
+                return "Error: Prompt too long";
+            }
         }
 
-        LOGD("Tokenized prompt into %zu tokens", prompt_tokens.size());
-        std::string response = generateText(prompt_tokens, 256);  // INCREASED from 100
+        sequence_tokens.insert(sequence_tokens.end(), turn_tokens.begin(), turn_tokens.end());
+
+        LOGD("Tokenized turn into %zu tokens (%zu history)", turn_tokens.size(), history_len);
+        std::string response = generateText(sequence_tokens, max_new_tokens, on_piece);
+        m_last_turn_start = history_len;
         LOGI("Generated response length: %zu characters", response.length());
         return response;
 
@@ -167,13 +342,50 @@ std::string LlamaWrapper::generateResponse(const std::string& prompt) {
     }
 }
 
+void LlamaWrapper::resetConversation() {
+    if (m_context) {
+        llama_memory_t mem = llama_get_memory(m_context);
+        // Only drop the chat sequence so the system prompt snapshot survives
+        if (mem && !llama_memory_seq_rm(mem, m_chat_seq, -1, -1)) {
+            llama_memory_clear(mem, true);
+            m_system_snapshot_ready = false;
+            // The other resident chats went with it
+            for (size_t i = 0; i < m_resident_chats.size(); ++i) {
+                if (i != m_active_chat) m_resident_chats[i] = ResidentChat();
+            }
+        }
+    }
+    m_session_tokens.clear();
+    m_ngram_drafter.clear();
+    m_last_turn_start = 0;
+    m_draft_prefill_len = 0;
+    LOGD("Conversation reset");
+}
+
 void LlamaWrapper::cleanup() {
     LOGI("Starting resource cleanup...");
     try {
-        if (m_sampler) {
-            llama_sampler_free(m_sampler);
-            m_sampler = nullptr;
-            LOGD("Sampler freed successfully");
+        // The draft model is only valid alongside the model it was checked against
+        unloadDraftModel();
+
+        // Resident and cached chats outlive the model only on disk
+        if (m_context) {
+            for (size_t i = 0; i < m_resident_chats.size(); ++i) {
+                releaseChat(i, true);
+            }
+        }
+        m_resident_chats.clear();
+        m_session_cache.flush();
+        waitForSessionWrites();
+
+        m_sampler = nullptr;
+        m_sampler_chains.clear();
+        LOGD("Sampler chains freed");
+
+        if (m_batch) {
+            llama_batch_free(*m_batch);
+            delete m_batch;
+            m_batch = nullptr;
         }
 
         if (m_context) {
@@ -183,6 +395,14 @@ void LlamaWrapper::cleanup() {
             }
             llama_free(m_context);
             m_context = nullptr;
+            freeThreadPools();
+            m_session_tokens.clear();
+            m_draft_prefill_len = 0;
+            m_ngram_drafter.clear();
+            m_system_tokens.clear();
+            m_system_snapshot_ready = false;
+            m_state_buffer.clear();
+            m_state_buffer.shrink_to_fit();
             LOGD("Context freed successfully");
         }
 
@@ -204,129 +424,1890 @@ void LlamaWrapper::cleanup() {
     }
 }
 
-// Rest of your existing methods remain the same...
-LlamaWrapper::ModelType LlamaWrapper::detectModelType(const std::string& modelPath) {
-    if (modelPath.find("LFM2") != std::string::npos || modelPath.find("lfm2") != std::string::npos) {
-        return MODEL_LFM2;
-    } else if (modelPath.find("Phi-4") != std::string::npos || modelPath.find("phi4") != std::string::npos) {
-        return MODEL_PHI4;
-    } else if (modelPath.find("qwen") != std::string::npos || modelPath.find("Qwen") != std::string::npos) {
-        return MODEL_QWEN;
-    } else if (modelPath.find("DeepSeek") != std::string::npos || modelPath.find("deepseek") != std::string::npos) {
-        return MODEL_DEEPSEEK;
+// Saving names the active chat's sequence, which stays resident in the KV cache.
+// A copy of its state is written through to the session file in the background
+// whenever it changed since the last save, so the chat survives the process
+// being killed; the old file stays in place until the new one replaces it.
+bool LlamaWrapper::saveSession(const std::string& dir, const std::string& sessionId) {
+    if (!m_initialized || !m_context || sessionId.empty()) return false;
+    discardDraftPrefill();
+
+    // Another sequence still holding an older copy of this chat is stale
+    int stale = findResidentChat(sessionId);
+    if (stale >= 0 && (size_t) stale != m_active_chat) {
+        releaseChat((size_t) stale, false);
     }
-    return MODEL_UNKNOWN;
+
+    ResidentChat& chat = m_resident_chats[m_active_chat];
+    chat.session_id = sessionId;
+    chat.dir = dir;
+    chat.last_used = ++m_chat_clock;
+
+    // The resident copy supersedes anything cached for this chat
+    m_session_cache.erase(sessionId);
+
+    // Nothing worth keeping beyond the shared system prompt
+    if (m_session_tokens.size() <= m_system_tokens.size() || !syncSessionWithMemory()) {
+        chat.saved_hash = 0;
+        queueSessionRemoval(dir, sessionId);
+        return false;
+    }
+
+    const uint64_t state_hash = chatStateHash(m_session_tokens, m_last_turn_start);
+    if (state_hash != chat.saved_hash) {
+        SessionFileInfo info;
+        std::vector<uint8_t> state;
+        if (captureChatState(m_chat_seq, m_session_tokens, m_last_turn_start, info, state)) {
+            queueSessionWrite(dir, sessionId, std::move(info), std::move(state));
+            chat.saved_hash = state_hash;
+        } else {
+            LOGE("Failed to serialize session %s", sessionId.c_str());
+        }
+    }
+
+    LOGI("Session %s resident in sequence %d: %zu tokens (%zu KV cells in use)",
+         sessionId.c_str(), m_chat_seq, m_session_tokens.size(), residentCells());
+    return true;
 }
 
-std::string LlamaWrapper::getSystemPrompt() {
-    switch (m_current_model_type) {
-        case MODEL_PHI4:
-            return "<|system|>\nYou are a helpful AI assistant.<|end|>\n<|user|>\n";
-        case MODEL_QWEN:
-            return "<|im_start|>system\nYou are a helpful assistant.<|im_end|>\n<|im_start|>user\n";
-        default:
-            return "";
+// A resident chat is switched to without touching the KV cache. Otherwise the
+// chat gets a free sequence (evicting the least recently used one if needed) and
+// its state is loaded from the session cache or its session file.
+bool LlamaWrapper::restoreSession(const std::string& dir, const std::string& sessionId) {
+    if (!m_initialized || !m_context || sessionId.empty()) return false;
+    discardDraftPrefill();
+
+    int resident = findResidentChat(sessionId);
+    if (resident >= 0) {
+        activateChat((size_t) resident);
+        if (!syncSessionWithMemory()) {
+            m_resident_chats[m_active_chat].session_id.clear();
+            return false;
+        }
+        LOGI("Switched to resident session %s (sequence %d, %zu tokens)",
+             sessionId.c_str(), m_chat_seq, m_session_tokens.size());
+        return true;
+    }
+
+    // Keep the current chat resident if it was saved, otherwise reuse its sequence
+    if (!m_resident_chats[m_active_chat].session_id.empty()) {
+        activateChat(acquireChatSlot());
     }
+    resetConversation();
+
+    auto start = std::chrono::steady_clock::now();
+    SessionCache::Entry entry;
+    bool from_cache = m_session_cache.take(sessionId, entry);
+    if (!from_cache) {
+        waitForSessionWrites();
+        // States left behind by another model (or an older copy of this one) are stale
+        removeSessionFiles(dir, sessionId, sessionFilePath(dir, sessionId, m_model_hash));
+        if (!readSessionFromDisk(dir, sessionId, entry.info, m_state_buffer)) {
+            return false;
+        }
+    }
+
+    ensureFreeCells(entry.info.tokens.size());
+    const std::vector<uint8_t>& state = from_cache ? entry.state : m_state_buffer;
+    if (!applyChatState(entry.info, state)) {
+        LOGE("Failed to restore session %s from %s", sessionId.c_str(), from_cache ? "cache" : "disk");
+        if (!from_cache) {
+            removeSessionFiles(dir, sessionId, "");
+        }
+        return false;
+    }
+
+    ResidentChat& chat = m_resident_chats[m_active_chat];
+    chat.session_id = sessionId;
+    chat.dir = dir;
+    // A cached entry may be newer than the file, so it is written on the next save
+    chat.saved_hash = from_cache ? 0 : chatStateHash(m_session_tokens, m_last_turn_start);
+
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    LOGI("Restored session %s from %s into sequence %d: %zu tokens, %zu bytes in %lld ms",
+         sessionId.c_str(), from_cache ? "cache" : "disk", m_chat_seq, m_session_tokens.size(), state.size(), ms);
+    return true;
 }
 
-std::vector<std::string> LlamaWrapper::getStopSequences() {
-    switch (m_current_model_type) {
-        case MODEL_PHI4:
-            return {"<|end|>", "<|user|>", "<|assistant|>"};
-        case MODEL_QWEN:
-            return {"<|im_end|>", "<|im_start|>"};
-        default:
-            return {};
+// Gives the new chat its own sequence so a saved chat that was active stays resident
+void LlamaWrapper::startNewChat() {
+    if (!m_initialized || !m_context) return;
+    discardDraftPrefill();
+    if (!m_resident_chats[m_active_chat].session_id.empty()) {
+        activateChat(acquireChatSlot());
     }
+    resetConversation();
 }
 
-std::vector<llama_token> LlamaWrapper::tokenize(const std::string& text, bool add_bos) {
-    if (!m_model) return {};
-    const struct llama_vocab* vocab = llama_model_get_vocab(m_model);
-    if (!vocab) return {};
+void LlamaWrapper::deleteSession(const std::string& dir, const std::string& sessionId) {
+    if (sessionId.empty()) return;
 
-    std::vector<llama_token> tokens(text.length() + (add_bos ? 1 : 0));
-    int n_tokens = llama_tokenize(
-            vocab,
-            text.c_str(),
-            text.length(),
-            tokens.data(),
-            tokens.size(),
-            add_bos,
-            false
-    );
+    int resident = findResidentChat(sessionId);
+    if (resident >= 0 && (size_t) resident == m_active_chat) {
+        resetConversation();
+        m_resident_chats[m_active_chat].session_id.clear();
+    } else if (resident >= 0) {
+        releaseChat((size_t) resident, false);
+    }
+    m_session_cache.erase(sessionId);
+    waitForSessionWrites();
+    removeSessionFiles(dir, sessionId, "");
+}
 
-    if (n_tokens < 0) {
-        LOGE("Failed to tokenize text");
-        return {};
+// The word being typed is left out: tokenizers attach the space before a word
+// to that word's first token. The turn suffix is only added on send, so the
+// prefilled tokens are a prefix of the prompt runTurn will build.
+bool LlamaWrapper::prefillDraft(const std::string& sessionId, const std::string& partialText) {
+    if (!m_initialized || !m_context || !m_partial_rollback) return false;
+    const std::string& active_id = m_resident_chats[m_active_chat].session_id;
+    if (!active_id.empty() && active_id != sessionId) return false;
+
+    syncSessionWithMemory();
+    const size_t history_len = m_session_tokens.size() - m_draft_prefill_len;
+    const bool first_turn = history_len == 0;
+
+    std::vector<llama_token> sequence_tokens(m_session_tokens.begin(), m_session_tokens.begin() + history_len);
+    const size_t stable_end = partialText.find_last_of(" \t\n");
+    if (stable_end != std::string::npos) {
+        std::vector<llama_token> user_tokens = tokenize(partialText.substr(0, stable_end), false);
+        if (user_tokens.size() > DRAFT_HOLDBACK_TOKENS) {
+            user_tokens.resize(user_tokens.size() - DRAFT_HOLDBACK_TOKENS);
+            std::vector<llama_token> prefix = tokenize(getTurnPrefix(first_turn), first_turn, true);
+            sequence_tokens.insert(sequence_tokens.end(), prefix.begin(), prefix.end());
+            sequence_tokens.insert(sequence_tokens.end(), user_tokens.begin(), user_tokens.end());
+        }
     }
+    // Prompts that need a context shift are left to runTurn
+    if (sequence_tokens.size() + MAX_RESPONSE_TOKENS > (size_t) m_n_ctx) return false;
 
-    tokens.resize(n_tokens);
-    return tokens;
+    if (sequence_tokens.size() > history_len) {
+        seedFromSystemSnapshot(sequence_tokens);
+    }
+
+    // Token-level diff against what the previous draft left in the KV cache
+    size_t n_keep = 0;
+    while (n_keep < m_session_tokens.size() && n_keep < sequence_tokens.size() &&
+           m_session_tokens[n_keep] == sequence_tokens[n_keep]) {
+        ++n_keep;
+    }
+    llama_memory_t mem = llama_get_memory(m_context);
+    if (n_keep < m_session_tokens.size()) {
+        if (!mem || !llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) n_keep, -1)) {
+            discardDraftPrefill();
+            return false;
+        }
+        m_session_tokens.resize(n_keep);
+        m_ngram_drafter.truncate(n_keep);
+    }
+
+    // A draft may never be sent, so it only takes cells that are already free and
+    // never evicts another chat; whatever does not fit is decoded on send
+    const size_t n_resident = residentCells();
+    const size_t n_free = n_resident < (size_t) m_n_ctx ? (size_t) m_n_ctx - n_resident : 0;
+    const size_t n_new = std::min({sequence_tokens.size() - n_keep, MAX_DRAFT_PREFILL_TOKENS, n_free});
+    if (n_new > 0) {
+        resumeThreadPools();
+        const bool decoded = prefill(sequence_tokens.data() + n_keep, n_new, (llama_pos) n_keep, m_chat_seq, false);
+        pauseThreadPools();
+        if (decoded) {
+            m_session_tokens.insert(m_session_tokens.end(), sequence_tokens.begin() + n_keep,
+                                    sequence_tokens.begin() + n_keep + n_new);
+        } else if (!mem || !llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) n_keep, -1)) {
+            resetConversation();
+            return false;
+        }
+    }
+
+    m_draft_prefill_len = m_session_tokens.size() - history_len;
+    LOGD("Draft prefill: %zu tokens ahead of history (%zu new, %zu kept)", m_draft_prefill_len, n_new,
+         n_keep - std::min(n_keep, history_len));
+    return true;
 }
 
-std::string LlamaWrapper::detokenize(const std::vector<llama_token>& tokens) {
-    if (!m_model || tokens.empty()) return "";
-    const struct llama_vocab* vocab = llama_model_get_vocab(m_model);
-    if (!vocab) return "";
+// Drops an unsent draft before the chat's tokens are saved, switched away from
+// or benchmarked
+void LlamaWrapper::discardDraftPrefill() {
+    if (m_draft_prefill_len == 0) return;
+    const size_t history_len = m_session_tokens.size() - m_draft_prefill_len;
+    m_draft_prefill_len = 0;
 
-    std::string result;
-    result.reserve(tokens.size() * 4);
+    llama_memory_t mem = m_context ? llama_get_memory(m_context) : nullptr;
+    if (mem && llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) history_len, -1)) {
+        m_session_tokens.resize(history_len);
+        m_ngram_drafter.truncate(history_len);
+    } else {
+        resetConversation();
+    }
+}
 
-    for (llama_token token : tokens) {
-        char token_str[256] = {0};
-        int token_len = llama_token_to_piece(
-                vocab, token, token_str, sizeof(token_str), 0, false
-        );
-        if (token_len > 0 && token_len < sizeof(token_str)) {
-            result.append(token_str, token_len);
+bool LlamaWrapper::sessionMatchesModel(const SessionFileInfo& info) {
+    return info.model_hash == m_model_hash &&
+           info.n_layer == (uint32_t) llama_model_n_layer(m_model) &&
+           info.n_head_kv == (uint32_t) llama_model_n_head_kv(m_model) &&
+           info.n_embd == (uint32_t) llama_model_n_embd(m_model) &&
+           !info.tokens.empty() && info.tokens.size() <= (size_t) m_n_ctx;
+}
+
+bool LlamaWrapper::captureChatState(llama_seq_id seq_id, const std::vector<llama_token>& tokens,
+                                    size_t last_turn_start, SessionFileInfo& info, std::vector<uint8_t>& state) {
+    size_t state_size = llama_state_seq_get_size(m_context, seq_id);
+    state.resize(state_size);
+    if (state_size == 0 ||
+        llama_state_seq_get_data(m_context, state.data(), state_size, seq_id) != state_size) {
+        return false;
+    }
+
+    info.model_hash = m_model_hash;
+    info.n_layer = llama_model_n_layer(m_model);
+    info.n_head_kv = llama_model_n_head_kv(m_model);
+    info.n_embd = llama_model_n_embd(m_model);
+    info.last_turn_start = (uint32_t) last_turn_start;
+    info.tokens = tokens;
+    return true;
+}
+
+bool LlamaWrapper::applyChatState(const SessionFileInfo& info, const std::vector<uint8_t>& state) {
+    if (!sessionMatchesModel(info)) {
+        LOGD("Session state does not match the loaded model");
+        return false;
+    }
+
+    if (llama_state_seq_set_data(m_context, state.data(), state.size(), m_chat_seq) == 0) {
+        resetConversation();
+        return false;
+    }
+
+    m_session_tokens = info.tokens;
+    m_ngram_drafter.clear();
+    m_last_turn_start = info.last_turn_start <= m_session_tokens.size() ? info.last_turn_start : m_session_tokens.size();
+
+    if (!syncSessionWithMemory()) {
+        LOGE("Restored session state does not match its tokens");
+        return false;
+    }
+    return true;
+}
+
+// Session state files are named <sessionId>-<model fingerprint>.kvz so a state
+// saved with one model file is never restored into another. The header also
+// records the model hash and layer layout, checked again before restoring.
+bool LlamaWrapper::writeSessionToDisk(const std::string& dir, const std::string& sessionId,
+                                      const SessionFileInfo& info, const std::vector<uint8_t>& state) {
+    auto start = std::chrono::steady_clock::now();
+    std::string path = sessionFilePath(dir, sessionId, info.model_hash);
+
+    size_t written = writeSessionFile(path, info, state.data(), state.size());
+    if (written == 0) {
+        LOGE("Failed to save session state to %s", path.c_str());
+        return false;
+    }
+
+    removeSessionFiles(dir, sessionId, path);
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    LOGI("Saved session %s: %zu tokens, %zu -> %zu bytes in %lld ms",
+         sessionId.c_str(), info.tokens.size(), state.size(), written, ms);
+    return true;
+}
+
+// Session files are written on m_session_writer in the order they were queued,
+// so a later save of the same chat always lands after an earlier one
+void LlamaWrapper::queueSessionWrite(const std::string& dir, const std::string& sessionId,
+                                     SessionFileInfo info, std::vector<uint8_t> state) {
+    auto job = std::make_shared<SessionCache::Entry>();
+    job->dir = dir;
+    job->info = std::move(info);
+    job->state = std::move(state);
+    m_session_writer.post([this, sessionId, job]() {
+        writeSessionToDisk(job->dir, sessionId, job->info, job->state);
+    });
+}
+
+void LlamaWrapper::queueSessionRemoval(const std::string& dir, const std::string& sessionId) {
+    m_session_writer.post([this, dir, sessionId]() {
+        removeSessionFiles(dir, sessionId, "");
+    });
+}
+
+// Called before a session file is read or removed on this thread
+void LlamaWrapper::waitForSessionWrites() {
+    if (m_session_writer.isCurrentThread()) return;
+    m_session_writer.submit([]() {}).wait();
+}
+
+// FNV-1a over the tokens and turn boundary; tells whether a chat changed since
+// its state was last queued for disk
+uint64_t LlamaWrapper::chatStateHash(const std::vector<llama_token>& tokens, size_t last_turn_start) {
+    uint64_t hash = 1469598103934665603ULL;
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ULL;
         }
+    };
+    mix(last_turn_start);
+    for (llama_token token : tokens) {
+        mix((uint32_t) token);
     }
-    return result;
+    return hash | 1;  // never 0, which marks a chat with nothing on disk
 }
 
-std::string LlamaWrapper::generateText(const std::vector<llama_token>& prompt_tokens, int max_tokens) {
-    if (!m_context || prompt_tokens.empty()) return "";
+bool LlamaWrapper::readSessionFromDisk(const std::string& dir, const std::string& sessionId,
+                                       SessionFileInfo& info, std::vector<uint8_t>& state) {
+    std::string path = sessionFilePath(dir, sessionId, m_model_hash);
+    if (!readSessionFileInfo(path, info, (size_t) m_n_ctx)) {
+        return false;
+    }
 
-    // Clear memory
-    llama_memory_t mem = llama_get_memory(m_context);
-    if (mem) {
-        llama_memory_clear(mem, true);
+    // Reject stale files before paying for decompression
+    if (!sessionMatchesModel(info)) {
+        LOGD("Session state %s does not match the loaded model", path.c_str());
+        std::remove(path.c_str());
+        return false;
     }
 
-    // Process prompt
-    llama_batch batch = llama_batch_get_one(
-            const_cast<llama_token*>(prompt_tokens.data()),
-            prompt_tokens.size()
-    );
+    return readSessionFile(path, info, state, (size_t) m_n_ctx);
+}
 
-    if (llama_decode(m_context, batch)) {
-        LOGE("Failed to decode prompt batch");
-        return "Error: Failed to process prompt";
+// Compares the session format paths with llama.cpp's own state files for the
+// current chat: save time, restore time and size for each.
+std::string LlamaWrapper::benchmarkSessionFormats(const std::string& dir) {
+    if (!m_initialized || !m_context) return "Error: Model not initialized";
+    discardDraftPrefill();
+    if (m_session_tokens.empty() || !syncSessionWithMemory()) return "Error: No active chat to benchmark";
+
+    const std::vector<llama_token> tokens = m_session_tokens;
+    const size_t last_turn_start = m_last_turn_start;
+    std::vector<llama_token> loaded(m_n_ctx);
+    size_t n_loaded = 0;
+
+    auto elapsed_ms = [](std::chrono::steady_clock::time_point t0) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    };
+    auto file_size = [](const std::string& path) -> long long {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? (long long) st.st_size : -1;
+    };
+
+    char line[160];
+    std::string report = "format, save_ms, restore_ms, bytes\n";
+
+    // Whole-context state (llama_state_save_file)
+    std::string full_path = dir + "/benchmark-full.state";
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = llama_state_save_file(m_context, full_path.c_str(), tokens.data(), tokens.size());
+    double save_ms = elapsed_ms(t0);
+    t0 = std::chrono::steady_clock::now();
+    ok = ok && llama_state_load_file(m_context, full_path.c_str(), loaded.data(), loaded.size(), &n_loaded);
+    double restore_ms = elapsed_ms(t0);
+    snprintf(line, sizeof(line), "full_state, %.1f, %.1f, %lld%s\n", save_ms, restore_ms,
+             file_size(full_path), ok ? "" : " (failed)");
+    report += line;
+    std::remove(full_path.c_str());
+
+    // Raw chat sequence (llama_state_seq_save_file)
+    std::string seq_path = dir + "/benchmark-seq.state";
+    t0 = std::chrono::steady_clock::now();
+    ok = llama_state_seq_save_file(m_context, seq_path.c_str(), m_chat_seq, tokens.data(), tokens.size()) > 0;
+    save_ms = elapsed_ms(t0);
+    t0 = std::chrono::steady_clock::now();
+    ok = ok && llama_state_seq_load_file(m_context, seq_path.c_str(), m_chat_seq,
+                                         loaded.data(), loaded.size(), &n_loaded) > 0;
+    restore_ms = elapsed_ms(t0);
+    snprintf(line, sizeof(line), "raw_seq, %.1f, %.1f, %lld%s\n", save_ms, restore_ms,
+             file_size(seq_path), ok ? "" : " (failed)");
+    report += line;
+    std::remove(seq_path.c_str());
+
+    // In-memory cache entry (serialize only, no I/O)
+    SessionFileInfo info;
+    std::vector<uint8_t> state;
+    t0 = std::chrono::steady_clock::now();
+    ok = captureChatState(m_chat_seq, tokens, last_turn_start, info, state);
+    save_ms = elapsed_ms(t0);
+    t0 = std::chrono::steady_clock::now();
+    ok = ok && applyChatState(info, state);
+    restore_ms = elapsed_ms(t0);
+    snprintf(line, sizeof(line), "memory_cache, %.1f, %.1f, %zu%s\n", save_ms, restore_ms,
+             state.size(), ok ? "" : " (failed)");
+    report += line;
+
+    // Compressed session file, as written on cache eviction
+    const std::string bench_id = "benchmark";
+    std::string packed_path = sessionFilePath(dir, bench_id, m_model_hash);
+    t0 = std::chrono::steady_clock::now();
+    ok = captureChatState(m_chat_seq, tokens, last_turn_start, info, state) && writeSessionToDisk(dir, bench_id, info, state);
+    save_ms = elapsed_ms(t0);
+    long long packed_size = file_size(packed_path);
+    t0 = std::chrono::steady_clock::now();
+    ok = ok && readSessionFromDisk(dir, bench_id, info, m_state_buffer) && applyChatState(info, m_state_buffer);
+    restore_ms = elapsed_ms(t0);
+    snprintf(line, sizeof(line), "compressed_seq, %.1f, %.1f, %lld%s\n", save_ms, restore_ms,
+             packed_size, ok ? "" : " (failed)");
+    report += line;
+    removeSessionFiles(dir, bench_id, "");
+
+    // Leave the chat exactly as it was if any step above disturbed it
+    m_session_tokens = tokens;
+    m_ngram_drafter.clear();
+    m_last_turn_start = last_turn_start;
+    if (!syncSessionWithMemory()) {
+        LOGE("Chat state lost during session format benchmark");
     }
 
-    std::vector<llama_token> response_tokens;
+    LOGI("Session format benchmark (%zu tokens):\n%s", tokens.size(), report.c_str());
+    return report;
+}
+
+// Times the per-token stack-buffer loop that used to run once after generation
+// against the streaming detokenizer, over a mixed-script sample tokenized with
+// the loaded vocabulary. The sample round-trips only if no piece was lost.
+std::string LlamaWrapper::benchmarkDetokenizer(int iterations) {
+    if (!m_initialized || !m_model) return "Error: Model not initialized";
     const struct llama_vocab* vocab = llama_model_get_vocab(m_model);
+    iterations = std::max(1, iterations);
 
-    // Generate tokens
-    for (int i = 0; i < max_tokens; ++i) {
-        llama_token next_token = llama_sampler_sample(m_sampler, m_context, -1);
+    std::string sample;
+    for (int i = 0; i < 8; ++i) {
+        sample += "The quick brown fox jumps over the lazy dog. ";
+        sample += "नमस्ते, आप कैसे हैं? ";
+        sample += "👋🙂 東京 42\n";
+    }
+    const std::vector<llama_token> tokens = tokenize(sample, false);
+    if (tokens.empty()) return "Error: Failed to tokenize benchmark sample";
 
-        // Check for end of sequence
-        if (next_token == llama_vocab_eos(vocab)) {
-            break;
+    auto elapsed_ns = [](std::chrono::steady_clock::time_point t0) {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    };
+    const double n_calls = (double) tokens.size() * iterations;
+
+    std::string batch_text;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        batch_text.clear();
+        batch_text.reserve(tokens.size() * 4);
+        for (llama_token token : tokens) {
+            char token_str[256] = {0};
+            int token_len = llama_token_to_piece(vocab, token, token_str, sizeof(token_str), 0, false);
+            if (token_len > 0 && token_len < (int) sizeof(token_str)) {
+                batch_text.append(token_str, token_len);
+            }
         }
+    }
+    const double batch_ns = elapsed_ns(t0) / n_calls;
 
-        response_tokens.push_back(next_token);
-        llama_sampler_accept(m_sampler, next_token);
+    StreamDetokenizer stream(vocab);
+    size_t held_back = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        stream.reset();
+        held_back = 0;
+        for (llama_token token : tokens) {
+            stream.push(token);
+            held_back += stream.pendingBytes() > 0;
+        }
+    }
+    const double stream_ns = elapsed_ns(t0) / n_calls;
 
-        // Process the new token
-        llama_batch single_batch = llama_batch_get_one(&next_token, 1);
-        if (llama_decode(m_context, single_batch)) {
-            LOGE("Failed to decode token at position %d", i);
-            break;
+    char line[160];
+    std::string report = "detokenizer, ns_per_token, round_trip\n";
+    snprintf(line, sizeof(line), "batch_loop, %.1f, %s\n", batch_ns, batch_text == sample ? "yes" : "no");
+    report += line;
+    snprintf(line, sizeof(line), "streaming, %.1f, %s\n", stream_ns, stream.text() == sample ? "yes" : "no");
+    report += line;
+
+    LOGI("Detokenizer benchmark (%zu tokens x %d, %zu pieces split a character):\n%s",
+         tokens.size(), iterations, held_back, report.c_str());
+    return report;
+}
+
+// Per-token cost of picking from a logits row the way llama_sampler_sample does
+// (a llama_token_data entry per token, then the chain) against the SIMD
+// argmax/top-k fast path, for common vocabulary sizes and the loaded model's
+std::string LlamaWrapper::benchmarkSampling(int iterations) {
+    iterations = std::max(1, iterations);
+    std::vector<int32_t> vocab_sizes = {32000, 65536, 151936, 200064};
+    if (m_model) {
+        const int32_t n_model = llama_vocab_n_tokens(llama_model_get_vocab(m_model));
+        if (std::find(vocab_sizes.begin(), vocab_sizes.end(), n_model) == vocab_sizes.end()) {
+            vocab_sizes.push_back(n_model);
+        }
+    }
+
+    SamplingProfile greedy_profile;
+    greedy_profile.temperature = 0.0f;
+    greedy_profile.penalty_last_n = 0;
+    SamplingProfile topk_profile;     // defaults: top-k 40, top-p, min-p, temp
+    topk_profile.penalty_last_n = 0;
+    llama_sampler* greedy = buildSamplerChain(greedy_profile);
+    llama_sampler* topk = buildSamplerChain(topk_profile);
+    if (!greedy || !topk) {
+        if (greedy) llama_sampler_free(greedy);
+        if (topk) llama_sampler_free(topk);
+        return "Error: Failed to build sampler chains";
+    }
+
+    auto elapsed_us = [](std::chrono::steady_clock::time_point t0) {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    };
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> logit_dist(0.0f, 4.0f);
+    std::vector<llama_token_data> full;
+    std::vector<llama_token_data> candidates(topk_profile.top_k);
+    std::string report = "vocab, full_greedy_us, simd_argmax_us, full_topk_us, simd_topk_us\n";
+    bool agree = true;
+
+    for (int32_t n_vocab : vocab_sizes) {
+        std::vector<float> logits(n_vocab);
+        for (float& l : logits) l = logit_dist(rng);
+        full.resize(n_vocab);
+
+        auto sample_full = [&](llama_sampler* chain) {
+            for (int32_t id = 0; id < n_vocab; ++id) full[id] = {id, logits[id], 0.0f};
+            llama_token_data_array cur_p = {full.data(), full.size(), -1, false};
+            llama_sampler_apply(chain, &cur_p);
+            return cur_p.data[cur_p.selected].id;
+        };
+
+        auto t0 = std::chrono::steady_clock::now();
+        llama_token full_token = 0;
+        for (int it = 0; it < iterations; ++it) full_token = sample_full(greedy);
+        const double full_greedy_us = elapsed_us(t0) / iterations;
+
+        t0 = std::chrono::steady_clock::now();
+        llama_token simd_token = 0;
+        for (int it = 0; it < iterations; ++it) simd_token = argmaxLogits(logits.data(), n_vocab);
+        const double simd_argmax_us = elapsed_us(t0) / iterations;
+        agree = agree && full_token == simd_token;
+
+        t0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; ++it) sample_full(topk);
+        const double full_topk_us = elapsed_us(t0) / iterations;
+
+        t0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; ++it) {
+            llama_token_data_array cur_p = {
+                candidates.data(), topKLogits(logits.data(), n_vocab, candidates.size(), candidates.data()), -1, false
+            };
+            llama_sampler_apply(topk, &cur_p);
+        }
+        const double simd_topk_us = elapsed_us(t0) / iterations;
+
+        char line[128];
+        snprintf(line, sizeof(line), "%d, %.1f, %.1f, %.1f, %.1f\n",
+                 n_vocab, full_greedy_us, simd_argmax_us, full_topk_us, simd_topk_us);
+        report += line;
+    }
+
+    llama_sampler_free(greedy);
+    llama_sampler_free(topk);
+    LOGI("Sampling benchmark (%s kernels, %d iterations, argmax %s full path):\n%s",
+         logitsKernelName(), iterations, agree ? "matches" : "differs from", report.c_str());
+    return report;
+}
+
+// FNV-1a over the file name, size and modification time; cheap enough to run on
+// every load and changes whenever the model file is replaced.
+uint64_t LlamaWrapper::computeModelHash(const std::string& modelPath) {
+    std::string key = modelPath.substr(modelPath.find_last_of('/') + 1);
+    struct stat st;
+    if (stat(modelPath.c_str(), &st) == 0) {
+        key += ":" + std::to_string((long long) st.st_size) + ":" + std::to_string((long long) st.st_mtime);
+    }
+
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string LlamaWrapper::sessionFilePath(const std::string& dir, const std::string& sessionId, uint64_t model_hash) {
+    char fingerprint[17];
+    snprintf(fingerprint, sizeof(fingerprint), "%016llx", (unsigned long long) model_hash);
+    return dir + "/" + sessionId + "-" + fingerprint + ".kvz";
+}
+
+// Removes every state file of a session except keep_path (pass "" to remove all)
+// Exactly "<sessionId>-<16 hex digits>.kvz" as built by sessionFilePath, so a
+// session whose id merely starts with sessionId keeps its files
+static bool isSessionFileName(const std::string& name, const std::string& sessionId) {
+    static const std::string EXTENSION = ".kvz";
+    const size_t n_hex = 16;
+    if (name.size() != sessionId.size() + 1 + n_hex + EXTENSION.size()) return false;
+    if (name.compare(0, sessionId.size(), sessionId) != 0 || name[sessionId.size()] != '-') return false;
+    for (size_t i = sessionId.size() + 1; i < sessionId.size() + 1 + n_hex; ++i) {
+        if (!isxdigit((unsigned char) name[i])) return false;
+    }
+    return name.compare(name.size() - EXTENSION.size(), EXTENSION.size(), EXTENSION) == 0;
+}
+
+void LlamaWrapper::removeSessionFiles(const std::string& dir, const std::string& sessionId, const std::string& keep_path) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (!isSessionFileName(name, sessionId)) continue;
+
+        std::string path = dir + "/" + name;
+        if (path == keep_path) continue;
+        if (std::remove(path.c_str()) == 0) {
+            LOGD("Removed stale session state %s", name.c_str());
         }
     }
+    closedir(d);
+}
+
+// Phi-4 mini and the Qwen-based models carry full-attention KV for every layer,
+// so q8_0 roughly halves their largest allocation; LFM2 is mostly convolution
+// layers with a small KV cache and stays at f16.
+LlamaWrapper::KvPrecision LlamaWrapper::defaultKvPrecision(ModelType type) {
+    switch (type) {
+        case MODEL_PHI4:
+        case MODEL_QWEN:
+        case MODEL_DEEPSEEK:
+            return KV_Q8_0;
+        default:
+            return KV_F16;
+    }
+}
 
-    return detokenize(response_tokens);
+// Creates the context with the planned KV type. Quantized V only works with
+// flash attention, which some architectures reject, so on failure V is moved back
+// to f16 first and then the whole cache, without flash attention.
+// ctx_params is left holding the configuration that succeeded.
+llama_context* LlamaWrapper::createContext(llama_context_params& ctx_params, ggml_type kv_type) {
+    ctx_params.type_k = kv_type;
+    ctx_params.type_v = kv_type;
+    ctx_params.flash_attn = kv_type != GGML_TYPE_F16;
+
+    llama_context* ctx = llama_init_from_model(m_model, ctx_params);
+    if (!ctx && ctx_params.type_v != GGML_TYPE_F16) {
+        LOGI("Quantized V cache rejected, retrying with f16 V");
+        ctx_params.type_v = GGML_TYPE_F16;
+        ctx = llama_init_from_model(m_model, ctx_params);
+    }
+    if (!ctx && (ctx_params.type_k != GGML_TYPE_F16 || ctx_params.flash_attn)) {
+        LOGI("Quantized KV cache rejected, retrying with f16 and no flash attention");
+        ctx_params.type_k = GGML_TYPE_F16;
+        ctx_params.flash_attn = false;
+        ctx = llama_init_from_model(m_model, ctx_params);
+    }
+    if (ctx) {
+        llama_set_abort_callback(ctx, abortCallback, this);
+    }
+    return ctx;
+}
+
+// Times a short prompt and a few single-token steps on a small scratch context.
+// Thread counts are swept first at the planned batch sizes, for prefill and
+// decode alike; smaller ubatches are then timed at the fastest prefill thread
+// count only. n_batch stays as planned since llama_decode splits it into
+// ubatches anyway. Stops early once m_cancel_requested is set.
+bool LlamaWrapper::runAutotune(const llama_context_params& base, TuneConfig& best, const ProgressCallback& on_progress) {
+    const int n_cpus = std::max(1, (int) std::thread::hardware_concurrency());
+    const std::vector<int> thread_counts = tuneThreadCandidates(m_cpu_topology, n_cpus);
+    const uint32_t max_ubatch = std::min(base.n_ubatch, (uint32_t) AUTOTUNE_PREFILL_TOKENS);
+    const std::vector<uint32_t> smaller_ubatches = tuneUbatchCandidates(max_ubatch / 2);
+
+    const int n_steps = (int) (2 * thread_counts.size() + smaller_ubatches.size());
+    int n_done = 0;
+    auto stepDone = [&]() {
+        if (on_progress) on_progress(++n_done, n_steps);
+    };
+    auto cancelled = [this]() { return m_cancel_requested.load(std::memory_order_relaxed); };
+
+    // Any spread of ids works for timing; logits are never read
+    const int32_t n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(m_model));
+    std::vector<llama_token> prompt(AUTOTUNE_PREFILL_TOKENS);
+    for (size_t i = 0; i < prompt.size(); ++i) {
+        prompt[i] = (llama_token) ((i * 7919 + 13) % (size_t) n_vocab);
+    }
+
+    LOGI("Autotune: %zu thread counts, then %zu smaller ubatches", thread_counts.size(), smaller_ubatches.size());
+    auto t_start = std::chrono::steady_clock::now();
+    best = TuneConfig();
+    best.n_batch = base.n_batch;
+    best.n_ubatch = base.n_ubatch;
+
+    llama_batch batch = llama_batch_init((int32_t) base.n_batch, 0, 1);
+
+    // Tokens from pos0 in n_batch chunks, milliseconds or -1 on failure
+    auto timeDecode = [&](llama_context* ctx, const llama_token* tokens, size_t n_tokens, llama_pos pos0) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t start = 0; start < n_tokens; start += base.n_batch) {
+            const size_t n_chunk = std::min((size_t) base.n_batch, n_tokens - start);
+            for (size_t i = 0; i < n_chunk; ++i) {
+                batch.token[i] = tokens[start + i];
+                batch.pos[i] = pos0 + (llama_pos) (start + i);
+                batch.n_seq_id[i] = 1;
+                batch.seq_id[i][0] = 0;
+                batch.logits[i] = i == n_chunk - 1;
+            }
+            batch.n_tokens = (int32_t) n_chunk;
+            if (llama_decode(ctx, batch) != 0) return -1.0;
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    };
+
+    auto createScratch = [&](uint32_t n_ubatch) {
+        llama_context_params params = base;
+        params.n_ctx = AUTOTUNE_CTX;
+        params.n_ubatch = n_ubatch;
+        params.n_seq_max = 1;
+        llama_context* ctx = createContext(params, m_context_plan.kv_type);
+        if (!ctx) {
+            LOGE("Autotune: no context for n_batch %u n_ubatch %u", base.n_batch, n_ubatch);
+        }
+        return ctx;
+    };
+
+    // Prefill tokens/s from an empty cache, 0 on failure
+    auto timePrefill = [&](llama_context* ctx, int n_threads) {
+        llama_set_n_threads(ctx, n_threads, n_threads);
+        llama_memory_clear(llama_get_memory(ctx), true);
+        const double ms = timeDecode(ctx, prompt.data(), prompt.size(), 0);
+        return ms > 0 ? prompt.size() * 1000.0 / ms : 0.0;
+    };
+
+    llama_context* ctx = createScratch(base.n_ubatch);
+    if (ctx) {
+        llama_memory_t mem = llama_get_memory(ctx);
+
+        // The first pass faults the mapped weights in and would skew whatever runs first
+        timeDecode(ctx, prompt.data(), prompt.size(), 0);
+
+        for (size_t i = 0; i < thread_counts.size() && !cancelled(); ++i) {
+            const double tps = timePrefill(ctx, thread_counts[i]);
+            LOGD("Autotune prefill: %d threads, n_ubatch %u: %.1f tok/s", thread_counts[i], base.n_ubatch, tps);
+            if (tps > best.prefill_tps) {
+                best.prefill_tps = tps;
+                best.n_threads_batch = thread_counts[i];
+            }
+            stepDone();
+        }
+
+        // Decode steps continue after the prompt left by the last prefill
+        for (size_t i = 0; i < thread_counts.size() && !cancelled(); ++i) {
+            llama_set_n_threads(ctx, thread_counts[i], thread_counts[i]);
+            double ms = 0;
+            for (int step = 0; step < AUTOTUNE_DECODE_STEPS && ms >= 0; ++step) {
+                const llama_token token = prompt[step];
+                const llama_pos pos = (llama_pos) prompt.size() + step;
+                llama_memory_seq_rm(mem, 0, pos, -1);
+                const double step_ms = timeDecode(ctx, &token, 1, pos);
+                ms = step_ms < 0 ? -1 : ms + step_ms;
+            }
+            if (ms > 0) {
+                const double tps = AUTOTUNE_DECODE_STEPS * 1000.0 / ms;
+                LOGD("Autotune decode: %d threads: %.1f tok/s", thread_counts[i], tps);
+                if (tps > best.decode_tps) {
+                    best.decode_tps = tps;
+                    best.n_threads = thread_counts[i];
+                }
+            }
+            stepDone();
+        }
+        llama_free(ctx);
+    }
+
+    for (size_t i = 0; i < smaller_ubatches.size() && best.n_threads_batch > 0 && !cancelled(); ++i) {
+        ctx = createScratch(smaller_ubatches[i]);
+        if (ctx) {
+            const double tps = timePrefill(ctx, best.n_threads_batch);
+            llama_free(ctx);
+            LOGD("Autotune prefill: %d threads, n_ubatch %u: %.1f tok/s",
+                 best.n_threads_batch, smaller_ubatches[i], tps);
+            if (tps > best.prefill_tps) {
+                best.prefill_tps = tps;
+                best.n_ubatch = smaller_ubatches[i];
+            }
+        }
+        stepDone();
+    }
+    llama_batch_free(batch);
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    if (cancelled()) {
+        LOGI("Autotune cancelled after %.1f s", seconds);
+        return false;
+    }
+    if (!best.valid()) {
+        LOGE("Autotune failed after %.1f s, keeping the planned settings", seconds);
+        return false;
+    }
+    LOGI("Autotune finished in %.1f s: %s", seconds, best.describe().c_str());
+    return true;
+}
+
+// Measures the loaded model on request rather than during load, where the
+// sweep would hold up every first start. Thread counts apply right away;
+// n_ubatch is fixed when the context is created and applies from the next load.
+// Runs as a request, so cancelGeneration() stops it.
+bool LlamaWrapper::autotune(const ProgressCallback& on_progress) {
+    if (!m_initialized || !m_model || !m_context) return false;
+
+    llama_context_params base = llama_context_default_params();
+    base.n_batch = m_context_plan.n_batch;
+    base.n_ubatch = m_context_plan.n_ubatch;
+    base.no_perf = true;
+    base.embeddings = false;
+
+    m_cancel_requested.store(false);
+    m_generating.store(true);
+    TuneConfig best;
+    const bool tuned = runAutotune(base, best, on_progress);
+    m_generating.store(false);
+    m_cancel_requested.store(false);
+    if (!tuned) return false;
+
+    m_tune_config = best;
+    if (!m_autotune_path.empty() &&
+        !saveTuneConfig(m_autotune_path, m_model_hash, cpuSignature(m_cpu_topology), m_tune_config)) {
+        LOGE("Failed to save tuning to %s", m_autotune_path.c_str());
+    }
+    if (!m_thread_counts_set) {
+        applyThreadCounts(best.n_threads, best.n_threads_batch);
+    }
+    return true;
+}
+
+// One pool for single-token decode steps and one for prompt batches, created
+// once per model so decode steps stop spawning and joining threads. Both start
+// paused and are only woken for a request.
+bool LlamaWrapper::createThreadPools() {
+    freeThreadPools();
+
+    ggml_threadpool_params decode_params = ggml_threadpool_params_default(m_n_threads);
+    decode_params.paused = true;
+    ggml_threadpool_params batch_params = ggml_threadpool_params_default(m_n_threads_batch);
+    batch_params.paused = true;
+
+    // Keep the workers on the fast cluster when it has a core for each of them;
+    // threads may still move between those cores
+    const size_t n_perf = m_cpu_topology.performance.size();
+    if (m_cpu_topology.heterogeneous()) {
+        if ((size_t) m_n_threads <= n_perf) {
+            fillCpuMask(m_cpu_topology.performance, decode_params.cpumask, sizeof(decode_params.cpumask));
+        }
+        if ((size_t) m_n_threads_batch <= n_perf) {
+            fillCpuMask(m_cpu_topology.performance, batch_params.cpumask, sizeof(batch_params.cpumask));
+        }
+    }
+
+    m_threadpool = ggml_threadpool_new(&decode_params);
+    m_threadpool_batch = ggml_threadpool_params_match(&decode_params, &batch_params)
+                         ? m_threadpool : ggml_threadpool_new(&batch_params);
+    if (!m_threadpool || !m_threadpool_batch) {
+        freeThreadPools();
+        return false;
+    }
+
+    llama_attach_threadpool(m_context, m_threadpool, m_threadpool_batch);
+    llama_set_n_threads(m_context, m_n_threads, m_n_threads_batch);
+    if (m_draft_context) {
+        llama_attach_threadpool(m_draft_context, m_threadpool, m_threadpool_batch);
+        llama_set_n_threads(m_draft_context, m_n_threads, m_n_threads_batch);
+    }
+    LOGI("Threadpools: %d decode threads, %d prefill threads%s", m_n_threads, m_n_threads_batch,
+         m_cpu_topology.heterogeneous() ? " on performance cores" : "");
+    return true;
+}
+
+void LlamaWrapper::freeThreadPools() {
+    if (m_context) llama_detach_threadpool(m_context);
+    if (m_draft_context) llama_detach_threadpool(m_draft_context);
+    if (m_threadpool_batch && m_threadpool_batch != m_threadpool) {
+        ggml_threadpool_free(m_threadpool_batch);
+    }
+    if (m_threadpool) {
+        ggml_threadpool_free(m_threadpool);
+    }
+    m_threadpool = nullptr;
+    m_threadpool_batch = nullptr;
+}
+
+// ggml resumes a paused pool by itself on the next graph; resuming up front
+// lets the workers wake while the prompt is tokenized
+void LlamaWrapper::resumeThreadPools() {
+    if (m_threadpool) ggml_threadpool_resume(m_threadpool);
+    if (m_threadpool_batch && m_threadpool_batch != m_threadpool) ggml_threadpool_resume(m_threadpool_batch);
+}
+
+// Paused workers block instead of polling for work between chat turns
+void LlamaWrapper::pauseThreadPools() {
+    if (m_threadpool) ggml_threadpool_pause(m_threadpool);
+    if (m_threadpool_batch && m_threadpool_batch != m_threadpool) ggml_threadpool_pause(m_threadpool_batch);
+}
+
+void LlamaWrapper::setThreadCounts(int n_decode, int n_batch) {
+    m_thread_counts_set = true;
+    applyThreadCounts(n_decode, n_batch);
+}
+
+void LlamaWrapper::applyThreadCounts(int n_decode, int n_batch) {
+    const int n_cpus = std::max(1, (int) std::thread::hardware_concurrency());
+    m_n_threads = std::max(1, std::min(n_decode, n_cpus));
+    m_n_threads_batch = std::max(1, std::min(n_batch, n_cpus));
+    if (m_context && !m_generating.load()) {
+        if (createThreadPools()) {
+            pauseThreadPools();
+        } else {
+            llama_set_n_threads(m_context, m_n_threads, m_n_threads_batch);
+        }
+    }
+    LOGI("Thread counts set to %d decode, %d prefill", m_n_threads, m_n_threads_batch);
+}
+
+// Polled by ggml between graph nodes, so a cancel stops llama_decode within
+// the current ubatch; llama_decode then returns 2 and keeps finished ubatches
+bool LlamaWrapper::abortCallback(void* data) {
+    const LlamaWrapper* self = static_cast<const LlamaWrapper*>(data);
+    return self->m_cancel_requested.load(std::memory_order_relaxed) && self->m_generating.load(std::memory_order_relaxed);
+}
+
+// Only a request in flight can be cancelled; restores and snapshots that run
+// between requests are never aborted by a late cancel
+void LlamaWrapper::cancelGeneration() {
+    if (m_generating.load()) {
+        m_cancel_requested.store(true);
+        LOGI("Generation cancel requested");
+    }
+}
+
+// Plans against free memory with the model already mapped. Automatic precision
+// may fall back to smaller KV types to keep a longer context; an explicit one
+// is kept as is and only the context length and batch shrink.
+ContextPlan LlamaWrapper::planContextForModel(KvPrecision precision, bool allow_smaller_kv) {
+    ContextPlanInput input;
+    input.model_bytes = llama_model_size(m_model);
+    input.n_layer = llama_model_n_layer(m_model);
+    input.n_head = llama_model_n_head(m_model);
+    input.n_head_kv = llama_model_n_head_kv(m_model);
+    input.n_embd = llama_model_n_embd(m_model);
+    input.n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(m_model));
+    input.n_ctx_train = llama_model_n_ctx_train(m_model);
+    input.available_bytes = readAvailableMemoryBytes();
+    input.budget_bytes = m_memory_budget_bytes;
+
+    const ggml_type by_precision[] = {GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0};
+    if (precision < KV_F16 || precision > KV_Q4_0) {
+        precision = KV_F16;
+    }
+    input.kv_types.clear();
+    if (allow_smaller_kv) {
+        for (int p = precision; p <= KV_Q4_0; ++p) {
+            input.kv_types.push_back(by_precision[p]);
+        }
+    } else {
+        input.kv_types.push_back(by_precision[precision]);
+    }
+
+    LOGI("Planning context: model %.1f MiB, available %.1f MiB, n_layer %lld, n_ctx_train %lld",
+         input.model_bytes / 1048576.0, input.available_bytes / 1048576.0,
+         (long long) input.n_layer, (long long) input.n_ctx_train);
+    return planContext(input);
+}
+
+// Size of K and V for every layer over the whole context; an upper bound for
+// hybrid models where only some layers use attention.
+size_t LlamaWrapper::estimateKvCacheBytes(const llama_context_params& ctx_params) {
+    if (!m_model || !m_context) return 0;
+
+    const int64_t n_layer = llama_model_n_layer(m_model);
+    const int64_t n_head = llama_model_n_head(m_model);
+    const int64_t n_head_kv = llama_model_n_head_kv(m_model);
+    const int64_t n_embd = llama_model_n_embd(m_model);
+    if (n_head <= 0) return 0;
+
+    const int64_t n_embd_kv = n_head_kv * (n_embd / n_head);
+    const size_t row_bytes = ggml_row_size(ctx_params.type_k, n_embd_kv) + ggml_row_size(ctx_params.type_v, n_embd_kv);
+    return (size_t) n_layer * llama_n_ctx(m_context) * row_bytes;
+}
+
+// Rest of your existing methods remain the same...
+LlamaWrapper::ModelType LlamaWrapper::detectModelType(const std::string& modelPath) {
+    if (modelPath.find("LFM2") != std::string::npos || modelPath.find("lfm2") != std::string::npos) {
+        return MODEL_LFM2;
+    } else if (modelPath.find("Phi-4") != std::string::npos || modelPath.find("phi4") != std::string::npos) {
+        return MODEL_PHI4;
+    } else if (modelPath.find("qwen") != std::string::npos || modelPath.find("Qwen") != std::string::npos) {
+        return MODEL_QWEN;
+    } else if (modelPath.find("DeepSeek") != std::string::npos || modelPath.find("deepseek") != std::string::npos) {
+        return MODEL_DEEPSEEK;
+    }
+    return MODEL_UNKNOWN;
+}
+
+std::string LlamaWrapper::getSystemPrompt() {
+    switch (m_current_model_type) {
+        case MODEL_PHI4:
+            return "<|system|>\nYou are a helpful AI assistant.<|end|>\n<|user|>\n";
+        case MODEL_QWEN:
+            return "<|im_start|>system\nYou are a helpful assistant.<|im_end|>\n<|im_start|>user\n";
+        default:
+            return "";
+    }
+}
+
+// The system prompt already opens the first user turn; later turns close the
+// previous assistant reply before opening a new user turn.
+std::string LlamaWrapper::getTurnPrefix(bool first_turn) {
+    if (first_turn) {
+        return getSystemPrompt();
+    }
+    switch (m_current_model_type) {
+        case MODEL_PHI4:
+            return "<|end|>\n<|user|>\n";
+        case MODEL_QWEN:
+            return "<|im_end|>\n<|im_start|>user\n";
+        default:
+            return "\n";
+    }
+}
+
+std::string LlamaWrapper::getTurnSuffix() {
+    switch (m_current_model_type) {
+        case MODEL_PHI4:
+            return "<|end|>\n<|assistant|>\n";
+        case MODEL_QWEN:
+            return "<|im_end|>\n<|im_start|>assistant\n";
+        default:
+            return "";
+    }
+}
+
+bool LlamaWrapper::isStopToken(llama_token token) const {
+    return std::find(m_stop_tokens.begin(), m_stop_tokens.end(), token) != m_stop_tokens.end();
+}
+
+std::vector<std::string> LlamaWrapper::getStopSequences() {
+    switch (m_current_model_type) {
+        case MODEL_PHI4:
+            return {"<|end|>", "<|user|>", "<|assistant|>"};
+        case MODEL_QWEN:
+            return {"<|im_end|>", "<|im_start|>"};
+        default:
+            return {};
+    }
+}
+
+// Template markers are parsed as special tokens, user text never is
+std::vector<llama_token> LlamaWrapper::buildTurnTokens(const std::string& prompt, bool first_turn) {
+    std::vector<llama_token> tokens = tokenize(getTurnPrefix(first_turn), first_turn, true);
+
+    std::vector<llama_token> user_tokens = tokenize(prompt, false);
+    if (user_tokens.empty()) {
+        return {};
+    }
+    // A single message may use up to half the context; older turns are shifted out for the rest
+    const size_t max_user_tokens = (size_t) m_n_ctx / 2;
+    if (user_tokens.size() > max_user_tokens) {
+        user_tokens.resize(max_user_tokens);
+        LOGD("Token count limited to %zu tokens", max_user_tokens);
+    }
+    tokens.insert(tokens.end(), user_tokens.begin(), user_tokens.end());
+
+    std::vector<llama_token> suffix = tokenize(getTurnSuffix(), false, true);
+    tokens.insert(tokens.end(), suffix.begin(), suffix.end());
+    return tokens;
+}
+
+// Decodes BOS + system prompt once into SYSTEM_SEQ_ID so new chats can start
+// from a copy of those cells instead of recomputing them.
+bool LlamaWrapper::prepareSystemSnapshot() {
+    m_system_tokens.clear();
+    m_system_snapshot_ready = false;
+
+    if (!m_context || getSystemPrompt().empty()) return false;
+    llama_memory_t mem = llama_get_memory(m_context);
+    if (!mem) return false;
+
+    m_system_tokens = tokenize(getTurnPrefix(true), true, true);
+    if (m_system_tokens.empty() || m_system_tokens.size() >= (size_t) m_n_ctx / 2) {
+        m_system_tokens.clear();
+        return false;
+    }
+
+    if (!prefill(m_system_tokens.data(), m_system_tokens.size(), 0, SYSTEM_SEQ_ID, false)) {
+        LOGE("Failed to decode system prompt snapshot");
+        llama_memory_seq_rm(mem, SYSTEM_SEQ_ID, -1, -1);
+        m_system_tokens.clear();
+        return false;
+    }
+
+    m_system_snapshot_ready = true;
+    LOGI("System prompt snapshot ready (%zu tokens)", m_system_tokens.size());
+    return true;
+}
+
+// Starts an empty chat from the system prompt snapshot when the new sequence begins with it
+bool LlamaWrapper::seedFromSystemSnapshot(const std::vector<llama_token>& sequence_tokens) {
+    if (!m_system_snapshot_ready || !m_session_tokens.empty()) return false;
+    if (sequence_tokens.size() <= m_system_tokens.size() ||
+        !std::equal(m_system_tokens.begin(), m_system_tokens.end(), sequence_tokens.begin())) {
+        return false;
+    }
+
+    llama_memory_t mem = llama_get_memory(m_context);
+    if (!mem) return false;
+
+    llama_memory_seq_cp(mem, SYSTEM_SEQ_ID, m_chat_seq, -1, -1);
+    m_session_tokens = m_system_tokens;
+    m_ngram_drafter.clear();
+    LOGD("Seeded chat with %zu system prompt tokens", m_system_tokens.size());
+    return true;
+}
+
+// Drops at least n_required tokens from the middle of history, keeping the
+// attention sinks and system prompt at the front. When the memory supports it the
+// cells are removed and the remainder re-positioned in place, so nothing is
+// decoded again; otherwise only history changes and generateText re-prefills
+// the kept tail. Returns the number of tokens discarded.
+size_t LlamaWrapper::shiftContext(std::vector<llama_token>& history, size_t n_required) {
+    size_t n_keep = std::max(ATTENTION_SINK_TOKENS, m_system_tokens.size());
+    if (history.size() <= n_keep) return 0;
+
+    // Discard half of what is left (as llama.cpp's examples do) so shifts stay rare
+    size_t n_left = history.size() - n_keep;
+    size_t n_discard = std::min(n_left, std::max(n_required, n_left / 2));
+
+    llama_memory_t mem = llama_get_memory(m_context);
+    bool shifted = false;
+    if (mem && llama_memory_can_shift(mem)) {
+        // history is a prefix of the cached tokens; drop any replaced turn first
+        bool in_sync = m_session_tokens.size() == history.size() ||
+                       llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) history.size(), -1);
+        if (in_sync) {
+            m_session_tokens.resize(history.size());
+            m_ngram_drafter.truncate(history.size());
+            shifted = llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) n_keep, (llama_pos) (n_keep + n_discard));
+        }
+        if (shifted) {
+            llama_memory_seq_add(mem, m_chat_seq, (llama_pos) (n_keep + n_discard), -1, -(llama_pos) n_discard);
+            m_session_tokens.erase(m_session_tokens.begin() + n_keep, m_session_tokens.begin() + n_keep + n_discard);
+            m_ngram_drafter.truncate(n_keep);
+        }
+    }
+
+    history.erase(history.begin() + n_keep, history.begin() + n_keep + n_discard);
+    LOGI("Context shift: kept %zu sink tokens, discarded %zu%s", n_keep, n_discard,
+         shifted ? "" : " (memory cannot shift, tail will be re-decoded)");
+    return n_discard;
+}
+
+// The KV cache must hold exactly m_session_tokens at positions [0, n); anything
+// else (failed decode, external clear) means the history cannot be resumed.
+bool LlamaWrapper::syncSessionWithMemory() {
+    if (!m_context) return false;
+    llama_memory_t mem = llama_get_memory(m_context);
+    if (!mem) return false;
+
+    llama_pos n_past = llama_memory_seq_pos_max(mem, m_chat_seq) + 1;
+    if (n_past == (llama_pos) m_session_tokens.size()) {
+        return true;
+    }
+
+    LOGD("KV cache holds %d tokens but session has %zu, clearing", n_past, m_session_tokens.size());
+    resetConversation();
+    return false;
+}
+
+std::vector<llama_token> LlamaWrapper::tokenize(const std::string& text, bool add_bos, bool parse_special) {
+    if (!m_model) return {};
+    const struct llama_vocab* vocab = llama_model_get_vocab(m_model);
+    if (!vocab) return {};
+
+    std::vector<llama_token> tokens(text.length() + (add_bos ? 1 : 0));
+    int n_tokens = llama_tokenize(
+            vocab,
+            text.c_str(),
+            text.length(),
+            tokens.data(),
+            tokens.size(),
+            add_bos,
+            parse_special
+    );
+
+    if (n_tokens < 0) {
+        LOGE("Failed to tokenize text");
+        return {};
+    }
+
+    tokens.resize(n_tokens);
+    return tokens;
+}
+
+void LlamaWrapper::setPrefillChunkSize(int n_tokens) {
+    const int n_batch = m_context ? (int) llama_n_batch(m_context) : n_tokens;
+    m_prefill_chunk = std::max(1, std::min(n_tokens, n_batch));
+    LOGI("Prefill chunk size set to %d tokens", m_prefill_chunk);
+}
+
+// Decodes tokens at consecutive positions from pos0 in chunks of m_prefill_chunk,
+// requesting logits only for the very last token. Each chunk is timed so the
+// throughput knee of a model/device can be found by sweeping the chunk size.
+bool LlamaWrapper::prefill(const llama_token* tokens, size_t n_tokens, llama_pos pos0,
+                           llama_seq_id seq_id, bool want_logits) {
+    m_last_prefill_timings.clear();
+    if (!m_context || !m_batch || n_tokens == 0) return false;
+
+    for (size_t start = 0; start < n_tokens; start += m_prefill_chunk) {
+        const size_t n_chunk = std::min((size_t) m_prefill_chunk, n_tokens - start);
+        const bool last_chunk = start + n_chunk == n_tokens;
+
+        llama_batch& batch = *m_batch;
+        for (size_t i = 0; i < n_chunk; ++i) {
+            batch.token[i] = tokens[start + i];
+            batch.pos[i] = pos0 + (llama_pos) (start + i);
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = seq_id;
+            batch.logits[i] = false;
+        }
+        batch.logits[n_chunk - 1] = want_logits && last_chunk;
+        batch.n_tokens = (int32_t) n_chunk;
+
+        auto t0 = std::chrono::steady_clock::now();
+        if (llama_decode(m_context, batch) != 0) {
+            LOGE("Prefill failed at chunk starting at token %zu", start);
+            return false;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        m_last_prefill_timings.push_back({(int) n_chunk, ms});
+        LOGD("Prefill chunk %zu: %zu tokens in %.1f ms (%.1f tok/s)",
+             m_last_prefill_timings.size(), n_chunk, ms, ms > 0 ? n_chunk * 1000.0 / ms : 0.0);
+    }
+    return true;
+}
+
+// Decodes sampled (and drafted) tokens into the active chat's sequence with
+// logits for every one of them, so each draft can be checked against the target
+bool LlamaWrapper::decodeTokens(const std::vector<llama_token>& tokens, llama_pos pos0) {
+    llama_batch& batch = *m_batch;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        batch.token[i] = tokens[i];
+        batch.pos[i] = pos0 + (llama_pos) i;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = m_chat_seq;
+        batch.logits[i] = true;
+    }
+    batch.n_tokens = (int32_t) tokens.size();
+    return llama_decode(m_context, batch) == 0;
+}
+
+// Decodes two tokens into seq_id and tries to drop the second one. Recurrent and
+// hybrid memories cannot remove a partial tail, which draft verification relies on.
+bool LlamaWrapper::probePartialRemoval(llama_context* ctx, llama_seq_id seq_id) {
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (!mem || !m_batch) return false;
+
+    llama_batch& batch = *m_batch;
+    for (int i = 0; i < 2; ++i) {
+        batch.token[i] = 0;
+        batch.pos[i] = i;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = seq_id;
+        batch.logits[i] = false;
+    }
+    batch.n_tokens = 2;
+
+    bool removed = llama_decode(ctx, batch) == 0 && llama_memory_seq_rm(mem, seq_id, 1, -1);
+    llama_memory_seq_rm(mem, seq_id, -1, -1);
+    return removed;
+}
+
+// Slot 0 becomes the active chat; every other chat sequence is free
+void LlamaWrapper::resetResidentChats() {
+    m_resident_chats.assign(MAX_RESIDENT_CHATS, ResidentChat());
+    m_active_chat = 0;
+    m_chat_seq = FIRST_CHAT_SEQ_ID;
+    m_resident_chats[0].in_use = true;
+    m_resident_chats[0].last_used = ++m_chat_clock;
+}
+
+int LlamaWrapper::findResidentChat(const std::string& sessionId) {
+    for (size_t i = 0; i < m_resident_chats.size(); ++i) {
+        if (m_resident_chats[i].in_use && m_resident_chats[i].session_id == sessionId) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+// Parks the active chat's tokens in its slot and makes slot idx the active
+// sequence. An unsaved chat being switched away from has no owner and is dropped.
+void LlamaWrapper::activateChat(size_t idx) {
+    if (idx == m_active_chat) return;
+
+    ResidentChat& current = m_resident_chats[m_active_chat];
+    current.tokens.swap(m_session_tokens);
+    current.last_turn_start = m_last_turn_start;
+    if (current.session_id.empty()) {
+        releaseChat(m_active_chat, false);
+    }
+
+    ResidentChat& next = m_resident_chats[idx];
+    next.in_use = true;
+    next.last_used = ++m_chat_clock;
+    m_session_tokens.swap(next.tokens);
+    // The index belongs to the chat switched away from
+    m_ngram_drafter.clear();
+    m_last_turn_start = next.last_turn_start;
+    m_active_chat = idx;
+    m_chat_seq = FIRST_CHAT_SEQ_ID + (llama_seq_id) idx;
+}
+
+// Frees a chat's sequence. With spill, a saved chat's state goes to the session
+// cache first, so switching back costs a state load instead of a full prefill.
+void LlamaWrapper::releaseChat(size_t idx, bool spill) {
+    ResidentChat& chat = m_resident_chats[idx];
+    if (!chat.in_use) return;
+
+    const llama_seq_id seq_id = FIRST_CHAT_SEQ_ID + (llama_seq_id) idx;
+    const bool active = idx == m_active_chat;
+    const std::vector<llama_token>& tokens = active ? m_session_tokens : chat.tokens;
+
+    if (spill && !chat.session_id.empty() && tokens.size() > m_system_tokens.size()) {
+        SessionCache::Entry entry;
+        entry.dir = chat.dir;
+        if (captureChatState(seq_id, tokens, active ? m_last_turn_start : chat.last_turn_start,
+                             entry.info, entry.state)) {
+            m_session_cache.put(chat.session_id, std::move(entry));
+        } else {
+            LOGE("Failed to serialize resident session %s", chat.session_id.c_str());
+        }
+    }
+
+    llama_memory_t mem = m_context ? llama_get_memory(m_context) : nullptr;
+    if (mem) {
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+    }
+    LOGD("Released sequence %d (%s, %zu tokens)", seq_id,
+         chat.session_id.empty() ? "unsaved" : chat.session_id.c_str(), tokens.size());
+    chat = ResidentChat();
+}
+
+int LlamaWrapper::leastRecentlyUsedChat() {
+    int victim = -1;
+    for (size_t i = 0; i < m_resident_chats.size(); ++i) {
+        if (i == m_active_chat || !m_resident_chats[i].in_use) continue;
+        if (victim < 0 || m_resident_chats[i].last_used < m_resident_chats[victim].last_used) {
+            victim = (int) i;
+        }
+    }
+    return victim;
+}
+
+// A free sequence for another chat, evicting the least recently used inactive one if needed
+size_t LlamaWrapper::acquireChatSlot() {
+    for (size_t i = 0; i < m_resident_chats.size(); ++i) {
+        if (i != m_active_chat && !m_resident_chats[i].in_use) return i;
+    }
+
+    size_t victim = (size_t) leastRecentlyUsedChat();
+    LOGI("Evicting resident session %s to free sequence %d",
+         m_resident_chats[victim].session_id.c_str(), FIRST_CHAT_SEQ_ID + (llama_seq_id) victim);
+    releaseChat(victim, true);
+    return victim;
+}
+
+// Cells shared with the system prompt snapshot are counted for every chat, so
+// this errs towards evicting a little early rather than failing a decode.
+size_t LlamaWrapper::residentCells() {
+    size_t n_cells = m_system_snapshot_ready ? m_system_tokens.size() : 0;
+    for (size_t i = 0; i < m_resident_chats.size(); ++i) {
+        if (!m_resident_chats[i].in_use) continue;
+        n_cells += i == m_active_chat ? m_session_tokens.size() : m_resident_chats[i].tokens.size();
+    }
+    return n_cells;
+}
+
+// Evicts inactive chats, least recently used first, until n_needed more cells fit
+void LlamaWrapper::ensureFreeCells(size_t n_needed) {
+    while (residentCells() + n_needed > (size_t) m_n_ctx) {
+        int victim = leastRecentlyUsedChat();
+        if (victim < 0) break;
+        LOGI("KV cells exhausted, evicting resident session %s",
+             m_resident_chats[victim].session_id.c_str());
+        releaseChat((size_t) victim, true);
+    }
+}
+
+// Same checks as llama.cpp's speculative example: tokenizer type, BOS/EOS, and
+// identical token text for every id both vocabularies have
+static bool vocabsCompatible(const llama_vocab* target, const llama_vocab* draft) {
+    if (llama_vocab_type(target) != llama_vocab_type(draft)) return false;
+    if (llama_vocab_get_add_bos(target) != llama_vocab_get_add_bos(draft) ||
+        (llama_vocab_get_add_bos(target) && llama_vocab_bos(target) != llama_vocab_bos(draft)) ||
+        llama_vocab_eos(target) != llama_vocab_eos(draft)) {
+        return false;
+    }
+
+    const int32_t n_target = llama_vocab_n_tokens(target);
+    const int32_t n_draft = llama_vocab_n_tokens(draft);
+    if (std::abs(n_target - n_draft) > MAX_DRAFT_VOCAB_DIFFERENCE) return false;
+
+    for (int32_t id = 0; id < std::min(n_target, n_draft); ++id) {
+        if (strcmp(llama_vocab_get_text(target, id), llama_vocab_get_text(draft, id)) != 0) {
+            LOGD("Draft vocabulary differs at token %d", id);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LlamaWrapper::loadDraftModel(const std::string& path, int n_draft) {
+    unloadDraftModel();
+    if (!m_initialized || !m_context) return false;
+    if (!m_partial_rollback) {
+        LOGE("Speculative decoding needs a model whose KV cache can drop rejected drafts");
+        return false;
+    }
+
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 0;
+    model_params.use_mmap = true;
+    m_draft_model = llama_model_load_from_file(path.c_str(), model_params);
+    if (!m_draft_model) {
+        LOGE("Failed to load draft model from %s", path.c_str());
+        return false;
+    }
+
+    if (!vocabsCompatible(llama_model_get_vocab(m_model), llama_model_get_vocab(m_draft_model))) {
+        LOGE("Draft model vocabulary is not compatible with the loaded model");
+        unloadDraftModel();
+        return false;
+    }
+
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = (uint32_t) m_n_ctx;
+    ctx_params.n_batch = llama_n_batch(m_context);
+    ctx_params.n_ubatch = llama_n_ubatch(m_context);
+    ctx_params.n_seq_max = 1;
+    ctx_params.n_threads = m_n_threads;
+    ctx_params.n_threads_batch = m_n_threads_batch;
+    ctx_params.no_perf = true;
+    m_draft_context = llama_init_from_model(m_draft_model, ctx_params);
+    if (m_draft_context) {
+        llama_set_abort_callback(m_draft_context, abortCallback, this);
+        // Draft and target decode in turn on this thread, so they share the pools
+        if (m_threadpool && m_threadpool_batch) {
+            llama_attach_threadpool(m_draft_context, m_threadpool, m_threadpool_batch);
+        }
+    }
+    if (!m_draft_context || !probePartialRemoval(m_draft_context, 0)) {
+        LOGE("Draft model context unavailable or its KV cache cannot drop rejected drafts");
+        unloadDraftModel();
+        return false;
+    }
+
+    // Every draft plus the committed token goes into one batch
+    m_n_draft = std::max(1, std::min(n_draft, (int) llama_n_batch(m_context) - 1));
+    m_draft_tokens.clear();
+    LOGI("Draft model loaded: %s, %d tokens per step", path.c_str(), m_n_draft);
+    return true;
+}
+
+void LlamaWrapper::unloadDraftModel() {
+    if (m_draft_context) {
+        llama_free(m_draft_context);
+        m_draft_context = nullptr;
+    }
+    if (m_draft_model) {
+        llama_model_free(m_draft_model);
+        m_draft_model = nullptr;
+        LOGI("Draft model unloaded");
+    }
+    m_draft_tokens.clear();
+    m_n_draft = 0;
+}
+
+bool LlamaWrapper::setSamplingProfile(const SamplingProfile& profile) {
+    m_sampling_profile = profile;
+    if (!m_initialized) return true;
+
+    llama_sampler* sampler = m_sampler_chains.get(profile);
+    if (!sampler) {
+        LOGE("Failed to build sampler chain: %s", profile.describe().c_str());
+        return false;
+    }
+    m_sampler = sampler;
+    LOGD("Sampling profile %016llx: %s (chains cached %zu, hits %llu)",
+         (unsigned long long) profile.hash(), profile.describe().c_str(), m_sampler_chains.size(),
+         (unsigned long long) m_sampler_chains.hits());
+    return true;
+}
+
+// Number of top logits the active profile can ever pick from, or 0 when it
+// needs the whole vocabulary (no top-k, or penalties over the full context).
+// With penalty_repeat >= 1 and non-negative frequency/presence penalties the
+// penalties only lower the logits of at most penalty_last_n tokens, so
+// top_k + penalty_last_n candidates always contain the post-penalty top_k.
+// Settings that can raise a logit need the full vocabulary.
+size_t LlamaWrapper::sampleCandidates() const {
+    const SamplingProfile& p = m_sampling_profile;
+    size_t n = p.temperature <= 0.0f ? 1 : (p.top_k > 0 ? (size_t) p.top_k : 0);
+    if (n == 0) return 0;
+
+    const bool penalties = p.penalty_last_n != 0 &&
+                           (p.penalty_repeat != 1.0f || p.penalty_freq != 0.0f || p.penalty_present != 0.0f);
+    if (penalties) {
+        if (p.penalty_last_n < 0) return 0;
+        if (!(p.penalty_repeat >= 1.0f && p.penalty_freq >= 0.0f && p.penalty_present >= 0.0f)) return 0;
+        n += (size_t) p.penalty_last_n;
+    }
+
+    const size_t n_vocab = (size_t) llama_vocab_n_tokens(llama_model_get_vocab(m_model));
+    return n * FAST_SAMPLE_MAX_VOCAB_SHARE <= n_vocab ? n : 0;
+}
+
+// Same result as llama_sampler_sample, but the chain only sees the few logits
+// it can choose from, selected by the SIMD kernels in logits_topk, instead of a
+// llama_token_data entry for every vocabulary token
+llama_token LlamaWrapper::sampleToken(int32_t idx) {
+    const size_t n_candidates = sampleCandidates();
+    const float* logits = n_candidates > 0 ? llama_get_logits_ith(m_context, idx) : nullptr;
+    if (!logits) {
+        return llama_sampler_sample(m_sampler, m_context, idx);
+    }
+
+    const int32_t n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(m_model));
+    llama_token token;
+    if (n_candidates == 1) {
+        token = argmaxLogits(logits, n_vocab);
+    } else {
+        m_candidates.resize(n_candidates);
+        llama_token_data_array cur_p = {
+            m_candidates.data(), topKLogits(logits, n_vocab, n_candidates, m_candidates.data()), -1, false
+        };
+        llama_sampler_apply(m_sampler, &cur_p);
+        if (cur_p.selected < 0 || cur_p.selected >= (int64_t) cur_p.size) {
+            return llama_sampler_sample(m_sampler, m_context, idx);
+        }
+        token = cur_p.data[cur_p.selected].id;
+    }
+    llama_sampler_accept(m_sampler, token);
+    return token;
+}
+
+void LlamaWrapper::setPromptLookup(int n_draft) {
+    const int n_max = m_context ? (int) llama_n_batch(m_context) - 1 : MAX_PROMPT_LOOKUP_DRAFT;
+    m_n_lookup_draft = std::max(0, std::min({n_draft, n_max, MAX_PROMPT_LOOKUP_DRAFT}));
+    if (m_n_lookup_draft == 0) m_ngram_drafter.clear();
+    LOGI("Prompt lookup drafting %s (%d tokens)", m_n_lookup_draft > 0 ? "enabled" : "disabled", m_n_lookup_draft);
+}
+
+// Proposes up to n_left tokens following the committed history plus `last`,
+// from the draft model when one is loaded, else from earlier text of the chat
+void LlamaWrapper::draftTokens(llama_token last, int n_left, std::vector<llama_token>& draft) {
+    if (n_left <= 0 || !m_partial_rollback) return;
+    if (m_draft_context) {
+        draftWithModel(last, std::min(m_n_draft, n_left), draft);
+    } else if (m_n_lookup_draft > 0) {
+        // Only the tokens committed since the last draft are indexed; rollbacks
+        // were reported where m_session_tokens was cut
+        m_ngram_drafter.sync(m_session_tokens);
+        m_ngram_drafter.draft(last, std::min(m_n_lookup_draft, n_left), draft);
+    }
+}
+
+// Greedy continuation from the draft model. Its KV cache mirrors the chat: the
+// part that still matches m_session_tokens is kept (rejected drafts and turns
+// that were edited or shifted away are dropped) and only the rest is decoded.
+void LlamaWrapper::draftWithModel(llama_token last, int n_draft, std::vector<llama_token>& draft) {
+    if (m_session_tokens.size() + 1 + n_draft > llama_n_ctx(m_draft_context)) return;
+    llama_memory_t mem = llama_get_memory(m_draft_context);
+    if (!mem) return;
+
+    size_t n_keep = 0;
+    while (n_keep < m_draft_tokens.size() && n_keep < m_session_tokens.size() &&
+           m_draft_tokens[n_keep] == m_session_tokens[n_keep]) {
+        ++n_keep;
+    }
+    if (n_keep < m_draft_tokens.size() && !llama_memory_seq_rm(mem, 0, (llama_pos) n_keep, -1)) {
+        llama_memory_clear(mem, true);
+        n_keep = 0;
+    }
+    m_draft_tokens.resize(n_keep);
+
+    std::vector<llama_token> pending(m_session_tokens.begin() + n_keep, m_session_tokens.end());
+    pending.push_back(last);
+
+    llama_batch& batch = *m_batch;
+    const size_t n_batch = llama_n_batch(m_draft_context);
+    for (size_t start = 0; start < pending.size(); start += n_batch) {
+        const size_t n_chunk = std::min(n_batch, pending.size() - start);
+        for (size_t i = 0; i < n_chunk; ++i) {
+            batch.token[i] = pending[start + i];
+            batch.pos[i] = (llama_pos) (m_draft_tokens.size() + i);
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = 0;
+            batch.logits[i] = start + i + 1 == pending.size();
+        }
+        batch.n_tokens = (int32_t) n_chunk;
+        if (llama_decode(m_draft_context, batch) != 0) {
+            LOGE("Draft model decode failed");
+            llama_memory_seq_rm(mem, 0, (llama_pos) m_draft_tokens.size(), -1);
+            return;
+        }
+        m_draft_tokens.insert(m_draft_tokens.end(), pending.begin() + start, pending.begin() + start + n_chunk);
+    }
+
+    const llama_vocab* vocab = llama_model_get_vocab(m_draft_model);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    for (int i = 0; i < n_draft; ++i) {
+        // Greedy drafts straight from the logits row
+        llama_token token = argmaxLogits(llama_get_logits_ith(m_draft_context, -1), n_vocab);
+        if (llama_vocab_is_eog(vocab, token) || isStopToken(token)) break;
+        draft.push_back(token);
+        if (i + 1 == n_draft) break;
+
+        batch.token[0] = token;
+        batch.pos[0] = (llama_pos) m_draft_tokens.size();
+        batch.n_seq_id[0] = 1;
+        batch.seq_id[0][0] = 0;
+        batch.logits[0] = true;
+        batch.n_tokens = 1;
+        if (llama_decode(m_draft_context, batch) != 0) break;
+        m_draft_tokens.push_back(token);
+    }
+}
+
+// Brings the KV cache to sequence_tokens by keeping the longest common prefix
+// with what is already cached and decoding only the divergent suffix, so prefill
+// cost is proportional to the new or edited turn rather than the whole history.
+// Each sampled token is detokenized and handed to on_piece (when set) before the
+// next decode, so the caller can render the response while it is generated.
+std::string LlamaWrapper::generateText(const std::vector<llama_token>& sequence_tokens, int max_tokens,
+                                       const TokenCallback& on_piece) {
+    if (!m_context || sequence_tokens.empty()) return "";
+
+    llama_memory_t mem = llama_get_memory(m_context);
+    const auto start = std::chrono::steady_clock::now();
+
+    seedFromSystemSnapshot(sequence_tokens);
+
+    size_t n_keep = 0;
+    while (n_keep < m_session_tokens.size() && n_keep < sequence_tokens.size() &&
+           m_session_tokens[n_keep] == sequence_tokens[n_keep]) {
+        ++n_keep;
+    }
+    // The last token must be decoded again to get logits for sampling
+    if (n_keep == sequence_tokens.size()) {
+        --n_keep;
+    }
+
+    if (n_keep < m_session_tokens.size()) {
+        // Recurrent models cannot drop a partial tail; fall back to a full prefill
+        if (!mem || !llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) n_keep, -1)) {
+            LOGD("Partial KV removal not supported, re-prefilling from scratch");
+            resetConversation();
+            n_keep = seedFromSystemSnapshot(sequence_tokens) ? m_system_tokens.size() : 0;
+        }
+        m_session_tokens.resize(n_keep);
+        m_ngram_drafter.truncate(n_keep);
+    }
+    m_last_reused_tokens = (int) n_keep;
+
+    const llama_pos n_past = (llama_pos) n_keep;
+    const size_t n_new = sequence_tokens.size() - n_keep;
+    ensureFreeCells(n_new + max_tokens);
+
+    // Process prompt
+    if (!prefill(sequence_tokens.data() + n_keep, n_new, n_past, m_chat_seq, true)) {
+        // Roll back any cells written for this turn so the history stays usable
+        if (!mem || !llama_memory_seq_rm(mem, m_chat_seq, n_past, -1)) {
+            resetConversation();
+        }
+        if (m_cancel_requested.load(std::memory_order_relaxed)) {
+            LOGI("Prompt processing cancelled");
+            m_last_stop_reason = STOP_CANCELLED;
+            return "";
+        }
+        LOGE("Failed to decode prompt batch");
+        m_last_stop_reason = STOP_ERROR;
+        return "Error: Failed to process prompt";
+    }
+
+    m_session_tokens.insert(m_session_tokens.end(), sequence_tokens.begin() + n_keep, sequence_tokens.end());
+    LOGD("Prefilled %zu new tokens, reused %d cached", n_new, n_past);
+
+    const struct llama_vocab* vocab = llama_model_get_vocab(m_model);
+    m_detokenizer.reset(vocab);
+    // Penalties only look at this response; sampleToken accepts each sampled
+    // token into the chain, so tokens are not accepted again here
+    llama_sampler_reset(m_sampler);
+    m_stop_matcher.reset();
+    m_last_stop_reason = STOP_MAX_TOKENS;
+    m_last_speculative_stats = SpeculativeStats();
+
+    const size_t response_pos = m_session_tokens.size();  // KV position of the first response token
+    std::vector<size_t> token_text_start;                 // response text offset where each token begins
+    size_t n_streamed = 0;
+    size_t text_end = std::string::npos;                  // where the reply is cut, if anywhere
+    int n_generated = 0;
+    const auto decode_start = std::chrono::steady_clock::now();
+    m_repetition_detector.reset();
+
+    // Ends the reply before response token n_keep. Tokens from there on that
+    // were already decoded are dropped so the next turn's template follows the
+    // reply text.
+    auto cutResponse = [&](size_t n_keep) {
+        const size_t n_decoded = m_session_tokens.size() - response_pos;
+        if (n_keep < n_decoded && mem &&
+            llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) (response_pos + n_keep), -1)) {
+            m_session_tokens.resize(response_pos + n_keep);
+            m_ngram_drafter.truncate(response_pos + n_keep);
+        }
+    };
+
+    // Adds a sampled token to the response; returns false when generation ends with it
+    auto commit = [&](llama_token token) -> bool {
+        // End-of-generation tokens (EOS, <|im_end|>, <|end|>, ...) are never decoded
+        if (llama_vocab_is_eog(vocab, token)) {
+            m_last_stop_reason = STOP_EOG;
+            return false;
+        }
+        // Nor are stop markers sampled as a single special token
+        if (isStopToken(token)) {
+            m_last_stop_reason = STOP_STRING;
+            return false;
+        }
+
+        if (n_generated++ == 0) {
+            LOGD("Time to first token: %.1f ms", std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+        // Pieces ending inside a multi-byte character are held until it completes
+        token_text_start.push_back(m_detokenizer.text().size());
+        const std::string& piece = m_detokenizer.push(token);
+
+        if (m_stop_matcher.feed(piece)) {
+            // Tokens spelling out the stop string are not part of the reply
+            text_end = m_stop_matcher.matchStart();
+            size_t n_kept = 0;
+            while (n_kept < token_text_start.size() && token_text_start[n_kept] < text_end) {
+                ++n_kept;
+            }
+            cutResponse(n_kept);
+            m_last_stop_reason = STOP_STRING;
+            return false;
+        }
+
+        // A block repeated back to back is kept once; the copies are dropped
+        if (m_repetition_detector.push(token)) {
+            const size_t n_kept = token_text_start.size() - m_repetition_detector.repeatedTokens();
+            text_end = token_text_start[n_kept];
+            cutResponse(n_kept);
+            LOGI("Repetition loop: %zu-token block repeated, %zu tokens dropped",
+                 m_repetition_detector.period(), m_repetition_detector.repeatedTokens());
+            m_last_stop_reason = STOP_REPETITION;
+            return false;
+        }
+
+        // Stream only text that can no longer turn out to be part of a stop string
+        const size_t n_safe = m_stop_matcher.safeLength();
+        if (on_piece && n_safe > n_streamed) {
+            on_piece(m_detokenizer.text().substr(n_streamed, n_safe - n_streamed));
+            n_streamed = n_safe;
+        }
+        return true;
+    };
+
+    // Generate tokens. Each step decodes the committed token together with any
+    // drafted continuation; output i of that batch is the target's own choice
+    // after batch token i, so drafts are accepted for as long as they agree.
+    std::vector<llama_token> draft;
+    std::vector<llama_token> step_tokens;
+    llama_token token = sampleToken(-1);
+    while (true) {
+        if (m_cancel_requested.load(std::memory_order_relaxed)) {
+            m_last_stop_reason = STOP_CANCELLED;
+            break;
+        }
+        if (!commit(token)) break;
+
+        const int n_left = max_tokens - n_generated;
+        draft.clear();
+        if (n_left > 0) {
+            draftTokens(token, n_left, draft);
+        }
+
+        step_tokens.assign(1, token);
+        step_tokens.insert(step_tokens.end(), draft.begin(), draft.end());
+        if (!decodeTokens(step_tokens, (llama_pos) m_session_tokens.size())) {
+            // An aborted or failed batch may have left some of its ubatches behind
+            if (mem) {
+                llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) m_session_tokens.size(), -1);
+            }
+            if (m_cancel_requested.load(std::memory_order_relaxed)) {
+                m_last_stop_reason = STOP_CANCELLED;
+            } else {
+                LOGE("Failed to decode token at position %zu", m_session_tokens.size());
+                m_last_stop_reason = STOP_ERROR;
+            }
+            break;
+        }
+        m_session_tokens.push_back(token);
+        if (n_left <= 0) break;
+
+        size_t n_accepted = 0;
+        bool stopped = false;
+        token = sampleToken(0);
+        while (n_accepted < draft.size() && token == draft[n_accepted]) {
+            if (!commit(token)) {
+                stopped = true;
+                break;
+            }
+            m_session_tokens.push_back(token);
+            ++n_accepted;
+            if (n_generated >= max_tokens) {
+                stopped = true;
+                break;
+            }
+            token = sampleToken((int32_t) n_accepted);
+        }
+
+        m_last_speculative_stats.drafted += (int) draft.size();
+        m_last_speculative_stats.accepted += (int) n_accepted;
+
+        // Rejected drafts left cells behind the accepted tokens
+        if (n_accepted < draft.size() && mem) {
+            llama_memory_seq_rm(mem, m_chat_seq, (llama_pos) m_session_tokens.size(), -1);
+        }
+        if (stopped) break;
+    }
+
+    SpeculativeStats& spec = m_last_speculative_stats;
+    spec.generated = n_generated;
+    spec.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decode_start).count();
+    if (spec.drafted > 0) {
+        LOGI("Speculative decoding: %d/%d drafts accepted (%.0f%%), %d tokens at %.1f tok/s",
+             spec.accepted, spec.drafted, 100.0 * spec.accepted / spec.drafted, spec.generated,
+             spec.ms > 0 ? spec.generated * 1000.0 / spec.ms : 0.0);
+    }
+
+    const std::string& text = m_detokenizer.text();
+    const size_t n_text = std::min(text_end, text.size());
+    if (on_piece && n_text > n_streamed) {
+        on_piece(text.substr(n_streamed, n_text - n_streamed));
+    }
+    LOGD("Generation stopped: %s after %d tokens", stopReasonName(m_last_stop_reason), n_generated);
+    return text.substr(0, n_text);
+}
+
+const char* LlamaWrapper::stopReasonName(StopReason reason) {
+    switch (reason) {
+        case STOP_EOG: return "end of generation";
+        case STOP_STRING: return "stop string";
+        case STOP_MAX_TOKENS: return "token limit";
+        case STOP_ERROR: return "decode error";
+        case STOP_REPETITION: return "repetition loop";
+        case STOP_CANCELLED: return "cancelled";
+        default: return "none";
+    }
 }
@@ -1,14 +1,32 @@
 #ifndef LLAMA_WRAPPER_H
 #define LLAMA_WRAPPER_H
 
+#include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
+#include "autotune.h"
+#include "context_planner.h"
+#include "cpu_topology.h"
+#include "inference_thread.h"
+#include "ngram_drafter.h"
+#include "repetition_detector.h"
+#include "sampling_profile.h"
+#include "session_cache.h"
+#include "stop_matcher.h"
+#include "stream_detokenizer.h"
 
 // Forward declarations
 struct llama_model;
 struct llama_context;
 struct llama_sampler;
+struct llama_batch;
+struct llama_context_params;
+struct llama_token_data;
+struct ggml_threadpool;
 typedef int32_t llama_token;
+typedef int32_t llama_pos;
+typedef int32_t llama_seq_id;
 
 class LlamaWrapper {
 public:
@@ -20,30 +38,254 @@ public:
         MODEL_DEEPSEEK = 4
     };
 
+    // KV cache precision; quantized V needs flash attention and falls back to f16
+    enum KvPrecision {
+        KV_AUTO = -1,
+        KV_F16 = 0,
+        KV_Q8_0 = 1,
+        KV_Q4_0 = 2
+    };
+
+    // Why the last generation ended
+    enum StopReason {
+        STOP_NONE = 0,
+        STOP_EOG = 1,          // end-of-generation token
+        STOP_STRING = 2,       // one of the model's stop strings appeared in the text
+        STOP_MAX_TOKENS = 3,
+        STOP_ERROR = 4,
+        STOP_REPETITION = 5,   // the output started looping over the same block of tokens
+        STOP_CANCELLED = 6     // cancelGeneration() was called
+    };
+
+    // Receives each decoded piece of the response as soon as it is sampled
+    typedef std::function<void(const std::string& piece)> TokenCallback;
+    typedef std::function<void(int done, int total)> ProgressCallback;
+
     LlamaWrapper();
     ~LlamaWrapper();
 
-    bool initialize(const std::string& modelPath);
-    std::string generateResponse(const std::string& prompt);
+    bool initialize(const std::string& modelPath, KvPrecision kvPrecision = KV_AUTO);
+    std::string generateResponse(const std::string& prompt, const TokenCallback& on_piece = TokenCallback());
+    std::string regenerateResponse(const std::string& prompt, const TokenCallback& on_piece = TokenCallback());
+    void resetConversation();
+    bool saveSession(const std::string& dir, const std::string& sessionId);
+    bool restoreSession(const std::string& dir, const std::string& sessionId);
+    void startNewChat();
+    void deleteSession(const std::string& dir, const std::string& sessionId);
+    // Decodes the settled part of a message that is still being typed into the
+    // active chat, so sending it only decodes what changed since the last call.
+    // sessionId must name the active chat (or the chat must be unsaved). Only
+    // KV cells that are already free are used; no resident chat is evicted.
+    bool prefillDraft(const std::string& sessionId, const std::string& partialText);
+    std::string benchmarkSessionFormats(const std::string& dir);
+    std::string benchmarkDetokenizer(int iterations);
+    std::string benchmarkSampling(int iterations);
+    void setSessionCacheBudget(size_t bytes) { m_session_cache.setBudget(bytes); }
+    SessionCache::Stats getSessionCacheStats() const { return m_session_cache.getStats(); }
     void cleanup();
+    // Thread-safe: stops the running request within one ubatch. The KV cache
+    // keeps everything decoded so far, like a reply that hit the token limit.
+    void cancelGeneration();
     bool isInitialized() const { return m_initialized; }
+    int getLastReusedTokens() const { return m_last_reused_tokens; }
+    StopReason getLastStopReason() const { return m_last_stop_reason; }
+    size_t getKvCacheBytes() const { return m_kv_cache_bytes; }
+    void setPrefillChunkSize(int n_tokens);
+    int getPrefillChunkSize() const { return m_prefill_chunk; }
+    // Threads for single-token decode and for prompt batches. The persistent
+    // threadpools are rebuilt right away unless a request is running, in which
+    // case the counts apply from the next model load.
+    void setThreadCounts(int n_decode, int n_batch);
+    int getDecodeThreads() const { return m_n_threads; }
+    int getBatchThreads() const { return m_n_threads_batch; }
+    const CpuTopology& getCpuTopology() const { return m_cpu_topology; }
+    // Results file for the batch/thread autotuner; empty disables it. A saved
+    // result for this model and CPU is applied by initialize().
+    void setAutotuneFile(const std::string& path) { m_autotune_path = path; }
+    // Measures the loaded model and saves the result; false when it failed or
+    // was cancelled. on_progress is called after each measurement.
+    bool autotune(const ProgressCallback& on_progress);
+    const TuneConfig& getTuneConfig() const { return m_tune_config; }
+    // Total bytes for weights, KV cache and buffers; 0 plans against a share of MemAvailable.
+    // Takes effect on the next initialize().
+    void setMemoryBudget(uint64_t bytes) { m_memory_budget_bytes = bytes; }
+    const ContextPlan& getContextPlan() const { return m_context_plan; }
+
+    struct PrefillChunkTiming {
+        int n_tokens;
+        double ms;
+    };
+    const std::vector<PrefillChunkTiming>& getLastPrefillTimings() const { return m_last_prefill_timings; }
+
+    // Sampler settings for the following requests; chains are cached per profile,
+    // so switching back and forth costs nothing once each has been used
+    bool setSamplingProfile(const SamplingProfile& profile);
+    const SamplingProfile& getSamplingProfile() const { return m_sampling_profile; }
+
+    // Speculative decoding with a smaller model that shares the vocabulary.
+    // Must be loaded after initialize(); unloaded with the main model.
+    bool loadDraftModel(const std::string& path, int n_draft);
+    void unloadDraftModel();
+
+    struct SpeculativeStats {
+        int drafted = 0;
+        int accepted = 0;
+        int generated = 0;
+        double ms = 0;       // sampling + decoding time of the response
+    };
+    const SpeculativeStats& getLastSpeculativeStats() const { return m_last_speculative_stats; }
+
+    // Draft-free speculation: up to n_draft tokens copied from where the chat's
+    // trailing n-gram appeared before. 0 disables; a loaded draft model wins.
+    void setPromptLookup(int n_draft);
+    int getPromptLookup() const { return m_n_lookup_draft; }
 
 private:
     ModelType detectModelType(const std::string& modelPath);
+    KvPrecision defaultKvPrecision(ModelType type);
+    ContextPlan planContextForModel(KvPrecision precision, bool allow_smaller_kv);
+    llama_context* createContext(llama_context_params& ctx_params, ggml_type kv_type);
+    size_t estimateKvCacheBytes(const llama_context_params& ctx_params);
+    std::string runTurn(const std::string& prompt, bool replace_last_turn, const TokenCallback& on_piece);
     std::string getSystemPrompt();
+    std::string getTurnPrefix(bool first_turn);
+    std::string getTurnSuffix();
     std::vector<std::string> getStopSequences();
-    std::vector<llama_token> tokenize(const std::string& text, bool add_bos);
-    std::string detokenize(const std::vector<llama_token>& tokens);
-    std::string generateText(const std::vector<llama_token>& prompt_tokens, int max_tokens);
+    bool isStopToken(llama_token token) const;
+    static const char* stopReasonName(StopReason reason);
+    static bool abortCallback(void* data);
+    bool runAutotune(const llama_context_params& base, TuneConfig& best, const ProgressCallback& on_progress);
+    void applyThreadCounts(int n_decode, int n_batch);
+    bool createThreadPools();
+    void freeThreadPools();
+    void resumeThreadPools();
+    void pauseThreadPools();
+    std::vector<llama_token> buildTurnTokens(const std::string& prompt, bool first_turn);
+    bool syncSessionWithMemory();
+    void discardDraftPrefill();
+    bool prepareSystemSnapshot();
+    uint64_t computeModelHash(const std::string& modelPath);
+    std::string sessionFilePath(const std::string& dir, const std::string& sessionId, uint64_t model_hash);
+    void removeSessionFiles(const std::string& dir, const std::string& sessionId, const std::string& keep_path);
+    bool sessionMatchesModel(const SessionFileInfo& info);
+    bool captureChatState(llama_seq_id seq_id, const std::vector<llama_token>& tokens,
+                          size_t last_turn_start, SessionFileInfo& info, std::vector<uint8_t>& state);
+    bool applyChatState(const SessionFileInfo& info, const std::vector<uint8_t>& state);
+    bool writeSessionToDisk(const std::string& dir, const std::string& sessionId,
+                            const SessionFileInfo& info, const std::vector<uint8_t>& state);
+    bool readSessionFromDisk(const std::string& dir, const std::string& sessionId,
+                             SessionFileInfo& info, std::vector<uint8_t>& state);
+    void queueSessionWrite(const std::string& dir, const std::string& sessionId,
+                           SessionFileInfo info, std::vector<uint8_t> state);
+    void queueSessionRemoval(const std::string& dir, const std::string& sessionId);
+    void waitForSessionWrites();
+    static uint64_t chatStateHash(const std::vector<llama_token>& tokens, size_t last_turn_start);
+    bool seedFromSystemSnapshot(const std::vector<llama_token>& sequence_tokens);
+    size_t shiftContext(std::vector<llama_token>& history, size_t n_required);
+    std::vector<llama_token> tokenize(const std::string& text, bool add_bos, bool parse_special = false);
+    std::string generateText(const std::vector<llama_token>& sequence_tokens, int max_tokens,
+                             const TokenCallback& on_piece);
+    bool prefill(const llama_token* tokens, size_t n_tokens, llama_pos pos0, llama_seq_id seq_id, bool want_logits);
+    bool decodeTokens(const std::vector<llama_token>& tokens, llama_pos pos0);
+    bool probePartialRemoval(llama_context* ctx, llama_seq_id seq_id);
+    size_t sampleCandidates() const;
+    llama_token sampleToken(int32_t idx);
+    void draftTokens(llama_token last, int n_left, std::vector<llama_token>& draft);
+    void draftWithModel(llama_token last, int n_draft, std::vector<llama_token>& draft);
+    void resetResidentChats();
+    int findResidentChat(const std::string& sessionId);
+    void activateChat(size_t idx);
+    void releaseChat(size_t idx, bool spill);
+    int leastRecentlyUsedChat();
+    size_t acquireChatSlot();
+    size_t residentCells();
+    void ensureFreeCells(size_t n_needed);
 
     bool m_initialized;
     llama_model* m_model;
     llama_context* m_context;
-    llama_sampler* m_sampler;
+    llama_sampler* m_sampler;                  // active chain, owned by m_sampler_chains
+    SamplerChainCache m_sampler_chains;
+    SamplingProfile m_sampling_profile;
+    std::vector<llama_token_data> m_candidates;   // logits the chain samples from
     std::string m_modelPath;
+    uint64_t m_model_hash;
     ModelType m_current_model_type;
     int m_n_ctx;
-    int m_n_threads;
+    int m_n_threads;             // decode (one token per step)
+    int m_n_threads_batch;       // prefill and speculative verification batches
+    bool m_thread_counts_set;    // false: one thread per performance core
+    CpuTopology m_cpu_topology;
+    std::string m_autotune_path;
+    TuneConfig m_tune_config;    // applied to this model, invalid when not tuned
+    ggml_threadpool* m_threadpool;
+    ggml_threadpool* m_threadpool_batch;   // same as m_threadpool when the counts match
+    size_t m_kv_cache_bytes;
+    uint64_t m_memory_budget_bytes;
+    ContextPlan m_context_plan;
+
+    // Tokens of the active chat resident in the KV cache, in its sequence m_chat_seq
+    std::vector<llama_token> m_session_tokens;
+    size_t m_last_turn_start;    // index in m_session_tokens where the last turn begins
+    int m_last_reused_tokens;    // KV cells kept by the last generateText call
+    size_t m_draft_prefill_len;  // trailing m_session_tokens of a message not sent yet
+
+    // System prompt decoded once per model into its own sequence, copied into new chats
+    std::vector<llama_token> m_system_tokens;
+    bool m_system_snapshot_ready;
+
+    // Prompt decoding in chunks of m_prefill_chunk tokens (at most n_batch)
+    llama_batch* m_batch;
+    int m_prefill_chunk;
+    std::vector<PrefillChunkTiming> m_last_prefill_timings;
+
+    // Chats kept decoded in the KV cache, slot i using sequence FIRST_CHAT_SEQ_ID + i.
+    // The active chat's tokens live in m_session_tokens; the others are parked here.
+    struct ResidentChat {
+        bool in_use = false;
+        std::string session_id;              // empty until the chat is saved or restored
+        std::string dir;
+        std::vector<llama_token> tokens;
+        size_t last_turn_start = 0;
+        uint64_t last_used = 0;
+        uint64_t saved_hash = 0;             // chatStateHash of the copy last queued for disk
+    };
+    std::vector<ResidentChat> m_resident_chats;
+    size_t m_active_chat;
+    llama_seq_id m_chat_seq;
+    uint64_t m_chat_clock;
+
+    // Response text of the current generation, built token by token, and the
+    // matcher cutting it at the model's stop strings
+    StreamDetokenizer m_detokenizer;
+    StopMatcher m_stop_matcher;
+    std::vector<llama_token> m_stop_tokens;    // stop strings that tokenize to one special token
+    StopReason m_last_stop_reason;
+    RepetitionDetector m_repetition_detector;
+    std::atomic<bool> m_generating;            // a request is running in runTurn
+    std::atomic<bool> m_cancel_requested;      // set from other threads, polled by ggml
+
+    // Speculative decoding: drafts are verified in one target batch and rejected
+    // cells removed, which needs memory that supports partial removal
+    bool m_partial_rollback;
+    llama_model* m_draft_model;
+    llama_context* m_draft_context;
+    std::vector<llama_token> m_draft_tokens;   // tokens in the draft model's KV cache
+    int m_n_draft;
+    NgramDrafter m_ngram_drafter;              // prompt lookup over m_session_tokens
+    int m_n_lookup_draft;
+    SpeculativeStats m_last_speculative_stats;
+
+    // Reused staging buffer for session state read from disk
+    std::vector<uint8_t> m_state_buffer;
+
+    // Recently used inactive chats, spilled to session files when evicted
+    SessionCache m_session_cache;
+
+    // Compresses and writes session files in order, off the inference thread.
+    // Declared last so it is destroyed first, draining its queue while the
+    // rest of the wrapper is still intact.
+    InferenceThread m_session_writer;
 };
 
 #endif // LLAMA_WRAPPER_H
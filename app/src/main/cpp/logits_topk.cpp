@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "include/llama.h"
+#include "logits_topk.h"
+
+// LOGITS_NO_SIMD builds the scalar fallback on any target (host tests)
+#if defined(LOGITS_NO_SIMD)
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LOGITS_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define LOGITS_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LOGITS_SSE2 1
+#endif
+
+const char* logitsKernelName() {
+#if defined(LOGITS_NEON)
+    return "neon";
+#elif defined(LOGITS_AVX2)
+    return "avx2";
+#elif defined(LOGITS_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+int32_t argmaxLogitsScalar(const float* logits, int32_t n_vocab) {
+    int32_t best = 0;
+    for (int32_t i = 1; i < n_vocab; ++i) {
+        if (logits[i] > logits[best]) best = i;
+    }
+    return best;
+}
+
+// Per-lane running maximum and the index it was first seen at; lanes are
+// merged at the end preferring the lower index on equal values. Lanes start at
+// -inf on their own first index so NaN logits are skipped as the scalar loop
+// skips them, and an all -inf row still yields index 0.
+int32_t argmaxLogits(const float* logits, int32_t n_vocab) {
+    if (n_vocab <= 0) return -1;
+    // Nothing compares greater than a NaN in slot 0, so the greedy sampler keeps it
+    if (std::isnan(logits[0])) return 0;
+    int32_t i = 0;
+    float best_val = -std::numeric_limits<float>::infinity();
+    int32_t best_idx = -1;
+
+#if defined(LOGITS_NEON)
+    const int W = 4;
+    if (n_vocab >= W) {
+        float32x4_t vmax = vdupq_n_f32(best_val);
+        const int32_t lane_init[4] = {0, 1, 2, 3};
+        int32x4_t vidx = vld1q_s32(lane_init);
+        int32x4_t vcur = vidx;
+        const int32x4_t vstep = vdupq_n_s32(W);
+        for (i = 0; i + W <= n_vocab; i += W) {
+            float32x4_t v = vld1q_f32(logits + i);
+            uint32x4_t gt = vcgtq_f32(v, vmax);
+            vmax = vbslq_f32(gt, v, vmax);
+            vidx = vbslq_s32(gt, vcur, vidx);
+            vcur = vaddq_s32(vcur, vstep);
+        }
+        float lane_val[4];
+        int32_t lane_idx[4];
+        vst1q_f32(lane_val, vmax);
+        vst1q_s32(lane_idx, vidx);
+        for (int l = 0; l < W; ++l) {
+            if (best_idx < 0 || lane_val[l] > best_val || (lane_val[l] == best_val && lane_idx[l] < best_idx)) {
+                best_val = lane_val[l];
+                best_idx = lane_idx[l];
+            }
+        }
+    }
+#elif defined(LOGITS_AVX2)
+    const int W = 8;
+    if (n_vocab >= W) {
+        __m256 vmax = _mm256_set1_ps(best_val);
+        __m256i vidx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i vcur = vidx;
+        const __m256i vstep = _mm256_set1_epi32(W);
+        for (i = 0; i + W <= n_vocab; i += W) {
+            __m256 v = _mm256_loadu_ps(logits + i);
+            __m256 gt = _mm256_cmp_ps(v, vmax, _CMP_GT_OQ);
+            vmax = _mm256_blendv_ps(vmax, v, gt);
+            vidx = _mm256_castps_si256(_mm256_blendv_ps(
+                    _mm256_castsi256_ps(vidx), _mm256_castsi256_ps(vcur), gt));
+            vcur = _mm256_add_epi32(vcur, vstep);
+        }
+        alignas(32) float lane_val[8];
+        alignas(32) int32_t lane_idx[8];
+        _mm256_store_ps(lane_val, vmax);
+        _mm256_store_si256((__m256i*) lane_idx, vidx);
+        for (int l = 0; l < W; ++l) {
+            if (best_idx < 0 || lane_val[l] > best_val || (lane_val[l] == best_val && lane_idx[l] < best_idx)) {
+                best_val = lane_val[l];
+                best_idx = lane_idx[l];
+            }
+        }
+    }
+#elif defined(LOGITS_SSE2)
+    const int W = 4;
+    if (n_vocab >= W) {
+        __m128 vmax = _mm_set1_ps(best_val);
+        __m128i vidx = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i vcur = vidx;
+        const __m128i vstep = _mm_set1_epi32(W);
+        for (i = 0; i + W <= n_vocab; i += W) {
+            __m128 v = _mm_loadu_ps(logits + i);
+            __m128 gt = _mm_cmpgt_ps(v, vmax);
+            vmax = _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, vmax));
+            __m128i gti = _mm_castps_si128(gt);
+            vidx = _mm_or_si128(_mm_and_si128(gti, vcur), _mm_andnot_si128(gti, vidx));
+            vcur = _mm_add_epi32(vcur, vstep);
+        }
+        alignas(16) float lane_val[4];
+        alignas(16) int32_t lane_idx[4];
+        _mm_store_ps(lane_val, vmax);
+        _mm_store_si128((__m128i*) lane_idx, vidx);
+        for (int l = 0; l < W; ++l) {
+            if (best_idx < 0 || lane_val[l] > best_val || (lane_val[l] == best_val && lane_idx[l] < best_idx)) {
+                best_val = lane_val[l];
+                best_idx = lane_idx[l];
+            }
+        }
+    }
+#endif
+
+    // Tail, or the whole row without SIMD
+    for (; i < n_vocab; ++i) {
+        if (best_idx < 0 || logits[i] > best_val) {
+            best_val = logits[i];
+            best_idx = i;
+        }
+    }
+    return best_idx;
+}
+
+static bool greaterLogit(const llama_token_data& a, const llama_token_data& b) {
+    return a.logit > b.logit;
+}
+
+// Min-heap of the k best entries; the heap root is the threshold to beat
+static inline void offer(llama_token_data* heap, size_t& size, size_t k, int32_t id, float logit) {
+    if (size < k) {
+        heap[size++] = {id, logit, 0.0f};
+        std::push_heap(heap, heap + size, greaterLogit);
+    } else if (logit > heap[0].logit) {
+        std::pop_heap(heap, heap + size, greaterLogit);
+        heap[size - 1] = {id, logit, 0.0f};
+        std::push_heap(heap, heap + size, greaterLogit);
+    }
+}
+
+size_t topKLogitsScalar(const float* logits, int32_t n_vocab, size_t k, llama_token_data* out) {
+    k = std::min(k, (size_t) std::max(n_vocab, 0));
+    size_t size = 0;
+    for (int32_t i = 0; i < n_vocab && k > 0; ++i) {
+        offer(out, size, k, i, logits[i]);
+    }
+    return size;
+}
+
+// Once the heap is full only lanes above its root need the scalar insert, and
+// after the first few thousand tokens almost no vector has one
+size_t topKLogits(const float* logits, int32_t n_vocab, size_t k, llama_token_data* out) {
+    k = std::min(k, (size_t) std::max(n_vocab, 0));
+    if (k == 0) return 0;
+
+    size_t size = 0;
+    int32_t i = 0;
+    for (; i < n_vocab && size < k; ++i) {
+        offer(out, size, k, i, logits[i]);
+    }
+
+#if defined(LOGITS_NEON)
+    for (; i + 4 <= n_vocab; i += 4) {
+        uint32x4_t gt = vcgtq_f32(vld1q_f32(logits + i), vdupq_n_f32(out[0].logit));
+        uint32x2_t any = vorr_u32(vget_low_u32(gt), vget_high_u32(gt));  // no vmaxvq on armv7
+        if ((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) continue;
+        for (int l = 0; l < 4; ++l) offer(out, size, k, i + l, logits[i + l]);
+    }
+#elif defined(LOGITS_AVX2)
+    for (; i + 8 <= n_vocab; i += 8) {
+        __m256 gt = _mm256_cmp_ps(_mm256_loadu_ps(logits + i), _mm256_set1_ps(out[0].logit), _CMP_GT_OQ);
+        if (_mm256_movemask_ps(gt) == 0) continue;
+        for (int l = 0; l < 8; ++l) offer(out, size, k, i + l, logits[i + l]);
+    }
+#elif defined(LOGITS_SSE2)
+    for (; i + 4 <= n_vocab; i += 4) {
+        __m128 gt = _mm_cmpgt_ps(_mm_loadu_ps(logits + i), _mm_set1_ps(out[0].logit));
+        if (_mm_movemask_ps(gt) == 0) continue;
+        for (int l = 0; l < 4; ++l) offer(out, size, k, i + l, logits[i + l]);
+    }
+#endif
+
+    for (; i < n_vocab; ++i) {
+        offer(out, size, k, i, logits[i]);
+    }
+    return size;
+}
@@ -0,0 +1,27 @@
+#ifndef LOGITS_TOPK_H
+#define LOGITS_TOPK_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct llama_token_data;
+
+// Selection over a raw logits row (llama_get_logits_ith) without building a
+// llama_token_data entry per vocabulary token. Vectorized with NEON, AVX2 or
+// SSE2 depending on the target, with a scalar fallback.
+
+// Index of the largest logit; the lowest index wins ties, like the greedy sampler
+int32_t argmaxLogits(const float* logits, int32_t n_vocab);
+
+// The k largest logits as token data (p = 0), in no particular order.
+// Returns min(k, n_vocab) and writes that many entries to out.
+size_t topKLogits(const float* logits, int32_t n_vocab, size_t k, llama_token_data* out);
+
+// Plain loops over the same inputs, for checking and benchmarking the kernels
+int32_t argmaxLogitsScalar(const float* logits, int32_t n_vocab);
+size_t topKLogitsScalar(const float* logits, int32_t n_vocab, size_t k, llama_token_data* out);
+
+// Instruction set the kernels were built for
+const char* logitsKernelName();
+
+#endif // LOGITS_TOPK_H
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include "ngram_drafter.h"
+
+NgramDrafter::NgramDrafter(int min_n, int max_n)
+        : m_min_n(std::max(1, min_n)), m_max_n(std::max(m_min_n, max_n)),
+          m_index(m_max_n - m_min_n + 1) {
+}
+
+void NgramDrafter::clear() {
+    m_tokens.clear();
+    for (auto& table : m_index) table.clear();
+}
+
+static const uint64_t HASH_SEED = 1469598103934665603ULL;
+
+static uint64_t hashStep(uint64_t h, llama_token token) {
+    return (h ^ (uint32_t) token) * 1099511628211ULL;
+}
+
+uint64_t NgramDrafter::hashAt(size_t end, int n) const {
+    uint64_t h = HASH_SEED;
+    for (size_t i = end + 1 - n; i <= end; ++i) {
+        h = hashStep(h, m_tokens[i]);
+    }
+    return h;
+}
+
+// An n-gram is indexed once the token after it exists, so the trailing n-gram
+// never finds itself
+void NgramDrafter::indexEndingAt(size_t end) {
+    for (int n = m_min_n; n <= m_max_n && (size_t) n <= end + 1; ++n) {
+        m_index[n - m_min_n][hashAt(end, n)] = (uint32_t) (end + 1);
+    }
+}
+
+void NgramDrafter::push(llama_token token) {
+    m_tokens.push_back(token);
+    if (m_tokens.size() >= 2) {
+        indexEndingAt(m_tokens.size() - 2);
+    }
+}
+
+void NgramDrafter::sync(const std::vector<llama_token>& tokens) {
+    // A shorter sequence is a rollback nobody reported; that much is free to see
+    if (tokens.size() < m_tokens.size()) {
+        truncate(tokens.size());
+    }
+    for (size_t i = m_tokens.size(); i < tokens.size(); ++i) {
+        push(tokens[i]);
+    }
+}
+
+void NgramDrafter::truncate(size_t n) {
+    if (n >= m_tokens.size()) return;
+    // Entries may point past n; rebuilding is linear and only happens when the
+    // history was rewritten
+    std::vector<llama_token> kept(m_tokens.begin(), m_tokens.begin() + n);
+    clear();
+    for (llama_token token : kept) push(token);
+}
+
+int NgramDrafter::draft(int n_draft, std::vector<llama_token>& out) const {
+    return draftFrom(nullptr, n_draft, out);
+}
+
+int NgramDrafter::draft(llama_token next, int n_draft, std::vector<llama_token>& out) const {
+    return draftFrom(&next, n_draft, out);
+}
+
+// Drafts from the indexed tokens followed by *next when given. The n-gram
+// ending at the last indexed token is only indexed once its successor is
+// pushed, so neither trailing n-gram can find itself.
+int NgramDrafter::draftFrom(const llama_token* next_token, int n_draft, std::vector<llama_token>& out) const {
+    const size_t size = m_tokens.size() + (next_token ? 1 : 0);
+    auto at = [&](size_t i) { return i < m_tokens.size() ? m_tokens[i] : *next_token; };
+
+    for (int n = std::min<int>(m_max_n, (int) size); n >= m_min_n; --n) {
+        uint64_t h = HASH_SEED;
+        for (size_t i = size - n; i < size; ++i) h = hashStep(h, at(i));
+        const auto& table = m_index[n - m_min_n];
+        auto it = table.find(h);
+        if (it == table.end()) continue;
+
+        // Hash collisions are cheap to rule out
+        const size_t next = it->second;
+        bool same = true;
+        for (int i = 0; i < n && same; ++i) same = at(next - n + i) == at(size - n + i);
+        if (!same) continue;
+
+        for (size_t i = next; i < size && (int) out.size() < n_draft; ++i) {
+            out.push_back(at(i));
+        }
+        return out.empty() ? 0 : n;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef NGRAM_DRAFTER_H
+#define NGRAM_DRAFTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+typedef int32_t llama_token;
+
+// Prompt-lookup drafting: proposes the tokens that followed the most recent
+// earlier occurrence of the sequence's trailing n-gram. Every n-gram of the
+// sequence is indexed in a hash table per n, updated as tokens are appended.
+class NgramDrafter {
+public:
+    NgramDrafter(int min_n = 2, int max_n = 4);
+
+    // Indexes the tokens past size(); the ones already indexed are taken to be
+    // unchanged and are not compared. Rewrites must be reported with truncate
+    // first. A missed one only costs acceptance: drafts are verified anyway.
+    void sync(const std::vector<llama_token>& tokens);
+
+    // Appends one token to the indexed sequence
+    void push(llama_token token);
+
+    // Forgets everything from position n on, after a rollback or an edit;
+    // re-indexes the kept prefix when anything was dropped
+    void truncate(size_t n);
+
+    // Continuation of the longest trailing n-gram seen before, up to n_draft
+    // tokens; returns the n that matched, 0 when nothing did
+    int draft(int n_draft, std::vector<llama_token>& out) const;
+
+    // Same, for the indexed sequence followed by `next`, which is not indexed
+    int draft(llama_token next, int n_draft, std::vector<llama_token>& out) const;
+
+    void clear();
+    size_t size() const { return m_tokens.size(); }
+
+private:
+    uint64_t hashAt(size_t end, int n) const;
+    void indexEndingAt(size_t end);
+    int draftFrom(const llama_token* next, int n_draft, std::vector<llama_token>& out) const;
+
+    int m_min_n;
+    int m_max_n;
+    std::vector<llama_token> m_tokens;
+    // Per n: hash of the n-gram ending at index i -> i + 1, latest occurrence wins
+    std::vector<std::unordered_map<uint64_t, uint32_t>> m_index;
+};
+
+#endif // NGRAM_DRAFTER_H
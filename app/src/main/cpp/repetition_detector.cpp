@@ -0,0 +1,39 @@
+#include <algorithm>
+#include "repetition_detector.h"
+
+RepetitionDetector::RepetitionDetector(size_t max_period, size_t max_repeats, size_t min_span)
+        : m_max_period(std::max<size_t>(1, max_period)), m_max_repeats(std::max<size_t>(1, max_repeats)),
+          m_min_span(min_span), m_ring(m_max_period + 1), m_count(0), m_run(m_max_period + 1, 0),
+          m_period(0), m_repeated(0) {
+}
+
+void RepetitionDetector::reset() {
+    m_count = 0;
+    std::fill(m_run.begin(), m_run.end(), 0);
+    m_period = 0;
+    m_repeated = 0;
+}
+
+bool RepetitionDetector::push(llama_token token) {
+    const size_t ring_size = m_ring.size();
+    const size_t pos = m_count % ring_size;
+    m_ring[pos] = token;
+    ++m_count;
+
+    const size_t n_periods = std::min(m_max_period, m_count - 1);
+    for (size_t p = 1; p <= n_periods; ++p) {
+        const llama_token earlier = m_ring[(pos + ring_size - p) % ring_size];
+        m_run[p] = earlier == token ? m_run[p] + 1 : 0;
+    }
+
+    // The shortest period explains the loop best ("ab" rather than "abab")
+    for (size_t p = 1; p <= n_periods; ++p) {
+        const size_t run = m_run[p];
+        if (run >= p * m_max_repeats && run + p >= m_min_span) {
+            m_period = p;
+            m_repeated = run;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+#ifndef REPETITION_DETECTOR_H
+#define REPETITION_DETECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef int32_t llama_token;
+
+// Detects a generation stuck in a loop: the newest tokens being the same block
+// of `period` tokens back to back more than max_repeats times. For every period
+// up to max_period it keeps how many of the latest tokens equal the token one
+// period earlier, so each pushed token costs max_period compares and no scan.
+class RepetitionDetector {
+public:
+    RepetitionDetector(size_t max_period = 128, size_t max_repeats = 3, size_t min_span = 32);
+
+    void reset();
+
+    // Adds the next token; returns true once it completes a loop
+    bool push(llama_token token);
+
+    // Length of the repeating block and how many trailing tokens repeat it
+    // (everything after its first occurrence), valid after push returned true
+    size_t period() const { return m_period; }
+    size_t repeatedTokens() const { return m_repeated; }
+
+private:
+    size_t m_max_period;
+    size_t m_max_repeats;
+    size_t m_min_span;               // loops shorter than this in total are left alone
+
+    std::vector<llama_token> m_ring; // last max_period + 1 tokens
+    size_t m_count;
+    std::vector<uint32_t> m_run;     // per period p: trailing tokens equal to the one p back
+
+    size_t m_period;
+    size_t m_repeated;
+};
+
+#endif // REPETITION_DETECTOR_H
@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cstring>
+#include "include/llama.h"
+#include "sampling_profile.h"
+
+template <typename T>
+static uint64_t mix(uint64_t h, T value) {
+    unsigned char bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    for (unsigned char b : bytes) {
+        h = (h ^ b) * 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t SamplingProfile::hash() const {
+    uint64_t h = 1469598103934665603ULL;
+    h = mix(h, temperature);
+    h = mix(h, top_k);
+    h = mix(h, top_p);
+    h = mix(h, min_p);
+    h = mix(h, penalty_last_n);
+    h = mix(h, penalty_repeat);
+    h = mix(h, penalty_freq);
+    h = mix(h, penalty_present);
+    return mix(h, seed);
+}
+
+bool SamplingProfile::operator==(const SamplingProfile& other) const {
+    return temperature == other.temperature && top_k == other.top_k && top_p == other.top_p &&
+           min_p == other.min_p && penalty_last_n == other.penalty_last_n &&
+           penalty_repeat == other.penalty_repeat && penalty_freq == other.penalty_freq &&
+           penalty_present == other.penalty_present && seed == other.seed;
+}
+
+std::string SamplingProfile::describe() const {
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+             "temp=%.2f top_k=%d top_p=%.2f min_p=%.2f penalties(last_n=%d repeat=%.2f freq=%.2f present=%.2f) seed=%u",
+             temperature, top_k, top_p, min_p, penalty_last_n, penalty_repeat, penalty_freq, penalty_present, seed);
+    return buf;
+}
+
+llama_sampler* buildSamplerChain(const SamplingProfile& p) {
+    llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (!chain) return nullptr;
+
+    if (p.penalty_last_n != 0 && (p.penalty_repeat != 1.0f || p.penalty_freq != 0.0f || p.penalty_present != 0.0f)) {
+        llama_sampler_chain_add(chain, llama_sampler_init_penalties(
+                p.penalty_last_n, p.penalty_repeat, p.penalty_freq, p.penalty_present));
+    }
+
+    if (p.temperature <= 0.0f) {
+        llama_sampler_chain_add(chain, llama_sampler_init_greedy());
+        return chain;
+    }
+
+    if (p.top_k > 0) llama_sampler_chain_add(chain, llama_sampler_init_top_k(p.top_k));
+    if (p.top_p < 1.0f) llama_sampler_chain_add(chain, llama_sampler_init_top_p(p.top_p, 1));
+    if (p.min_p > 0.0f) llama_sampler_chain_add(chain, llama_sampler_init_min_p(p.min_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(p.temperature));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(p.seed));
+    return chain;
+}
+
+SamplerChainCache::SamplerChainCache(size_t capacity)
+        : m_capacity(capacity > 0 ? capacity : 1), m_hits(0), m_misses(0) {
+}
+
+SamplerChainCache::~SamplerChainCache() {
+    clear();
+}
+
+llama_sampler* SamplerChainCache::get(const SamplingProfile& profile) {
+    const uint64_t hash = profile.hash();
+    for (auto it = m_chains.begin(); it != m_chains.end(); ++it) {
+        if (it->hash == hash && it->profile == profile) {
+            m_chains.splice(m_chains.begin(), m_chains, it);
+            ++m_hits;
+            return m_chains.front().sampler;
+        }
+    }
+
+    ++m_misses;
+    llama_sampler* sampler = buildSamplerChain(profile);
+    if (!sampler) return nullptr;
+
+    m_chains.push_front({hash, profile, sampler});
+    while (m_chains.size() > m_capacity) {
+        llama_sampler_free(m_chains.back().sampler);
+        m_chains.pop_back();
+    }
+    return sampler;
+}
+
+void SamplerChainCache::clear() {
+    for (Chain& chain : m_chains) {
+        llama_sampler_free(chain.sampler);
+    }
+    m_chains.clear();
+}
@@ -0,0 +1,64 @@
+#ifndef SAMPLING_PROFILE_H
+#define SAMPLING_PROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+
+struct llama_sampler;
+
+// Sampler settings for one request. temperature <= 0 samples greedily after
+// the repetition penalties; the default seed (0xFFFFFFFF) draws a random one.
+struct SamplingProfile {
+    float temperature = 0.7f;
+    int32_t top_k = 40;              // <= 0 disables
+    float top_p = 0.95f;             // 1.0 disables
+    float min_p = 0.05f;             // 0.0 disables
+    int32_t penalty_last_n = 64;     // 0 disables the penalties
+    float penalty_repeat = 1.1f;     // 1.0 disables
+    float penalty_freq = 0.0f;
+    float penalty_present = 0.0f;
+    uint32_t seed = 0xFFFFFFFF;
+
+    uint64_t hash() const;
+    bool operator==(const SamplingProfile& other) const;
+    std::string describe() const;
+};
+
+// Builds penalties -> top-k -> top-p -> min-p -> temperature -> dist (or greedy)
+llama_sampler* buildSamplerChain(const SamplingProfile& profile);
+
+// Sampler chains built for recently used profiles, keyed by profile hash, so
+// switching between a handful of profiles never rebuilds a chain. The least
+// recently used chain is freed once more than `capacity` profiles are in use.
+class SamplerChainCache {
+public:
+    explicit SamplerChainCache(size_t capacity = 8);
+    ~SamplerChainCache();
+
+    SamplerChainCache(const SamplerChainCache&) = delete;
+    SamplerChainCache& operator=(const SamplerChainCache&) = delete;
+
+    // The chain for profile, owned by the cache; nullptr if it cannot be built
+    llama_sampler* get(const SamplingProfile& profile);
+
+    void clear();
+    size_t size() const { return m_chains.size(); }
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+
+private:
+    struct Chain {
+        uint64_t hash;
+        SamplingProfile profile;
+        llama_sampler* sampler;
+    };
+
+    std::list<Chain> m_chains;  // front = most recently used
+    size_t m_capacity;
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
+
+#endif // SAMPLING_PROFILE_H
@@ -0,0 +1,80 @@
+#include "session_cache.h"
+
+SessionCache::SessionCache(size_t budget_bytes, SpillFn spill)
+        : m_spill(std::move(spill)) {
+    m_stats.budget_bytes = budget_bytes;
+}
+
+size_t SessionCache::entryBytes(const Entry& entry) {
+    return entry.state.size() + entry.info.tokens.size() * sizeof(llama_token);
+}
+
+void SessionCache::put(const std::string& sessionId, Entry entry) {
+    erase(sessionId);
+
+    m_stats.bytes_held += entryBytes(entry);
+    m_lru.emplace_front(sessionId, std::move(entry));
+    m_index[sessionId] = m_lru.begin();
+    m_stats.entries = m_lru.size();
+
+    evictToBudget();
+}
+
+bool SessionCache::take(const std::string& sessionId, Entry& entry) {
+    auto it = m_index.find(sessionId);
+    if (it == m_index.end()) {
+        m_stats.misses++;
+        return false;
+    }
+
+    m_stats.hits++;
+    m_stats.bytes_held -= entryBytes(it->second->second);
+    entry = std::move(it->second->second);
+    m_lru.erase(it->second);
+    m_index.erase(it);
+    m_stats.entries = m_lru.size();
+    return true;
+}
+
+void SessionCache::erase(const std::string& sessionId) {
+    auto it = m_index.find(sessionId);
+    if (it == m_index.end()) return;
+
+    m_stats.bytes_held -= entryBytes(it->second->second);
+    m_lru.erase(it->second);
+    m_index.erase(it);
+    m_stats.entries = m_lru.size();
+}
+
+void SessionCache::flush() {
+    for (auto& item : m_lru) {
+        if (m_spill) m_spill(item.first, item.second);
+    }
+    m_lru.clear();
+    m_index.clear();
+    m_stats.bytes_held = 0;
+    m_stats.entries = 0;
+}
+
+void SessionCache::setBudget(size_t budget_bytes) {
+    m_stats.budget_bytes = budget_bytes;
+    evictToBudget();
+}
+
+SessionCache::Stats SessionCache::getStats() const {
+    return m_stats;
+}
+
+// A single entry larger than the whole budget is spilled straight away
+void SessionCache::evictToBudget() {
+    while (!m_lru.empty() && m_stats.bytes_held > m_stats.budget_bytes) {
+        auto& victim = m_lru.back();
+        m_stats.bytes_held -= entryBytes(victim.second);
+        if (m_spill) m_spill(victim.first, victim.second);
+
+        m_stats.evictions++;
+        m_index.erase(victim.first);
+        m_lru.pop_back();
+    }
+    m_stats.entries = m_lru.size();
+}
@@ -0,0 +1,65 @@
+#ifndef SESSION_CACHE_H
+#define SESSION_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "session_file.h"
+
+// Serialized sequence state of inactive chats, kept in RAM under a byte budget.
+// Least recently used entries are handed to the spill callback (which writes
+// them in the on-disk session format) when the budget is exceeded. The entry is
+// dropped right after, so the callback may move its contents out.
+class SessionCache {
+public:
+    struct Entry {
+        std::string dir;                // where the entry is spilled on eviction
+        SessionFileInfo info;
+        std::vector<uint8_t> state;     // llama_state_seq_get_data output
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t bytes_held = 0;
+        size_t entries = 0;
+        size_t budget_bytes = 0;
+    };
+
+    typedef std::function<void(const std::string& sessionId, Entry& entry)> SpillFn;
+
+    SessionCache(size_t budget_bytes, SpillFn spill);
+
+    // Inserts or replaces the entry for sessionId as most recently used
+    void put(const std::string& sessionId, Entry entry);
+
+    // Removes and returns the entry for sessionId; counts a hit or a miss
+    bool take(const std::string& sessionId, Entry& entry);
+
+    // Drops the entry without spilling it
+    void erase(const std::string& sessionId);
+
+    // Spills every entry, e.g. before the model is unloaded
+    void flush();
+
+    void setBudget(size_t budget_bytes);
+    Stats getStats() const;
+
+private:
+    typedef std::list<std::pair<std::string, Entry>> LruList;
+
+    static size_t entryBytes(const Entry& entry);
+    void evictToBudget();
+
+    LruList m_lru;  // front = most recently used
+    std::unordered_map<std::string, LruList::iterator> m_index;
+    SpillFn m_spill;
+    Stats m_stats;
+};
+
+#endif // SESSION_CACHE_H
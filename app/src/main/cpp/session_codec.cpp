@@ -0,0 +1,160 @@
+#include <cstring>
+#include <vector>
+#include "session_codec.h"
+
+// Sequence layout (same as an LZ4 block):
+//   token      high nibble = literal length, low nibble = match length - 4
+//   [255...]   length extensions when a nibble is 15
+//   literals
+//   offset     2 bytes little-endian, omitted for the final literal run
+//   [255...]   match length extension
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+static const size_t LAST_LITERALS = 5;   // the block always ends with literals
+static const size_t MATCH_LIMIT = 12;    // no match may start this close to the end
+static const int HASH_LOG = 14;
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static inline size_t lengthBytes(size_t len) {
+    return len >= 15 ? (len - 15) / 255 + 1 : 0;
+}
+
+static inline uint8_t* writeLength(uint8_t* op, size_t len) {
+    len -= 15;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+size_t session_codec_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t session_codec_compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    uint8_t* op = dst;
+    uint8_t* const op_end = dst + capacity;
+    size_t anchor = 0;
+
+    if (n > MATCH_LIMIT) {
+        std::vector<uint32_t> table(1u << HASH_LOG, 0);
+        const size_t mf_limit = n - MATCH_LIMIT;
+        const size_t match_end = n - LAST_LITERALS;
+        size_t ip = 0;
+
+        while (ip < mf_limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash32(seq);
+            size_t ref = table[h];
+            table[h] = (uint32_t) ip;
+
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                ++ip;
+                continue;
+            }
+
+            size_t len = MIN_MATCH;
+            while (ip + len < match_end && src[ref + len] == src[ip + len]) {
+                ++len;
+            }
+
+            size_t lit = ip - anchor;
+            size_t mlen = len - MIN_MATCH;
+            size_t need = 1 + lengthBytes(lit) + lit + 2 + lengthBytes(mlen);
+            if ((size_t) (op_end - op) < need) return 0;
+
+            uint8_t* token = op++;
+            *token = (uint8_t) (((lit < 15 ? lit : 15) << 4) | (mlen < 15 ? mlen : 15));
+            if (lit >= 15) op = writeLength(op, lit);
+            memcpy(op, src + anchor, lit);
+            op += lit;
+
+            size_t offset = ip - ref;
+            *op++ = (uint8_t) (offset & 0xff);
+            *op++ = (uint8_t) (offset >> 8);
+            if (mlen >= 15) op = writeLength(op, mlen);
+
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    size_t lit = n - anchor;
+    size_t need = 1 + lengthBytes(lit) + lit;
+    if ((size_t) (op_end - op) < need) return 0;
+
+    *op++ = (uint8_t) ((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) op = writeLength(op, lit);
+    if (lit > 0) memcpy(op, src + anchor, lit);
+    op += lit;
+
+    return (size_t) (op - dst);
+}
+
+size_t session_codec_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < n) {
+        uint8_t token = src[ip++];
+
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= n) return 0;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > n - ip || lit > capacity - op) return 0;
+        if (lit > 0) memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+
+        // The final sequence carries literals only
+        if (ip == n) break;
+
+        if (n - ip < 2) return 0;
+        size_t offset = src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return 0;
+
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= n) return 0;
+                b = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += MIN_MATCH;
+        if (mlen > capacity - op) return 0;
+
+        uint8_t* out = dst + op;
+        const uint8_t* match = out - offset;
+        if (offset >= mlen) {
+            memcpy(out, match, mlen);
+        } else {
+            // Overlapping copy repeats the last `offset` bytes
+            for (size_t i = 0; i < mlen; ++i) {
+                out[i] = match[i];
+            }
+        }
+        op += mlen;
+    }
+
+    return op;
+}
@@ -0,0 +1,20 @@
+#ifndef SESSION_CODEC_H
+#define SESSION_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Small LZ4-style block codec used for session state files. Byte-oriented
+// LZ77 with a single hash probe per position: fast to compress and much
+// faster to decompress than deflate, which matters when restoring on a phone.
+
+// Worst-case compressed size for an input of n bytes
+size_t session_codec_bound(size_t n);
+
+// Returns the compressed size, or 0 if dst is too small
+size_t session_codec_compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+
+// Returns the decompressed size, or 0 if the input is malformed or dst is too small
+size_t session_codec_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+
+#endif // SESSION_CODEC_H
@@ -0,0 +1,223 @@
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "session_codec.h"
+#include "session_file.h"
+
+static const uint32_t SESSION_MAGIC = 0x53564b4c;  // "LKVS"
+static const uint32_t SESSION_VERSION = 1;
+static const uint32_t SESSION_BLOCK_SIZE = 1u << 20;
+
+struct SessionFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t model_hash;
+    uint64_t state_size;       // uncompressed llama_state_seq_get_data size
+    uint32_t n_layer;
+    uint32_t n_head_kv;
+    uint32_t n_embd;
+    uint32_t last_turn_start;
+    uint32_t n_tokens;
+    uint32_t block_size;       // uncompressed bytes per block, the last one may be shorter
+    uint32_t n_blocks;
+    uint32_t reserved;
+};
+
+// A block whose stored size equals its raw size was kept uncompressed
+static size_t rawBlockSize(const SessionFileHeader& header, uint32_t block) {
+    size_t offset = (size_t) block * header.block_size;
+    size_t remaining = header.state_size - offset;
+    return remaining < header.block_size ? remaining : header.block_size;
+}
+
+size_t writeSessionFile(const std::string& path, const SessionFileInfo& info,
+                        const uint8_t* state, size_t state_size) {
+    SessionFileHeader header = {};
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.model_hash = info.model_hash;
+    header.state_size = state_size;
+    header.n_layer = info.n_layer;
+    header.n_head_kv = info.n_head_kv;
+    header.n_embd = info.n_embd;
+    header.last_turn_start = info.last_turn_start;
+    header.n_tokens = (uint32_t) info.tokens.size();
+    header.block_size = SESSION_BLOCK_SIZE;
+    header.n_blocks = (uint32_t) ((state_size + SESSION_BLOCK_SIZE - 1) / SESSION_BLOCK_SIZE);
+
+    // Written next to the target and renamed over it, so a crash mid-write
+    // leaves the previous state (or nothing) instead of a truncated file
+    const std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) return 0;
+
+    std::vector<uint32_t> block_sizes(header.n_blocks, 0);
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && (info.tokens.empty() ||
+                fwrite(info.tokens.data(), sizeof(llama_token), info.tokens.size(), f) == info.tokens.size());
+
+    // Reserve the block table and fill it in once the block sizes are known
+    long table_pos = ftell(f);
+    ok = ok && (block_sizes.empty() ||
+                fwrite(block_sizes.data(), sizeof(uint32_t), block_sizes.size(), f) == block_sizes.size());
+
+    std::vector<uint8_t> packed(session_codec_bound(SESSION_BLOCK_SIZE));
+    for (uint32_t b = 0; ok && b < header.n_blocks; ++b) {
+        const uint8_t* raw = state + (size_t) b * SESSION_BLOCK_SIZE;
+        size_t raw_size = rawBlockSize(header, b);
+
+        size_t packed_size = session_codec_compress(raw, raw_size, packed.data(), packed.size());
+        if (packed_size > 0 && packed_size < raw_size) {
+            ok = fwrite(packed.data(), 1, packed_size, f) == packed_size;
+            block_sizes[b] = (uint32_t) packed_size;
+        } else {
+            ok = fwrite(raw, 1, raw_size, f) == raw_size;
+            block_sizes[b] = (uint32_t) raw_size;
+        }
+    }
+
+    long end_pos = ftell(f);
+    ok = ok && fseek(f, table_pos, SEEK_SET) == 0;
+    ok = ok && (block_sizes.empty() ||
+                fwrite(block_sizes.data(), sizeof(uint32_t), block_sizes.size(), f) == block_sizes.size());
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || end_pos <= 0 || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return 0;
+    }
+    return (size_t) end_pos;
+}
+
+// Header fields checked against the file size before anything is allocated:
+// the tokens and block table must fit in the file, and the state must be
+// exactly the blocks it claims at the block size this version writes.
+static bool headerIsPlausible(const SessionFileHeader& header, uint64_t file_size, size_t max_tokens) {
+    if (header.magic != SESSION_MAGIC || header.version != SESSION_VERSION ||
+        header.block_size != SESSION_BLOCK_SIZE || header.n_tokens > max_tokens) {
+        return false;
+    }
+    const uint64_t tokens_bytes = (uint64_t) header.n_tokens * sizeof(llama_token);
+    const uint64_t table_bytes = (uint64_t) header.n_blocks * sizeof(uint32_t);
+    const uint64_t expected_blocks = (header.state_size + header.block_size - 1) / header.block_size;
+    return expected_blocks == header.n_blocks &&
+           file_size >= sizeof(header) && file_size - sizeof(header) >= tokens_bytes + table_bytes;
+}
+
+// Validates the header against the mapped size and fills `info`; returns the
+// offset of the block table, or 0 if the file is not a usable session file.
+static size_t parseHeader(const uint8_t* data, size_t size, size_t max_tokens,
+                          SessionFileHeader& header, SessionFileInfo& info) {
+    if (size < sizeof(header)) return 0;
+    memcpy(&header, data, sizeof(header));
+    if (!headerIsPlausible(header, size, max_tokens)) {
+        return 0;
+    }
+
+    size_t tokens_bytes = (size_t) header.n_tokens * sizeof(llama_token);
+
+    info.model_hash = header.model_hash;
+    info.n_layer = header.n_layer;
+    info.n_head_kv = header.n_head_kv;
+    info.n_embd = header.n_embd;
+    info.last_turn_start = header.last_turn_start;
+    info.tokens.resize(header.n_tokens);
+    if (tokens_bytes > 0) {
+        memcpy(info.tokens.data(), data + sizeof(header), tokens_bytes);
+    }
+    return sizeof(header) + tokens_bytes;
+}
+
+bool readSessionFileInfo(const std::string& path, SessionFileInfo& info, size_t max_tokens) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    struct stat st;
+    SessionFileHeader header;
+    bool ok = fstat(fileno(f), &st) == 0 && fread(&header, sizeof(header), 1, f) == 1 &&
+              headerIsPlausible(header, (uint64_t) st.st_size, max_tokens);
+    if (ok) {
+        info.model_hash = header.model_hash;
+        info.n_layer = header.n_layer;
+        info.n_head_kv = header.n_head_kv;
+        info.n_embd = header.n_embd;
+        info.last_turn_start = header.last_turn_start;
+        info.tokens.resize(header.n_tokens);
+        ok = header.n_tokens == 0 ||
+             fread(info.tokens.data(), sizeof(llama_token), header.n_tokens, f) == header.n_tokens;
+    }
+    fclose(f);
+    return ok;
+}
+
+bool readSessionFile(const std::string& path, SessionFileInfo& info, std::vector<uint8_t>& state, size_t max_tokens) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t) st.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    const uint8_t* data = static_cast<const uint8_t*>(mapped);
+    SessionFileHeader header;
+    size_t table_pos = parseHeader(data, size, max_tokens, header, info);
+    bool ok = table_pos > 0;
+
+    // Every block must be stored, no larger than its raw size, and all of them
+    // must fit in the file; only then is the state buffer sized from the header
+    const size_t blocks_pos = table_pos + (size_t) header.n_blocks * sizeof(uint32_t);
+    uint64_t stored_total = 0;
+    for (uint32_t b = 0; ok && b < header.n_blocks; ++b) {
+        uint32_t stored;
+        memcpy(&stored, data + table_pos + (size_t) b * sizeof(uint32_t), sizeof(stored));
+        ok = stored > 0 && stored <= rawBlockSize(header, b);
+        stored_total += stored;
+    }
+    ok = ok && stored_total <= size - blocks_pos;
+
+    if (ok) {
+        try {
+            state.resize(header.state_size);
+        } catch (const std::bad_alloc&) {
+            ok = false;
+        }
+    }
+    if (ok) {
+        size_t pos = blocks_pos;
+
+        for (uint32_t b = 0; ok && b < header.n_blocks; ++b) {
+            uint32_t stored;
+            memcpy(&stored, data + table_pos + (size_t) b * sizeof(uint32_t), sizeof(stored));
+            size_t raw_size = rawBlockSize(header, b);
+            uint8_t* out = state.data() + (size_t) b * header.block_size;
+
+            if (stored > size - pos) {
+                ok = false;
+            } else if (stored == raw_size) {
+                memcpy(out, data + pos, raw_size);
+            } else {
+                ok = session_codec_decompress(data + pos, stored, out, raw_size) == raw_size;
+            }
+            pos += stored;
+        }
+    }
+
+    munmap(mapped, size);
+    if (!ok) {
+        state.clear();
+    }
+    return ok;
+}
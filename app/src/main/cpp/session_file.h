@@ -0,0 +1,36 @@
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef int32_t llama_token;
+
+// On-disk chat state: a fixed header, the conversation tokens, a block table
+// and the sequence state from llama_state_seq_get_data split into blocks that
+// are each compressed with session_codec (or stored raw when that does not help).
+struct SessionFileInfo {
+    uint64_t model_hash = 0;
+    uint32_t n_layer = 0;
+    uint32_t n_head_kv = 0;
+    uint32_t n_embd = 0;
+    uint32_t last_turn_start = 0;
+    std::vector<llama_token> tokens;
+};
+
+// Returns the number of bytes written, or 0 on failure. The file is replaced
+// atomically: the old one stays in place until the new one is complete.
+size_t writeSessionFile(const std::string& path, const SessionFileInfo& info,
+                        const uint8_t* state, size_t state_size);
+
+// Reads only the header and tokens; used to reject stale files before touching the state.
+// Files claiming more than max_tokens tokens or more data than they hold are rejected.
+bool readSessionFileInfo(const std::string& path, SessionFileInfo& info, size_t max_tokens);
+
+// Maps the file and decompresses the state blocks straight into `state`
+bool readSessionFile(const std::string& path, SessionFileInfo& info, std::vector<uint8_t>& state,
+                     size_t max_tokens);
+
+#endif // SESSION_FILE_H
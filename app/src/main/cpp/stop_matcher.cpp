@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <queue>
+#include "stop_matcher.h"
+
+StopMatcher::StopMatcher() {
+    setStopStrings({});
+}
+
+void StopMatcher::setStopStrings(const std::vector<std::string>& stops) {
+    std::array<int32_t, 256> no_edges;
+    no_edges.fill(-1);
+
+    m_next.assign(1, no_edges);
+    m_depth.assign(1, 0);
+    m_out_len.assign(1, 0);
+    std::vector<int32_t> fail(1, 0);
+
+    // Trie of the stop strings
+    for (const std::string& stop : stops) {
+        if (stop.empty()) continue;
+        int32_t state = 0;
+        for (unsigned char c : stop) {
+            if (m_next[state][c] < 0) {
+                m_next[state][c] = (int32_t) m_next.size();
+                m_next.push_back(no_edges);
+                m_depth.push_back(m_depth[state] + 1);
+                m_out_len.push_back(0);
+                fail.push_back(0);
+            }
+            state = m_next[state][c];
+        }
+        m_out_len[state] = (uint32_t) stop.size();
+    }
+
+    // Breadth-first pass turning the trie into a DFA: missing edges follow the
+    // failure link, and each state inherits the matches of its failure state.
+    std::queue<int32_t> pending;
+    for (int c = 0; c < 256; ++c) {
+        int32_t child = m_next[0][c];
+        if (child < 0) {
+            m_next[0][c] = 0;
+        } else {
+            fail[child] = 0;
+            pending.push(child);
+        }
+    }
+    while (!pending.empty()) {
+        int32_t state = pending.front();
+        pending.pop();
+        m_out_len[state] = std::max(m_out_len[state], m_out_len[fail[state]]);
+        for (int c = 0; c < 256; ++c) {
+            int32_t child = m_next[state][c];
+            if (child < 0) {
+                m_next[state][c] = m_next[fail[state]][c];
+            } else {
+                fail[child] = m_next[fail[state]][c];
+                pending.push(child);
+            }
+        }
+    }
+
+    reset();
+}
+
+void StopMatcher::reset() {
+    m_state = 0;
+    m_consumed = 0;
+    m_matched = false;
+    m_match_start = 0;
+}
+
+bool StopMatcher::feed(const std::string& piece) {
+    if (m_matched) return true;
+
+    for (unsigned char c : piece) {
+        m_state = m_next[m_state][c];
+        ++m_consumed;
+        if (m_out_len[m_state] > 0) {
+            m_matched = true;
+            m_match_start = m_consumed - m_out_len[m_state];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t StopMatcher::safeLength() const {
+    return m_matched ? m_match_start : m_consumed - m_depth[m_state];
+}
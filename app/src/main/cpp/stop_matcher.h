@@ -0,0 +1,49 @@
+#ifndef STOP_MATCHER_H
+#define STOP_MATCHER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Finds the first occurrence of any stop string in text fed piece by piece.
+// The stop strings are compiled into an Aho-Corasick automaton whose state is
+// kept between pieces, so every byte of the output is examined exactly once.
+class StopMatcher {
+public:
+    StopMatcher();
+
+    // Builds the automaton; an empty list never matches
+    void setStopStrings(const std::vector<std::string>& stops);
+
+    // Starts a new output stream with the same stop strings
+    void reset();
+
+    // Feeds the next piece; returns true once a stop string is complete.
+    // Bytes after the end of the match are not consumed.
+    bool feed(const std::string& piece);
+
+    bool matched() const { return m_matched; }
+
+    // Offset in the fed text where the matched stop string begins
+    size_t matchStart() const { return m_match_start; }
+
+    // Length of the fed text that cannot turn into a stop string and is safe
+    // to show: everything before a match, or before a possible partial match.
+    size_t safeLength() const;
+
+    bool empty() const { return m_out_len.size() <= 1; }
+
+private:
+    std::vector<std::array<int32_t, 256>> m_next;  // full transition table
+    std::vector<uint32_t> m_depth;                 // length of the prefix a state stands for
+    std::vector<uint32_t> m_out_len;               // longest stop string ending in a state, 0 if none
+
+    int32_t m_state;
+    size_t m_consumed;
+    bool m_matched;
+    size_t m_match_start;
+};
+
+#endif // STOP_MATCHER_H
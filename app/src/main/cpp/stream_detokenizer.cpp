@@ -0,0 +1,64 @@
+#include "include/llama.h"
+#include "stream_detokenizer.h"
+
+static const size_t INITIAL_PIECE_BYTES = 64;
+
+// Expected sequence length from a lead byte; 0 for continuation or invalid bytes
+static size_t utf8SequenceLength(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+    return 0;
+}
+
+size_t utf8CompletePrefix(const char* data, size_t size) {
+    // Only the last three bytes can belong to an unfinished sequence
+    size_t back = 0;
+    while (back < size && back < 4) {
+        unsigned char c = (unsigned char) data[size - 1 - back];
+        if ((c & 0xC0) != 0x80) {
+            size_t expected = utf8SequenceLength(c);
+            // Invalid lead bytes are passed through rather than held forever
+            return expected > back + 1 ? size - 1 - back : size;
+        }
+        ++back;
+    }
+    return size;
+}
+
+StreamDetokenizer::StreamDetokenizer(const llama_vocab* vocab)
+        : m_vocab(vocab), m_piece(INITIAL_PIECE_BYTES) {
+}
+
+void StreamDetokenizer::reset(const llama_vocab* vocab) {
+    m_vocab = vocab;
+    reset();
+}
+
+void StreamDetokenizer::reset() {
+    m_carry.clear();
+    m_emitted.clear();
+    m_text.clear();
+}
+
+const std::string& StreamDetokenizer::push(llama_token token) {
+    m_emitted.clear();
+    if (!m_vocab) return m_emitted;
+
+    int32_t n = llama_token_to_piece(m_vocab, token, m_piece.data(), (int32_t) m_piece.size(), 0, false);
+    if (n < 0) {
+        m_piece.resize((size_t) -n);
+        n = llama_token_to_piece(m_vocab, token, m_piece.data(), (int32_t) m_piece.size(), 0, false);
+    }
+    if (n <= 0) return m_emitted;
+
+    m_carry.append(m_piece.data(), (size_t) n);
+    size_t complete = utf8CompletePrefix(m_carry.data(), m_carry.size());
+    if (complete == 0) return m_emitted;
+
+    m_emitted.assign(m_carry, 0, complete);
+    m_carry.erase(0, complete);
+    m_text += m_emitted;
+    return m_emitted;
+}
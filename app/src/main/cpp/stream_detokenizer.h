@@ -0,0 +1,44 @@
+#ifndef STREAM_DETOKENIZER_H
+#define STREAM_DETOKENIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct llama_vocab;
+typedef int32_t llama_token;
+
+// Turns a stream of tokens into text one token at a time. A token can end in the
+// middle of a multi-byte UTF-8 character (Devanagari, emoji), so the incomplete
+// tail is carried over to the next token and only whole characters are emitted.
+// Piece and output buffers are reused across tokens and responses.
+class StreamDetokenizer {
+public:
+    explicit StreamDetokenizer(const llama_vocab* vocab = nullptr);
+
+    void reset(const llama_vocab* vocab);
+    void reset();
+
+    // Appends the token and returns the complete characters it made available,
+    // possibly empty; the reference is valid until the next call.
+    const std::string& push(llama_token token);
+
+    // Everything emitted since the last reset
+    const std::string& text() const { return m_text; }
+
+    // Bytes held back waiting for the rest of a character
+    size_t pendingBytes() const { return m_carry.size(); }
+
+private:
+    const llama_vocab* m_vocab;
+    std::vector<char> m_piece;   // llama_token_to_piece output, grown on demand
+    std::string m_carry;         // incomplete UTF-8 sequence from earlier tokens
+    std::string m_emitted;       // text released by the last push
+    std::string m_text;
+};
+
+// Length of the longest prefix of data that does not end inside a UTF-8 sequence
+size_t utf8CompletePrefix(const char* data, size_t size);
+
+#endif // STREAM_DETOKENIZER_H
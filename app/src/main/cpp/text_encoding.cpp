@@ -0,0 +1,92 @@
+#include "text_encoding.h"
+
+static const char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+static void appendUtf16(std::u16string& out, char32_t cp) {
+    if (cp < 0x10000) {
+        out.push_back((char16_t) cp);
+    } else {
+        cp -= 0x10000;
+        out.push_back((char16_t) (0xD800 + (cp >> 10)));
+        out.push_back((char16_t) (0xDC00 + (cp & 0x3FF)));
+    }
+}
+
+static void appendUtf8(std::string& out, char32_t cp) {
+    if (cp < 0x80) {
+        out.push_back((char) cp);
+    } else if (cp < 0x800) {
+        out.push_back((char) (0xC0 | (cp >> 6)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char) (0xE0 | (cp >> 12)));
+        out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char) (0xF0 | (cp >> 18)));
+        out.push_back((char) (0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    }
+}
+
+std::u16string utf8ToUtf16(const std::string& text) {
+    std::u16string out;
+    out.reserve(text.size());
+
+    const size_t size = text.size();
+    size_t i = 0;
+    while (i < size) {
+        const unsigned char lead = (unsigned char) text[i];
+        if (lead < 0x80) {
+            out.push_back(lead);
+            ++i;
+            continue;
+        }
+
+        size_t length;
+        char32_t cp, min_cp;
+        if ((lead & 0xE0) == 0xC0) {
+            length = 2, cp = lead & 0x1F, min_cp = 0x80;
+        } else if ((lead & 0xF0) == 0xE0) {
+            length = 3, cp = lead & 0x0F, min_cp = 0x800;
+        } else if ((lead & 0xF8) == 0xF0) {
+            length = 4, cp = lead & 0x07, min_cp = 0x10000;
+        } else {
+            out.push_back((char16_t) REPLACEMENT_CHARACTER);
+            ++i;
+            continue;
+        }
+
+        size_t n = 1;
+        while (n < length && i + n < size && ((unsigned char) text[i + n] & 0xC0) == 0x80) {
+            cp = (cp << 6) | ((unsigned char) text[i + n] & 0x3F);
+            ++n;
+        }
+        // One replacement per malformed sequence, resuming at the first byte that did not fit
+        if (n < length || cp < min_cp || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            out.push_back((char16_t) REPLACEMENT_CHARACTER);
+        } else {
+            appendUtf16(out, cp);
+        }
+        i += n;
+    }
+    return out;
+}
+
+std::string utf16ToUtf8(const char16_t* text, size_t length) {
+    std::string out;
+    out.reserve(length);
+
+    for (size_t i = 0; i < length; ++i) {
+        char32_t cp = text[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < length && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (text[i + 1] - 0xDC00);
+            ++i;
+        } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = REPLACEMENT_CHARACTER;
+        }
+        appendUtf8(out, cp);
+    }
+    return out;
+}
@@ -0,0 +1,18 @@
+#ifndef TEXT_ENCODING_H
+#define TEXT_ENCODING_H
+
+#include <cstddef>
+#include <string>
+
+// Conversions between the UTF-8 used by llama.cpp and the UTF-16 of Java strings.
+// JNI's own *StringUTF functions use modified UTF-8, which encodes characters
+// outside the BMP (emoji, some Indic symbols) as surrogate pairs and rejects
+// standard 4-byte sequences, so strings cross JNI as UTF-16 instead.
+
+// Malformed sequences (truncated, overlong, surrogates, past U+10FFFF) become U+FFFD
+std::u16string utf8ToUtf16(const std::string& text);
+
+// Unpaired surrogates become U+FFFD
+std::string utf16ToUtf8(const char16_t* text, size_t length);
+
+#endif // TEXT_ENCODING_H
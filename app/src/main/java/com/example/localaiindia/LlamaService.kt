@@ -11,6 +11,13 @@ import java.io.IOException
 class LlamaService {
     companion object {
         private const val TAG = "LlamaService"
+        private const val AUTOTUNE_FILE_NAME = "autotune.txt"
+
+        // KV cache precision passed to native initialization (matches LlamaWrapper::KvPrecision)
+        const val KV_PRECISION_AUTO = -1
+        const val KV_PRECISION_F16 = 0
+        const val KV_PRECISION_Q8_0 = 1
+        const val KV_PRECISION_Q4_0 = 2
 
         // Load the native library - FIXED: Match CMakeLists.txt project name
         init {
@@ -51,6 +58,23 @@ class LlamaService {
         )
     }
 
+    /**
+     * Why the last response ended; values match LlamaWrapper::StopReason
+     */
+    enum class StopReason(val nativeValue: Int) {
+        NONE(0),
+        END_OF_GENERATION(1),
+        STOP_STRING(2),
+        MAX_TOKENS(3),
+        ERROR(4),
+        REPETITION(5),
+        CANCELLED(6);
+
+        companion object {
+            fun fromNative(value: Int): StopReason = values().firstOrNull { it.nativeValue == value } ?: NONE
+        }
+    }
+
     data class ModelConfig(
         val fileName: String,
         val displayName: String,
@@ -58,19 +82,151 @@ class LlamaService {
         val sizeInMB: Int
     )
 
+    data class PrefillChunkTiming(
+        val tokens: Int,
+        val timeMs: Float
+    )
+
+    data class SessionCacheStats(
+        val hits: Long,
+        val misses: Long,
+        val evictions: Long,
+        val bytesHeld: Long,
+        val entries: Long,
+        val budgetBytes: Long
+    )
+
+    data class ContextPlan(
+        val nCtx: Int,
+        val nBatch: Int,
+        val nUbatch: Int,
+        val kvPrecision: Int,
+        val kvBytes: Long,
+        val computeBytes: Long,
+        val modelBytes: Long,
+        val budgetBytes: Long,
+        val fitsBudget: Boolean
+    )
+
+    /**
+     * Sampler settings for a request. temperature <= 0 picks the most likely token
+     * after the repetition penalties; seed -1 draws a random seed.
+     */
+    data class SamplingProfile(
+        val temperature: Float = 0.7f,
+        val topK: Int = 40,
+        val topP: Float = 0.95f,
+        val minP: Float = 0.05f,
+        val penaltyLastN: Int = 64,
+        val penaltyRepeat: Float = 1.1f,
+        val penaltyFreq: Float = 0f,
+        val penaltyPresent: Float = 0f,
+        val seed: Long = -1
+    ) {
+        /**
+         * Preset name, or the settings that decide the output when the profile is
+         * custom; recorded with benchmark results. Contains no commas.
+         */
+        val label: String
+            get() = when (this) {
+                PRECISE -> "precise"
+                BALANCED -> "balanced"
+                CREATIVE -> "creative"
+                else -> "custom temp=$temperature top_k=$topK top_p=$topP min_p=$minP " +
+                        "repeat=$penaltyRepeat/$penaltyLastN seed=$seed"
+            }
+
+        companion object {
+            val PRECISE = SamplingProfile(temperature = 0f)
+            val BALANCED = SamplingProfile()
+            val CREATIVE = SamplingProfile(temperature = 1.0f, topK = 100, topP = 0.98f, minP = 0.02f)
+        }
+    }
+
+    data class SpeculativeStats(
+        val drafted: Int,
+        val accepted: Int,
+        val generated: Int,
+        val timeMs: Float
+    ) {
+        val acceptanceRate: Float get() = if (drafted > 0) accepted.toFloat() / drafted else 0f
+        val tokensPerSecond: Float get() = if (timeMs > 0f) generated * 1000f / timeMs else 0f
+    }
+
+    /**
+     * Receives each piece of a response while native code generates it.
+     * Called on the generating thread.
+     */
+    fun interface TokenListener {
+        fun onToken(piece: String)
+    }
+
+    /**
+     * Receives autotune progress as measurements done out of the total.
+     * Called on the inference thread.
+     */
+    fun interface AutotuneListener {
+        fun onProgress(done: Int, total: Int)
+    }
+
     private var currentModelId: String? = null
     private var isModelLoaded = false
+    private var samplingProfile = SamplingProfile.BALANCED
+
+    /**
+     * Apply the settings saved by [autotune] when a model is loaded, and save new
+     * results. Loading never measures anything itself.
+     */
+    var autotuneEnabled = true
 
     // Native method declarations
-    private external fun nativeInitialize(modelPath: String): Boolean
-    private external fun nativeGenerateResponse(prompt: String): String
+    private external fun nativeInitialize(modelPath: String, kvPrecision: Int): Boolean
+    private external fun nativeGenerateResponse(prompt: String, listener: TokenListener?): String
+    private external fun nativeRegenerateResponse(prompt: String, listener: TokenListener?): String
+    private external fun nativeGetLastReusedTokens(): Int
+    private external fun nativeGetLastStopReason(): Int
+    private external fun nativeCancelGeneration()
+    private external fun nativeResetConversation()
+    private external fun nativeStartNewChat()
+    private external fun nativeSaveSession(dir: String, sessionId: String): Boolean
+    private external fun nativeRestoreSession(dir: String, sessionId: String): Boolean
+    private external fun nativeDeleteSession(dir: String, sessionId: String)
+    private external fun nativePrefillDraft(sessionId: String, partialText: String)
+    private external fun nativeBenchmarkSessionFormats(dir: String): String
+    private external fun nativeBenchmarkDetokenizer(iterations: Int): String
+    private external fun nativeBenchmarkSampling(iterations: Int): String
+    private external fun nativeSetSessionCacheBudget(bytes: Long)
+    private external fun nativeGetSessionCacheStats(): LongArray
+    private external fun nativeSetPrefillChunkSize(nTokens: Int)
+    private external fun nativeGetLastPrefillTimings(): FloatArray
     private external fun nativeCleanup()
     private external fun nativeIsInitialized(): Boolean
+    private external fun nativeGetKvCacheBytes(): Long
+    private external fun nativeSetMemoryBudget(bytes: Long)
+    private external fun nativeSetThreadCounts(decodeThreads: Int, batchThreads: Int)
+    private external fun nativeGetCpuTopology(): String
+    private external fun nativeSetAutotuneFile(path: String)
+    private external fun nativeGetTuneConfig(): String
+    private external fun nativeAutotune(listener: AutotuneListener?): String
+    private external fun nativeGetContextPlan(): LongArray
+    private external fun nativeLoadDraftModel(modelPath: String, nDraft: Int): Boolean
+    private external fun nativeUnloadDraftModel()
+    private external fun nativeGetSpeculativeStats(): FloatArray
+    private external fun nativeSetPromptLookup(nDraft: Int)
+    private external fun nativeSetSamplingProfile(
+        temperature: Float, topK: Int, topP: Float, minP: Float, penaltyLastN: Int,
+        penaltyRepeat: Float, penaltyFreq: Float, penaltyPresent: Float, seed: Long
+    ): Boolean
 
     /**
-     * Initialize a specific model by its ID
+     * Initialize a specific model by its ID. kvPrecision picks the KV cache type;
+     * KV_PRECISION_AUTO lets native code choose per model.
      */
-    suspend fun initializeModel(context: Context, modelId: String): Boolean = withContext(Dispatchers.IO) {
+    suspend fun initializeModel(
+        context: Context,
+        modelId: String,
+        kvPrecision: Int = KV_PRECISION_AUTO
+    ): Boolean = withContext(Dispatchers.IO) {
         try {
             Log.d(TAG, "Initializing model: $modelId (current: $currentModelId)")
 
@@ -108,7 +264,8 @@ class LlamaService {
 
             // Initialize the model
             val success = try {
-                nativeInitialize(modelFile.absolutePath)
+                nativeSetAutotuneFile(if (autotuneEnabled) getAutotuneFile(context).absolutePath else "")
+                nativeInitialize(modelFile.absolutePath, kvPrecision)
             } catch (e: Exception) {
                 Log.e(TAG, "Native initialization failed", e)
                 false
@@ -149,9 +306,91 @@ class LlamaService {
     }
 
     /**
-     * Generate chat response
+     * Generate chat response. When onToken is set it receives the response piece by
+     * piece as it is generated; the full response is still returned at the end.
+     */
+    suspend fun chat(
+        prompt: String,
+        onToken: TokenListener? = null,
+        profile: SamplingProfile? = null
+    ): String = generate(prompt, replaceLastTurn = false, onToken = onToken, profile = profile)
+
+    /**
+     * Answer again after the last user message was edited or a regenerate was requested.
+     * Native code only re-decodes the part of the conversation that changed.
+     */
+    suspend fun regenerate(
+        prompt: String,
+        onToken: TokenListener? = null,
+        profile: SamplingProfile? = null
+    ): String = generate(prompt, replaceLastTurn = true, onToken = onToken, profile = profile)
+
+    /**
+     * Sampler settings used by the following requests and kept across model loads.
+     * Native code caches one sampler chain per profile, so switching is free.
+     */
+    fun setSamplingProfile(profile: SamplingProfile): Boolean {
+        if (profile == samplingProfile) return true
+        return try {
+            val applied = nativeSetSamplingProfile(
+                profile.temperature, profile.topK, profile.topP, profile.minP, profile.penaltyLastN,
+                profile.penaltyRepeat, profile.penaltyFreq, profile.penaltyPresent, profile.seed
+            )
+            if (applied) samplingProfile = profile
+            applied
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting sampling profile", e)
+            false
+        }
+    }
+
+    fun getSamplingProfile(): SamplingProfile = samplingProfile
+
+    /**
+     * Number of prompt tokens served from the KV cache by the last generation
+     */
+    fun getLastReusedTokens(): Int {
+        return try {
+            if (isModelLoaded) nativeGetLastReusedTokens() else 0
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading reused token count", e)
+            0
+        }
+    }
+
+    /**
+     * Stop the response being generated, from any thread. The running chat() or
+     * regenerate() returns within one batch with the text produced so far, and
+     * the conversation stays usable for the next message.
+     */
+    fun cancelGeneration() {
+        try {
+            if (isModelLoaded) {
+                nativeCancelGeneration()
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error cancelling generation", e)
+        }
+    }
+
+    /**
+     * Why the last generation stopped, e.g. REPETITION when a loop was cut off
      */
-    suspend fun chat(prompt: String): String = withContext(Dispatchers.IO) {
+    fun getLastStopReason(): StopReason {
+        return try {
+            if (isModelLoaded) StopReason.fromNative(nativeGetLastStopReason()) else StopReason.NONE
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading stop reason", e)
+            StopReason.NONE
+        }
+    }
+
+    private suspend fun generate(
+        prompt: String,
+        replaceLastTurn: Boolean,
+        onToken: TokenListener?,
+        profile: SamplingProfile?
+    ): String = withContext(Dispatchers.IO) {
         try {
             if (!isModelLoaded || currentModelId == null) {
                 return@withContext "Error: Model not initialized. Please select a model first."
@@ -169,9 +408,17 @@ class LlamaService {
                 return@withContext "Error: Model not ready. Please try switching models or restart the app."
             }
 
+            if (profile != null) {
+                setSamplingProfile(profile)
+            }
+
             Log.d(TAG, "Generating response with model: $currentModelId, prompt: ${prompt.take(100)}...")
             val response = try {
-                nativeGenerateResponse(prompt)
+                if (replaceLastTurn) {
+                    nativeRegenerateResponse(prompt, onToken)
+                } else {
+                    nativeGenerateResponse(prompt, onToken)
+                }
             } catch (e: Exception) {
                 Log.e(TAG, "Error in native response generation", e)
                 "I apologize, but I encountered an error while generating a response. Please try again or switch models."
@@ -185,6 +432,399 @@ class LlamaService {
         }
     }
 
+    /**
+     * Start a new conversation, dropping the cached chat history in native code
+     */
+    fun resetConversation() {
+        try {
+            if (isModelLoaded) {
+                nativeResetConversation()
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error resetting conversation", e)
+        }
+    }
+
+    /**
+     * Start an empty chat in its own KV sequence. The chat that was active stays
+     * resident if it was saved, so switching back to it needs no prefill.
+     */
+    fun startNewChat() {
+        try {
+            if (isModelLoaded) {
+                nativeStartNewChat()
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error starting new chat", e)
+        }
+    }
+
+    /**
+     * Keep the KV state of a chat so reopening it does not re-prefill the history.
+     * Recent chats stay resident in the KV cache, then in native memory, and are
+     * written to disk when evicted from both.
+     */
+    suspend fun saveSessionState(context: Context, sessionId: String): Boolean = withContext(Dispatchers.IO) {
+        try {
+            isModelLoaded && nativeSaveSession(getSessionStateDir(context).absolutePath, sessionId)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error saving session state: $sessionId", e)
+            false
+        }
+    }
+
+    /**
+     * Restore the KV state of a chat; returns false when no valid state exists for the current model
+     */
+    suspend fun restoreSessionState(context: Context, sessionId: String): Boolean = withContext(Dispatchers.IO) {
+        try {
+            isModelLoaded && nativeRestoreSession(getSessionStateDir(context).absolutePath, sessionId)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error restoring session state: $sessionId", e)
+            false
+        }
+    }
+
+    /**
+     * Delete any persisted KV state for a chat
+     */
+    suspend fun deleteSessionState(context: Context, sessionId: String) = withContext(Dispatchers.IO) {
+        try {
+            if (isModelLoaded) {
+                nativeDeleteSession(getSessionStateDir(context).absolutePath, sessionId)
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error deleting session state: $sessionId", e)
+        }
+    }
+
+    /**
+     * Compare save/restore time and file size of the compressed session format
+     * against llama.cpp's uncompressed state files, using the current chat.
+     * Returns CSV lines: format, save_ms, restore_ms, bytes
+     */
+    suspend fun benchmarkSessionFormats(context: Context): String = withContext(Dispatchers.IO) {
+        try {
+            if (!isModelLoaded) {
+                return@withContext "Error: Model not initialized. Please select a model first."
+            }
+            nativeBenchmarkSessionFormats(getSessionStateDir(context).absolutePath)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error benchmarking session formats", e)
+            "Error: ${e.message}"
+        }
+    }
+
+    /**
+     * Compare the per-token cost of the streaming detokenizer with the old
+     * end-of-generation loop on a mixed-script sample.
+     * Returns CSV lines: detokenizer, ns_per_token, round_trip
+     */
+    suspend fun benchmarkDetokenizer(iterations: Int = 200): String = withContext(Dispatchers.IO) {
+        try {
+            if (!isModelLoaded) {
+                return@withContext "Error: Model not initialized. Please select a model first."
+            }
+            nativeBenchmarkDetokenizer(iterations)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error benchmarking detokenizer", e)
+            "Error: ${e.message}"
+        }
+    }
+
+    /**
+     * Compare picking a token through a full-vocabulary candidate array with the
+     * SIMD argmax/top-k path, at common vocabulary sizes and the loaded model's.
+     * Returns CSV lines: vocab, full_greedy_us, simd_argmax_us, full_topk_us, simd_topk_us
+     */
+    suspend fun benchmarkSampling(iterations: Int = 200): String = withContext(Dispatchers.IO) {
+        try {
+            if (!isModelLoaded) {
+                return@withContext "Error: Model not initialized. Please select a model first."
+            }
+            nativeBenchmarkSampling(iterations)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error benchmarking sampling", e)
+            "Error: ${e.message}"
+        }
+    }
+
+    /**
+     * Set the RAM budget for inactive chat states kept in native memory
+     */
+    fun setSessionCacheBudget(bytes: Long) {
+        try {
+            if (isModelLoaded) {
+                nativeSetSessionCacheBudget(bytes)
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting session cache budget", e)
+        }
+    }
+
+    /**
+     * Hit/miss counters and memory held by the native session state cache
+     */
+    fun getSessionCacheStats(): SessionCacheStats? {
+        return try {
+            if (!isModelLoaded) return null
+            val values = nativeGetSessionCacheStats()
+            SessionCacheStats(
+                hits = values[0],
+                misses = values[1],
+                evictions = values[2],
+                bytesHeld = values[3],
+                entries = values[4],
+                budgetBytes = values[5]
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading session cache stats", e)
+            null
+        }
+    }
+
+    /**
+     * Set how many prompt tokens are decoded per llama_decode call (capped at n_batch)
+     */
+    fun setPrefillChunkSize(tokens: Int) {
+        try {
+            if (isModelLoaded) {
+                nativeSetPrefillChunkSize(tokens)
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting prefill chunk size", e)
+        }
+    }
+
+    /**
+     * Per-chunk token counts and decode times of the last prompt prefill
+     */
+    fun getLastPrefillTimings(): List<PrefillChunkTiming> {
+        return try {
+            if (!isModelLoaded) return emptyList()
+            val values = nativeGetLastPrefillTimings()
+            (0 until values.size / 2).map { i ->
+                PrefillChunkTiming(tokens = values[2 * i].toInt(), timeMs = values[2 * i + 1])
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading prefill timings", e)
+            emptyList()
+        }
+    }
+
+    /**
+     * Decode the settled part of a message that is still being typed into the chat's
+     * KV cache, so sending it only has its last words left to process. Returns at
+     * once; later drafts keep whatever tokens they share with this one.
+     */
+    fun prefillDraft(sessionId: String?, partialText: String) {
+        try {
+            if (!isModelLoaded) return
+            nativePrefillDraft(sessionId ?: "", partialText)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error prefilling draft", e)
+        }
+    }
+
+    /**
+     * Measure thread counts and ubatch sizes for the loaded model on this device,
+     * typically from a settings screen. Takes a few seconds to tens of seconds
+     * depending on the model, and [cancelGeneration] stops it. Thread counts apply
+     * at once, the ubatch size from the next load. Returns the chosen settings,
+     * or an empty string when tuning failed or was cancelled.
+     */
+    suspend fun autotune(onProgress: AutotuneListener? = null): String = withContext(Dispatchers.IO) {
+        try {
+            if (!isModelLoaded) return@withContext ""
+            nativeAutotune(onProgress)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error running autotune", e)
+            ""
+        }
+    }
+
+    private fun getAutotuneFile(context: Context): File {
+        return File(context.filesDir, AUTOTUNE_FILE_NAME)
+    }
+
+    /**
+     * Settings the autotuner chose for the loaded model, empty when it was not tuned
+     */
+    fun getTuneConfig(): String {
+        return try {
+            if (!isModelLoaded) return ""
+            nativeGetTuneConfig()
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading tune config", e)
+            ""
+        }
+    }
+
+    /**
+     * Forget every saved autotune result; models use the planned settings until [autotune] runs again
+     */
+    fun clearAutotuneResults(context: Context): Boolean {
+        return try {
+            val file = getAutotuneFile(context)
+            !file.exists() || file.delete()
+        } catch (e: Exception) {
+            Log.e(TAG, "Error clearing autotune results", e)
+            false
+        }
+    }
+
+    private fun getSessionStateDir(context: Context): File {
+        return File(context.filesDir, "kv_sessions").apply { mkdirs() }
+    }
+
+    /**
+     * Estimated size of the KV cache allocated for the loaded model
+     */
+    fun getKvCacheBytes(): Long {
+        return try {
+            if (isModelLoaded) nativeGetKvCacheBytes() else 0L
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading KV cache size", e)
+            0L
+        }
+    }
+
+    /**
+     * Threads for token-by-token decoding (memory bound) and for prompt processing
+     * (compute bound). Kept across model loads; applied at once when idle.
+     */
+    fun setThreadCounts(decodeThreads: Int, batchThreads: Int) {
+        try {
+            nativeSetThreadCounts(decodeThreads, batchThreads)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting thread counts", e)
+        }
+    }
+
+    /**
+     * Online cores with their capacity and max frequency, marking the performance
+     * cores inference threads are pinned to
+     */
+    fun getCpuTopology(): String {
+        return try {
+            nativeGetCpuTopology()
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading CPU topology", e)
+            "Error: ${e.message}"
+        }
+    }
+
+    /**
+     * Set the memory budget the context size, batch and KV type are planned against.
+     * 0 uses a share of the currently available RAM. Applies to the next model load.
+     */
+    fun setMemoryBudget(bytes: Long) {
+        try {
+            nativeSetMemoryBudget(bytes)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting memory budget", e)
+        }
+    }
+
+    /**
+     * Context length, batch size and KV precision chosen for the loaded model
+     */
+    fun getContextPlan(): ContextPlan? {
+        return try {
+            if (!isModelLoaded) return null
+            val values = nativeGetContextPlan()
+            ContextPlan(
+                nCtx = values[0].toInt(),
+                nBatch = values[1].toInt(),
+                nUbatch = values[2].toInt(),
+                kvPrecision = values[3].toInt(),
+                kvBytes = values[4],
+                computeBytes = values[5],
+                modelBytes = values[6],
+                budgetBytes = values[7],
+                fitsBudget = values[8] != 0L
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading context plan", e)
+            null
+        }
+    }
+
+    /**
+     * Load a smaller model of the same family to draft tokens for the loaded model.
+     * Fails if the vocabularies differ (e.g. LFM2 drafting for Phi-4).
+     */
+    suspend fun enableSpeculativeDecoding(
+        context: Context,
+        draftModelId: String,
+        nDraft: Int = 4
+    ): Boolean = withContext(Dispatchers.IO) {
+        try {
+            if (!isModelLoaded) return@withContext false
+            val modelConfig = AVAILABLE_MODELS[draftModelId]
+            if (modelConfig == null || draftModelId == currentModelId) {
+                Log.e(TAG, "Invalid draft model: $draftModelId")
+                return@withContext false
+            }
+
+            val modelFile = getModelFile(context, modelConfig.fileName)
+            if (!modelFile.exists()) {
+                Log.e(TAG, "Draft model file not found: ${modelFile.absolutePath}")
+                return@withContext false
+            }
+
+            val success = nativeLoadDraftModel(modelFile.absolutePath, nDraft)
+            Log.i(TAG, "Speculative decoding with $draftModelId: ${if (success) "enabled" else "unavailable"}")
+            success
+        } catch (e: Exception) {
+            Log.e(TAG, "Error loading draft model", e)
+            false
+        }
+    }
+
+    /**
+     * Stop drafting and free the draft model
+     */
+    fun disableSpeculativeDecoding() {
+        try {
+            nativeUnloadDraftModel()
+        } catch (e: Exception) {
+            Log.e(TAG, "Error unloading draft model", e)
+        }
+    }
+
+    /**
+     * Draft up to nDraft tokens by copying what followed the latest earlier occurrence
+     * of the chat's last few tokens. Needs no extra model or RAM; 0 disables it.
+     * Kept across model loads; a loaded draft model takes precedence.
+     */
+    fun setPromptLookupDecoding(nDraft: Int) {
+        try {
+            nativeSetPromptLookup(nDraft)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting prompt lookup decoding", e)
+        }
+    }
+
+    /**
+     * Drafted and accepted token counts and decode speed of the last response
+     */
+    fun getSpeculativeStats(): SpeculativeStats? {
+        return try {
+            if (!isModelLoaded) return null
+            val values = nativeGetSpeculativeStats()
+            SpeculativeStats(
+                drafted = values[0].toInt(),
+                accepted = values[1].toInt(),
+                generated = values[2].toInt(),
+                timeMs = values[3]
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading speculative decoding stats", e)
+            null
+        }
+    }
+
     /**
      * Get current model information
      */
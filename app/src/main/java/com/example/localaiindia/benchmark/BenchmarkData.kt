@@ -20,7 +20,10 @@ data class BenchmarkRun(
     val p99Latency: Double = 0.0,
     val minLatency: Double = 0.0,
     val maxLatency: Double = 0.0,
-    val tokensPerSecond: Double = 0.0
+    val tokensPerSecond: Double = 0.0,
+    // SamplingProfile.label the run was generated with; empty for runs from before it was recorded
+    @ColumnInfo(defaultValue = "")
+    val samplingProfile: String = ""
 )
 
 @Entity(
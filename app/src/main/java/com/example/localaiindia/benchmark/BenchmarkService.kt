@@ -21,6 +21,7 @@ class BenchmarkService(private val context: Context) {
     private val database = BenchmarkDatabase.getDatabase(context)
     private val benchmarkDao = database.benchmarkDao()
     private var currentJob: Job? = null
+    private var currentService: LlamaService? = null
 
     companion object {
         private const val TAG = "BenchmarkService"
@@ -80,10 +81,13 @@ suspend fun startBenchmark(
     modelName: String,
     llamaService: LlamaService,
     promptCount: Int = 100,
-    promptFileName: String? = null
+    promptFileName: String? = null,
+    // Greedy by default so runs are repeatable and comparable across models
+    profile: LlamaService.SamplingProfile = LlamaService.SamplingProfile.PRECISE
 ): String {
     // Cancel any existing benchmark
     currentJob?.cancel()
+    currentService = llamaService
 
     // Load prompts (prefer asset file if provided)
     val prompts: List<String> = if (!promptFileName.isNullOrBlank()) {
@@ -106,14 +110,15 @@ suspend fun startBenchmark(
         modelName = modelName,
         startTime = System.currentTimeMillis(),
         totalPrompts = prompts.size,
-        status = BenchmarkStatus.RUNNING
+        status = BenchmarkStatus.RUNNING,
+        samplingProfile = profile.label
     )
 
     benchmarkDao.insertBenchmarkRun(benchmarkRun)
 
     currentJob = CoroutineScope(Dispatchers.IO).launch {
         try {
-            runBenchmark(benchmarkRun, prompts, llamaService)
+            runBenchmark(benchmarkRun, prompts, llamaService, profile)
         } catch (e: CancellationException) {
             Log.d(TAG, "Benchmark cancelled")
             benchmarkDao.updateBenchmarkRun(
@@ -144,7 +149,8 @@ suspend fun startBenchmark(
     private suspend fun runBenchmark(
         benchmarkRun: BenchmarkRun,
         prompts: List<String>,
-        llamaService: LlamaService
+        llamaService: LlamaService,
+        profile: LlamaService.SamplingProfile
     ) {
         val results = mutableListOf<BenchmarkResult>()
         val latencies = mutableListOf<Long>()
@@ -157,7 +163,7 @@ suspend fun startBenchmark(
             try {
                 Log.d(TAG, "Running benchmark prompt ${index + 1}/${prompts.size}: ${prompt.take(50)}...")
 
-                val response = llamaService.chat(prompt)
+                val response = llamaService.chat(prompt, profile = profile)
                 val endTime = System.currentTimeMillis()
                 val responseTime = endTime - startTime
                 latencies.add(responseTime)
@@ -326,6 +332,8 @@ suspend fun startBenchmark(
 
     fun cancelBenchmark() {
         currentJob?.cancel()
+        // Job cancellation cannot interrupt the native call of the current prompt
+        currentService?.cancelGeneration()
         _benchmarkProgress.value = null
     }
 
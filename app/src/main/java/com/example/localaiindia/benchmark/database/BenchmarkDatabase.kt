@@ -2,6 +2,7 @@ package com.example.localaiindia.benchmark.database
 
 import android.content.Context
 import androidx.room.*
+import androidx.room.migration.Migration
 import androidx.sqlite.db.SupportSQLiteDatabase
 import kotlinx.coroutines.flow.Flow
 import com.example.localaiindia.benchmark.*
@@ -79,7 +80,7 @@ data class ModelComparisonRaw(
 // Room Database
 @Database(
     entities = [BenchmarkRun::class, BenchmarkResult::class],
-    version = 1,
+    version = 2,
     exportSchema = false
 )
 @TypeConverters(BenchmarkConverters::class)
@@ -90,13 +91,20 @@ abstract class BenchmarkDatabase : RoomDatabase() {
         @Volatile
         private var INSTANCE: BenchmarkDatabase? = null
 
+        // Runs now record the sampling profile they were generated with
+        private val MIGRATION_1_2 = object : Migration(1, 2) {
+            override fun migrate(db: SupportSQLiteDatabase) {
+                db.execSQL("ALTER TABLE benchmark_runs ADD COLUMN samplingProfile TEXT NOT NULL DEFAULT ''")
+            }
+        }
+
         fun getDatabase(context: Context): BenchmarkDatabase {
             return INSTANCE ?: synchronized(this) {
                 val instance = Room.databaseBuilder(
                     context.applicationContext,
                     BenchmarkDatabase::class.java,
                     "benchmark_database"
-                ).addCallback(object : RoomDatabase.Callback() {
+                ).addMigrations(MIGRATION_1_2).addCallback(object : RoomDatabase.Callback() {
                     override fun onCreate(db: SupportSQLiteDatabase) {
                         super.onCreate(db)
                         // Database created
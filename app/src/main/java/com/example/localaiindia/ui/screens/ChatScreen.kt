@@ -344,7 +344,10 @@ fun ChatScreen(
                 // Message Input Area
                 MessageInput(
                     message = currentMessage,
-                    onMessageChange = { currentMessage = it },
+                    onMessageChange = {
+                        currentMessage = it
+                        chatViewModel.onDraftChanged(it)
+                    },
                     onSendMessage = {
                         if (currentMessage.isNotBlank()) {
                             chatViewModel.sendMessage(currentMessage)
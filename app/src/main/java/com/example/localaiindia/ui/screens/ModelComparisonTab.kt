@@ -602,15 +602,16 @@ private fun exportComparisonData( // Removed suspend
 ) {
     try {
         val csvContent = buildString {
-            appendLine("Model,Average Latency (ms),P99 Latency (ms),Success Rate (%),Tokens/s")
+            appendLine("Model,Average Latency (ms),P99 Latency (ms),Success Rate (%),Tokens/s,Sampling Profile")
 
+            // Per-model aggregates may mix profiles, so they leave the column empty
             modelComparisons.forEach { comparison ->
-                appendLine("${comparison.modelName},${comparison.stats.averageLatency.toInt()},${comparison.stats.p99Latency.toInt()},${comparison.stats.successRate.toInt()},${comparison.stats.tokensPerSecond}")
+                appendLine("${comparison.modelName},${comparison.stats.averageLatency.toInt()},${comparison.stats.p99Latency.toInt()},${comparison.stats.successRate.toInt()},${comparison.stats.tokensPerSecond},")
             }
 
             benchmarkRuns.forEach { run ->
                 val successRate = if (run.totalPrompts > 0) (run.completedPrompts.toDouble() / run.totalPrompts * 100) else 0.0
-                appendLine("${run.modelId},${run.averageLatency.toInt()},${run.p99Latency.toInt()},${successRate.toInt()},${run.tokensPerSecond}")
+                appendLine("${run.modelId},${run.averageLatency.toInt()},${run.p99Latency.toInt()},${successRate.toInt()},${run.tokensPerSecond},${run.samplingProfile}")
             }
         }
 
@@ -10,14 +10,23 @@ import com.example.localaiindia.model.ChatSession
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.flow.update
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
 import kotlinx.coroutines.delay
+import kotlinx.coroutines.Job
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
+import android.os.SystemClock
 import android.util.Log
 import java.text.SimpleDateFormat
 import java.util.*
 
+private const val DRAFT_PREFILL_DELAY_MS = 300L
+// Streamed text is shown at most this often; tokens can arrive faster than frames
+private const val STREAM_UPDATE_INTERVAL_MS = 50L
+
 class ChatViewModel(application: Application) : AndroidViewModel(application) {
 
     val llamaService = LlamaService()
@@ -52,6 +61,10 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
     private val _benchmarkProgress = MutableStateFlow<BenchmarkService.BenchmarkProgress?>(null)
     val benchmarkProgress: StateFlow<BenchmarkService.BenchmarkProgress?> = _benchmarkProgress.asStateFlow()
 
+    // Sampler settings applied to every chat request
+    private val _samplingProfile = MutableStateFlow(LlamaService.SamplingProfile.BALANCED)
+    val samplingProfile: StateFlow<LlamaService.SamplingProfile> = _samplingProfile.asStateFlow()
+
     // Session performance tracking
     private val _sessionStats = MutableStateFlow<SessionStats?>(null)
     val sessionStats: StateFlow<SessionStats?> = _sessionStats.asStateFlow()
@@ -63,6 +76,10 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
         val timestamp: Long,
         val modelId: String,
         val tokenCount: Int = 0,
+        val reusedTokens: Int = 0,
+        val timeToFirstToken: Long = 0,
+        val stopReason: LlamaService.StopReason = LlamaService.StopReason.NONE,
+        val samplingProfile: String = "",
         val success: Boolean = true
     )
 
@@ -122,6 +139,9 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
 }
 
     fun createNewChat() {
+        val previousSessionId = _currentSession.value?.id
+        llamaService.cancelGeneration()
+
         // Save current session if it exists and has messages
         _currentSession.value?.let { session ->
             if (session.messages.isNotEmpty()) {
@@ -140,6 +160,7 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
 
         _currentSession.value = newSession
         _messages.value = emptyList()
+        swapSessionState(previousSessionId, null)
 
         // Reset session stats
         _sessionStats.value = null
@@ -150,18 +171,43 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
     }
 
     fun switchToChat(sessionId: String) {
+        val previousSessionId = _currentSession.value?.id
+        if (sessionId != previousSessionId) {
+            llamaService.cancelGeneration()
+        }
         saveCurrentSession()
 
         val selectedSession = _chatSessions.value.find { it.id == sessionId }
         selectedSession?.let { session ->
             _currentSession.value = session
             _messages.value = session.messages
+            if (session.id != previousSessionId) {
+                swapSessionState(previousSessionId, session.id)
+            }
             
             // Calculate session stats for this chat
             calculateSessionStats()
         }
     }
 
+    /**
+     * Save the native KV state of the chat being left and restore the one being opened,
+     * falling back to an empty conversation when no valid state is kept for it
+     */
+    private fun swapSessionState(previousSessionId: String?, nextSessionId: String?) {
+        if (!_isModelReady.value) return
+
+        viewModelScope.launch {
+            conversationMutex.withLock {
+                previousSessionId?.let { llamaService.saveSessionState(getApplication(), it) }
+                val restored = nextSessionId?.let { llamaService.restoreSessionState(getApplication(), it) } ?: false
+                if (!restored) {
+                    llamaService.startNewChat()
+                }
+            }
+        }
+    }
+
     private fun saveCurrentSession() {
         _currentSession.value?.let { session ->
             val updatedSession = session.copy(
@@ -225,8 +271,29 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
         }
     }
 
+    private var draftJob: Job? = null
+
+    // Held around every native call that works on the current chat's KV state, so
+    // a request never lands between the save and the restore of a chat switch
+    private val conversationMutex = Mutex()
+
+    /**
+     * Feed the message being typed to the model once typing pauses, so most of it
+     * is already decoded when it is sent
+     */
+    fun onDraftChanged(text: String) {
+        draftJob?.cancel()
+        if (text.isBlank() || !_isModelReady.value) return
+        val sessionId = _currentSession.value?.id
+        draftJob = viewModelScope.launch {
+            delay(DRAFT_PREFILL_DELAY_MS)
+            conversationMutex.withLock { llamaService.prefillDraft(sessionId, text) }
+        }
+    }
+
     fun sendMessage(text: String) {
         if (text.isBlank() || !_isModelReady.value) return
+        draftJob?.cancel()
 
         val userMessage = ChatMessage(
             text = text,
@@ -243,26 +310,31 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
         )
         _messages.value = _messages.value + typingMessage
 
+        val sessionId = _currentSession.value?.id
         viewModelScope.launch {
             val startTime = System.currentTimeMillis()
             
             try {
-                val response = llamaService.chat(text)
+                val stream = ResponseStream(typingMessage.id, startTime)
+                val profile = _samplingProfile.value
+                val response = try {
+                    conversationMutex.withLock { llamaService.chat(text, stream, profile) }
+                } finally {
+                    stream.finish()
+                }
                 val endTime = System.currentTimeMillis()
                 val responseTime = endTime - startTime
 
                 // Record response time
-                recordResponseTime(text, responseTime, response)
+                recordResponseTime(text, responseTime, response, timeToFirstToken = stream.timeToFirstToken,
+                    profile = profile)
 
                 // Remove typing indicator and add actual response
-                _messages.value = _messages.value.dropLast(1) + ChatMessage(
+                finishResponse(sessionId, typingMessage.id, ChatMessage(
                     text = response,
                     isFromUser = false,
                     timestamp = endTime
-                )
-
-                saveCurrentSession()
-                calculateSessionStats()
+                ))
 
             } catch (e: Exception) {
                 android.util.Log.e("ChatViewModel", "Error sending message", e)
@@ -280,6 +352,169 @@ class ChatViewModel(application: Application) : AndroidViewModel(application) {
         }
     }
 
+    /**
+     * Choose how responses are sampled, e.g. SamplingProfile.PRECISE for factual answers
+     */
+    fun setSamplingProfile(profile: LlamaService.SamplingProfile) {
+        _samplingProfile.value = profile
+    }
+
+    /**
+     * Replace the last user message and answer it again
+     */
+    fun editLastMessage(text: String) {
+        if (text.isBlank() || !_isModelReady.value) return
+        answerLastMessageAgain(text)
+    }
+
+    /**
+     * Discard the last response and generate a new one for the same message
+     */
+    fun regenerateLastResponse() {
+        if (!_isModelReady.value) return
+        val lastUserMessage = _messages.value.lastOrNull { it.isFromUser } ?: return
+        answerLastMessageAgain(lastUserMessage.text)
+    }
+
+    private fun answerLastMessageAgain(text: String) {
+        val lastUserIndex = _messages.value.indexOfLast { it.isFromUser }
+        if (lastUserIndex < 0) return
+
+        val userMessage = _messages.value[lastUserIndex].copy(
+            text = text,
+            timestamp = System.currentTimeMillis()
+        )
+        val typingMessage = ChatMessage(
+            text = "",
+            isFromUser = false,
+            isTyping = true,
+            timestamp = System.currentTimeMillis()
+        )
+        _messages.value = _messages.value.take(lastUserIndex) + userMessage + typingMessage
+
+        val sessionId = _currentSession.value?.id
+        viewModelScope.launch {
+            val startTime = System.currentTimeMillis()
+
+            try {
+                val stream = ResponseStream(typingMessage.id, startTime)
+                val profile = _samplingProfile.value
+                val response = try {
+                    conversationMutex.withLock { llamaService.regenerate(text, stream, profile) }
+                } finally {
+                    stream.finish()
+                }
+                val endTime = System.currentTimeMillis()
+
+                recordResponseTime(text, endTime - startTime, response, timeToFirstToken = stream.timeToFirstToken,
+                    profile = profile)
+
+                finishResponse(sessionId, typingMessage.id, ChatMessage(
+                    text = response,
+                    isFromUser = false,
+                    timestamp = endTime
+                ))
+
+            } catch (e: Exception) {
+                android.util.Log.e("ChatViewModel", "Error regenerating response", e)
+                recordResponseTime(text, System.currentTimeMillis() - startTime, "", success = false)
+
+                _messages.value = _messages.value.dropLast(1) + ChatMessage(
+                    text = "I apologize, but I encountered an error. Please try again.",
+                    isFromUser = false,
+                    timestamp = System.currentTimeMillis()
+                )
+            }
+        }
+    }
+
+    /**
+     * Stop the response being generated; the text produced so far is kept
+     */
+    fun stopGeneration() {
+        llamaService.cancelGeneration()
+    }
+
+    /**
+     * Put the final response in place of its typing placeholder. If the user left the
+     * chat meanwhile (which cancels generation), the stored copy of that chat is updated.
+     * A response cancelled before its first token just removes the placeholder.
+     */
+    private fun finishResponse(sessionId: String?, typingId: String, response: ChatMessage) {
+        fun List<ChatMessage>.withResponse(): List<ChatMessage> =
+            if (response.text.isEmpty()) filter { it.id != typingId }
+            else map { if (it.id == typingId) response else it }
+
+        if (_currentSession.value?.id == sessionId) {
+            _messages.update { it.withResponse() }
+            saveCurrentSession()
+            calculateSessionStats()
+        } else {
+            _chatSessions.update { sessions ->
+                sessions.map { if (it.id == sessionId) it.copy(messages = it.messages.withResponse()) else it }
+            }
+        }
+    }
+
+    /**
+     * Renders a response into the placeholder message as pieces arrive, replacing the
+     * typing indicator with text from the first token on. Pieces come in on the
+     * inference thread; the message is updated on the main thread, at most once per
+     * STREAM_UPDATE_INTERVAL_MS, and only the placeholder is replaced in the list.
+     */
+    private inner class ResponseStream(
+        private val messageId: String,
+        private val startTime: Long
+    ) : LlamaService.TokenListener {
+        // Guards everything below; the inference thread appends, the main thread flushes
+        private val partial = StringBuilder()
+        private var flushJob: Job? = null
+        private var lastFlush = 0L
+        private var finished = false
+
+        @Volatile
+        var timeToFirstToken: Long = 0
+            private set
+
+        override fun onToken(piece: String) {
+            if (timeToFirstToken == 0L) {
+                timeToFirstToken = System.currentTimeMillis() - startTime
+            }
+            synchronized(partial) {
+                partial.append(piece)
+                if (flushJob != null || finished) return
+                val wait = lastFlush + STREAM_UPDATE_INTERVAL_MS - SystemClock.uptimeMillis()
+                flushJob = viewModelScope.launch {
+                    if (wait > 0) delay(wait)
+                    flush()
+                }
+            }
+        }
+
+        private fun flush() {
+            val text = synchronized(partial) {
+                flushJob = null
+                lastFlush = SystemClock.uptimeMillis()
+                partial.toString()
+            }
+            _messages.update { messages ->
+                val index = messages.indexOfLast { it.id == messageId }
+                if (index < 0) messages
+                else messages.toMutableList().apply { set(index, messages[index].copy(text = text, isTyping = false)) }
+            }
+        }
+
+        /**
+         * Drops any pending update so it cannot overwrite the final response
+         */
+        fun finish() {
+            synchronized(partial) {
+                finished = true
+                flushJob?.cancel()
+                flushJob = null
+            }
+        }
+    }
 
     // Add this inside ChatViewModel class
 private var isAutoBenchmarkRunning = false
@@ -333,8 +568,11 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
                 // 3) Call model on IO dispatcher so UI thread isn't blocked
                 val startTime = System.currentTimeMillis()
                 val response: String = try {
-                    withContext(Dispatchers.IO) {
-                        llamaService.chat(prompt)
+                    conversationMutex.withLock {
+                        withContext(Dispatchers.IO) {
+                            // Greedy, like BenchmarkService, so runs can be compared
+                            llamaService.chat(prompt, profile = LlamaService.SamplingProfile.PRECISE)
+                        }
                     }
                 } catch (e: Exception) {
                     Log.e("ChatViewModel", "Error during auto-run prompt #${index+1}", e)
@@ -352,14 +590,16 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
                     )
 
                     // record for session/benchmark stats (so your dashboard updates)
-                    recordResponseTime(prompt, responseTime, response, success = true)
+                    recordResponseTime(prompt, responseTime, response, success = true,
+                        profile = LlamaService.SamplingProfile.PRECISE)
                 } else {
                     _messages.value = _messages.value.dropLast(1) + ChatMessage(
                         text = "⚠️ Error generating response for prompt ${index + 1}",
                         isFromUser = false,
                         timestamp = System.currentTimeMillis()
                     )
-                    recordResponseTime(prompt, responseTime, "", success = false)
+                    recordResponseTime(prompt, responseTime, "", success = false,
+                        profile = LlamaService.SamplingProfile.PRECISE)
                 }
 
                 // Save session and update calculated stats so UI dashboard updates live
@@ -378,7 +618,14 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
     }
 }
 
-    private fun recordResponseTime(prompt: String, responseTime: Long, response: String, success: Boolean = true) {
+    private fun recordResponseTime(
+        prompt: String,
+        responseTime: Long,
+        response: String,
+        success: Boolean = true,
+        timeToFirstToken: Long = 0,
+        profile: LlamaService.SamplingProfile = _samplingProfile.value
+    ) {
         val currentModel = _currentModel.value ?: return
         val currentHistory = _responseTimeHistory.value.toMutableList()
         
@@ -389,6 +636,10 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
             timestamp = System.currentTimeMillis(),
             modelId = currentModel,
             tokenCount = estimateTokenCount(response),
+            reusedTokens = if (success) llamaService.getLastReusedTokens() else 0,
+            timeToFirstToken = timeToFirstToken,
+            stopReason = if (success) llamaService.getLastStopReason() else LlamaService.StopReason.ERROR,
+            samplingProfile = profile.label,
             success = success
         )
         
@@ -447,6 +698,33 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
     }
 
 
+    fun runSessionStateBenchmark() {
+        if (!_isModelReady.value) return
+
+        viewModelScope.launch {
+            val report = llamaService.benchmarkSessionFormats(getApplication())
+            Log.i("ChatViewModel", "Session state benchmark:\n$report")
+        }
+    }
+
+    fun runDetokenizerBenchmark() {
+        if (!_isModelReady.value) return
+
+        viewModelScope.launch {
+            val report = llamaService.benchmarkDetokenizer()
+            Log.i("ChatViewModel", "Detokenizer benchmark:\n$report")
+        }
+    }
+
+    fun runSamplingBenchmark() {
+        if (!_isModelReady.value) return
+
+        viewModelScope.launch {
+            val report = llamaService.benchmarkSampling()
+            Log.i("ChatViewModel", "Sampling benchmark:\n$report")
+        }
+    }
+
     fun cancelBenchmark() {
         benchmarkService.cancelBenchmark()
     }
@@ -465,10 +743,10 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
         if (history.isEmpty()) return "No data available"
 
         val csv = StringBuilder()
-        csv.appendLine("Index,Prompt,ResponseTime(ms),Timestamp,ModelId,TokenCount,Success")
+        csv.appendLine("Index,Prompt,ResponseTime(ms),Timestamp,ModelId,TokenCount,ReusedTokens,TimeToFirstToken(ms),StopReason,SamplingProfile,Success")
         
         history.forEach { entry ->
-            csv.appendLine("${entry.promptIndex},\"${entry.prompt.replace("\"", "\"\"")}\",${entry.responseTime},${entry.timestamp},${entry.modelId},${entry.tokenCount},${entry.success}")
+            csv.appendLine("${entry.promptIndex},\"${entry.prompt.replace("\"", "\"\"")}\",${entry.responseTime},${entry.timestamp},${entry.modelId},${entry.tokenCount},${entry.reusedTokens},${entry.timeToFirstToken},${entry.stopReason},${entry.samplingProfile},${entry.success}")
         }
         
         return csv.toString()
@@ -501,14 +779,22 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
     fun deleteChat(sessionId: String) {
         val updatedSessions = _chatSessions.value.filter { it.id != sessionId }
         _chatSessions.value = updatedSessions
+        viewModelScope.launch {
+            llamaService.deleteSessionState(getApplication(), sessionId)
+        }
 
         if (_currentSession.value?.id == sessionId) {
+            // Forget the deleted chat so createNewChat neither re-saves its text nor its KV state
+            _currentSession.value = null
             createNewChat()
         }
     }
 
     fun clearMessages() {
         _messages.value = emptyList()
+        // The reset is queued behind a running response, so stop that first
+        llamaService.cancelGeneration()
+        llamaService.resetConversation()
         _responseTimeHistory.value = emptyList()
         _sessionStats.value = null
         
@@ -518,13 +804,19 @@ fun runBenchmarkInChat(promptCount: Int = 25, promptFileName: String? = null) {
     }
 
     fun clearAllChats() {
+        val sessionIds = _chatSessions.value.map { it.id }
+        viewModelScope.launch {
+            sessionIds.forEach { llamaService.deleteSessionState(getApplication(), it) }
+        }
         _chatSessions.value = emptyList()
+        _currentSession.value = null
         createNewChat()
     }
 
     override fun onCleared() {
         super.onCleared()
         try {
+            llamaService.cancelGeneration()
             saveCurrentSession()
             llamaService.destroy()
         } catch (e: Exception) {
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "cpu_topology.h"
+
+namespace fs = std::filesystem;
+
+// A throwaway /sys/devices/system/cpu with only the files the probe reads
+class FakeSysfs : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::string pattern = (fs::temp_directory_path() / "cpu_topology_XXXXXX").string();
+        ASSERT_NE(mkdtemp(&pattern[0]), nullptr);
+        m_root = pattern;
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        fs::remove_all(m_root, ec);
+    }
+
+    void write(const std::string& relative, const std::string& content) {
+        const fs::path path = m_root / relative;
+        fs::create_directories(path.parent_path());
+        std::ofstream(path) << content;
+    }
+
+    void setOnline(const std::string& list) { write("online", list + "\n"); }
+
+    // capacity / max_freq_khz of 0 leave the file out
+    void addCore(int id, uint32_t capacity, uint64_t max_freq_khz) {
+        const std::string dir = "cpu" + std::to_string(id);
+        fs::create_directories(m_root / dir);
+        if (capacity > 0) write(dir + "/cpu_capacity", std::to_string(capacity) + "\n");
+        if (max_freq_khz > 0) write(dir + "/cpufreq/cpuinfo_max_freq", std::to_string(max_freq_khz) + "\n");
+    }
+
+    CpuTopology probe() const { return probeCpuTopology(m_root.string()); }
+
+    fs::path m_root;
+};
+
+TEST(ParseCpuListTest, ExpandsRangesAndSingles) {
+    EXPECT_EQ(parseCpuList("0-3,5,7-8"), (std::vector<int>{0, 1, 2, 3, 5, 7, 8}));
+    EXPECT_EQ(parseCpuList("0-7\n"), (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7}));
+    EXPECT_EQ(parseCpuList("4"), (std::vector<int>{4}));
+}
+
+TEST(ParseCpuListTest, EmptyAndMalformedInput) {
+    EXPECT_TRUE(parseCpuList("").empty());
+    EXPECT_TRUE(parseCpuList("\n").empty());
+    EXPECT_EQ(parseCpuList("x,2"), (std::vector<int>{2}));
+}
+
+TEST_F(FakeSysfs, BigLittleKeepsTheBigCluster) {
+    setOnline("0-7");
+    for (int id = 0; id < 4; ++id) addCore(id, 400, 1800000);
+    for (int id = 4; id < 8; ++id) addCore(id, 1024, 2800000);
+
+    CpuTopology topo = probe();
+    ASSERT_EQ(topo.cores.size(), 8u);
+    EXPECT_EQ(topo.performance, (std::vector<int>{4, 5, 6, 7}));
+    EXPECT_TRUE(topo.heterogeneous());
+}
+
+// Prime and big cores are within SAME_CLUSTER_RATIO of each other, so the cut
+// falls at the larger drop down to the little cores
+TEST_F(FakeSysfs, TriClusterCutsAtTheLargestDrop) {
+    setOnline("0-7");
+    for (int id = 0; id < 4; ++id) addCore(id, 325, 2000000);
+    for (int id = 4; id < 7; ++id) addCore(id, 870, 2850000);
+    addCore(7, 1024, 3200000);
+
+    CpuTopology topo = probe();
+    EXPECT_EQ(topo.performance, (std::vector<int>{4, 5, 6, 7}));
+    EXPECT_TRUE(topo.heterogeneous());
+}
+
+TEST_F(FakeSysfs, TriClusterWithALonePrimeCore) {
+    setOnline("0-7");
+    for (int id = 0; id < 4; ++id) addCore(id, 500, 2000000);
+    for (int id = 4; id < 7; ++id) addCore(id, 600, 2400000);
+    addCore(7, 1024, 3300000);
+
+    CpuTopology topo = probe();
+    EXPECT_EQ(topo.performance, (std::vector<int>{7}));
+}
+
+TEST_F(FakeSysfs, MissingCapacityFallsBackToFrequency) {
+    setOnline("0-5");
+    for (int id = 0; id < 4; ++id) addCore(id, 0, 1700000);
+    for (int id = 4; id < 6; ++id) addCore(id, 0, 2600000);
+
+    CpuTopology topo = probe();
+    ASSERT_EQ(topo.cores.size(), 6u);
+    EXPECT_EQ(topo.cores[0].capacity, 0u);
+    EXPECT_EQ(topo.performance, (std::vector<int>{4, 5}));
+}
+
+TEST_F(FakeSysfs, EqualCoresAreAllPerformance) {
+    setOnline("0-3");
+    for (int id = 0; id < 4; ++id) addCore(id, 1024, 2400000);
+
+    CpuTopology topo = probe();
+    EXPECT_EQ(topo.performance, (std::vector<int>{0, 1, 2, 3}));
+    EXPECT_FALSE(topo.heterogeneous());
+}
+
+TEST_F(FakeSysfs, NoSpeedInformationTreatsCoresAsEqual) {
+    setOnline("0-3");
+    for (int id = 0; id < 4; ++id) addCore(id, 0, 0);
+
+    CpuTopology topo = probe();
+    EXPECT_EQ(topo.performance.size(), 4u);
+    EXPECT_FALSE(topo.heterogeneous());
+}
+
+TEST_F(FakeSysfs, MissingOnlineListScansCpuDirectories) {
+    for (int id : {0, 1, 2, 10}) addCore(id, id < 2 ? 400 : 1024, 0);
+    fs::create_directories(m_root / "cpufreq");
+    fs::create_directories(m_root / "cpuidle");
+
+    CpuTopology topo = probe();
+    ASSERT_EQ(topo.cores.size(), 4u);
+    EXPECT_EQ(topo.cores[0].id, 0);
+    EXPECT_EQ(topo.cores[3].id, 10);
+    EXPECT_EQ(topo.performance, (std::vector<int>{2, 10}));
+}
+
+TEST_F(FakeSysfs, OfflineCoresAreSkipped) {
+    setOnline("0-2");
+    for (int id = 0; id < 4; ++id) addCore(id, id == 3 ? 1024 : 512, 0);
+
+    CpuTopology topo = probe();
+    ASSERT_EQ(topo.cores.size(), 3u);
+    EXPECT_FALSE(topo.heterogeneous());
+}
+
+TEST(FillCpuMaskTest, IgnoresIdsOutsideTheMask) {
+    bool mask[4] = {false, false, false, false};
+    fillCpuMask({1, 3, 7, -1}, mask, 4);
+    EXPECT_FALSE(mask[0]);
+    EXPECT_TRUE(mask[1]);
+    EXPECT_FALSE(mask[2]);
+    EXPECT_TRUE(mask[3]);
+}
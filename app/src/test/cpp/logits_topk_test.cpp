@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "include/llama.h"
+#include "logits_topk.h"
+
+// Built once per instruction set; EXPECTED_LOGITS_KERNEL names the one this binary targets
+#ifndef EXPECTED_LOGITS_KERNEL
+#error "EXPECTED_LOGITS_KERNEL must be defined"
+#endif
+
+static const float NEG_INF = -std::numeric_limits<float>::infinity();
+static const float NAN_LOGIT = std::numeric_limits<float>::quiet_NaN();
+
+// What llama.cpp's greedy sampler picks: the first index nothing later beats
+static int32_t referenceArgmax(const std::vector<float>& logits) {
+    int32_t best = 0;
+    for (int32_t i = 1; i < (int32_t) logits.size(); ++i) {
+        if (logits[i] > logits[best]) best = i;
+    }
+    return best;
+}
+
+// The k largest values, descending; NaN-free input only
+static std::vector<float> referenceTopK(const std::vector<float>& logits, size_t k) {
+    std::vector<float> sorted = logits;
+    std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+    sorted.resize(std::min(k, sorted.size()));
+    return sorted;
+}
+
+static std::vector<float> topKValues(const std::vector<float>& logits, size_t k, size_t* n_out = nullptr) {
+    std::vector<llama_token_data> out(std::max<size_t>(k, 1));
+    const size_t n = topKLogits(logits.data(), (int32_t) logits.size(), k, out.data());
+    if (n_out) *n_out = n;
+
+    std::vector<float> values;
+    for (size_t i = 0; i < n; ++i) {
+        EXPECT_GE(out[i].id, 0);
+        EXPECT_LT(out[i].id, (int32_t) logits.size());
+        EXPECT_EQ(out[i].logit, logits[out[i].id]) << "entry " << i << " does not match its token";
+        values.push_back(out[i].logit);
+    }
+    std::sort(values.begin(), values.end(), std::greater<float>());
+    return values;
+}
+
+static std::vector<float> randomLogits(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> dist(0.0f, 4.0f);
+    std::vector<float> logits(n);
+    for (float& v : logits) v = dist(rng);
+    return logits;
+}
+
+// Sizes around every vector width: 4 (NEON, SSE2) and 8 (AVX2)
+static const size_t VOCAB_SIZES[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1000, 32000, 32003, 151936};
+
+TEST(LogitsTopKTest, BuiltForTheExpectedKernel) {
+    EXPECT_STREQ(logitsKernelName(), EXPECTED_LOGITS_KERNEL);
+}
+
+TEST(LogitsTopKTest, ArgmaxMatchesReference) {
+    for (size_t n : VOCAB_SIZES) {
+        for (uint32_t seed = 0; seed < 4; ++seed) {
+            const std::vector<float> logits = randomLogits(n, seed * 7919 + (uint32_t) n);
+            EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), referenceArgmax(logits)) << "n_vocab " << n;
+            EXPECT_EQ(argmaxLogitsScalar(logits.data(), (int32_t) n), referenceArgmax(logits));
+        }
+    }
+}
+
+TEST(LogitsTopKTest, ArgmaxAtEveryPosition) {
+    for (size_t n : {9u, 17u, 33u}) {
+        for (size_t pos = 0; pos < n; ++pos) {
+            std::vector<float> logits(n, 0.0f);
+            logits[pos] = 1.0f;
+            EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), (int32_t) pos) << "n_vocab " << n;
+        }
+    }
+}
+
+TEST(LogitsTopKTest, ArgmaxTiesPickTheLowestIndex) {
+    for (size_t n : VOCAB_SIZES) {
+        std::vector<float> logits(n, 1.0f);
+        EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), 0) << "n_vocab " << n;
+
+        // Equal maxima in different lanes and in the tail
+        if (n >= 3) {
+            std::fill(logits.begin(), logits.end(), 0.0f);
+            logits[n - 1] = 5.0f;
+            logits[n / 2] = 5.0f;
+            logits[1] = 5.0f;
+            EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), 1) << "n_vocab " << n;
+        }
+    }
+}
+
+TEST(LogitsTopKTest, ArgmaxWithInfinities) {
+    for (size_t n : VOCAB_SIZES) {
+        std::vector<float> logits(n, NEG_INF);
+        EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), 0) << "n_vocab " << n;
+
+        logits[n - 1] = -1e30f;
+        EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), referenceArgmax(logits)) << "n_vocab " << n;
+    }
+}
+
+TEST(LogitsTopKTest, ArgmaxWithNaN) {
+    for (size_t n : VOCAB_SIZES) {
+        std::vector<float> logits = randomLogits(n, 42 + (uint32_t) n);
+        for (size_t i = 1; i < n; i += 3) logits[i] = NAN_LOGIT;
+        EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), referenceArgmax(logits)) << "n_vocab " << n;
+
+        // Nothing compares greater than a NaN in slot 0, so the sampler keeps it
+        logits[0] = NAN_LOGIT;
+        EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), 0) << "n_vocab " << n;
+
+        std::fill(logits.begin(), logits.end(), NAN_LOGIT);
+        EXPECT_EQ(argmaxLogits(logits.data(), (int32_t) n), 0) << "n_vocab " << n;
+    }
+}
+
+TEST(LogitsTopKTest, ArgmaxEmptyVocab) {
+    EXPECT_EQ(argmaxLogits(nullptr, 0), -1);
+}
+
+TEST(LogitsTopKTest, TopKMatchesReference) {
+    for (size_t n : VOCAB_SIZES) {
+        const std::vector<float> logits = randomLogits(n, 1234 + (uint32_t) n);
+        for (size_t k : {1u, 2u, 5u, 8u, 40u, 100u}) {
+            EXPECT_EQ(topKValues(logits, k), referenceTopK(logits, k)) << "n_vocab " << n << " k " << k;
+        }
+    }
+}
+
+TEST(LogitsTopKTest, TopKLargerThanVocab) {
+    for (size_t n : {1u, 3u, 9u, 17u}) {
+        const std::vector<float> logits = randomLogits(n, 99);
+        size_t n_out = 0;
+        EXPECT_EQ(topKValues(logits, n + 10, &n_out), referenceTopK(logits, n));
+        EXPECT_EQ(n_out, n);
+    }
+}
+
+TEST(LogitsTopKTest, TopKZero) {
+    const std::vector<float> logits = randomLogits(16, 5);
+    llama_token_data out[1];
+    EXPECT_EQ(topKLogits(logits.data(), 16, 0, out), 0u);
+    EXPECT_EQ(topKLogits(logits.data(), 0, 4, out), 0u);
+}
+
+TEST(LogitsTopKTest, TopKWithTiesAndInfinities) {
+    for (size_t n : VOCAB_SIZES) {
+        std::vector<float> logits(n, NEG_INF);
+        for (size_t i = 0; i < n; i += 5) logits[i] = 2.0f;
+        for (size_t i = 3; i < n; i += 7) logits[i] = 1.0f;
+        for (size_t k : {1u, 4u, 9u}) {
+            EXPECT_EQ(topKValues(logits, k), referenceTopK(logits, k)) << "n_vocab " << n << " k " << k;
+        }
+    }
+}
+
+// NaN never beats the heap root, so the vector path has to reject exactly what
+// the scalar path rejects
+TEST(LogitsTopKTest, TopKWithNaNMatchesScalar) {
+    for (size_t n : VOCAB_SIZES) {
+        std::vector<float> logits = randomLogits(n, 7 + (uint32_t) n);
+        for (size_t i = 2; i < n; i += 4) logits[i] = NAN_LOGIT;
+        for (size_t k : {1u, 8u, 40u}) {
+            std::vector<llama_token_data> fast(k), scalar(k);
+            const size_t n_fast = topKLogits(logits.data(), (int32_t) n, k, fast.data());
+            const size_t n_scalar = topKLogitsScalar(logits.data(), (int32_t) n, k, scalar.data());
+            ASSERT_EQ(n_fast, n_scalar);
+
+            std::vector<int32_t> fast_ids, scalar_ids;
+            for (size_t i = 0; i < n_fast; ++i) {
+                fast_ids.push_back(fast[i].id);
+                scalar_ids.push_back(scalar[i].id);
+            }
+            std::sort(fast_ids.begin(), fast_ids.end());
+            std::sort(scalar_ids.begin(), scalar_ids.end());
+            EXPECT_EQ(fast_ids, scalar_ids) << "n_vocab " << n << " k " << k;
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "ngram_drafter.h"
+
+static std::vector<llama_token> draftFrom(const NgramDrafter& drafter, int n_draft, int* matched = nullptr) {
+    std::vector<llama_token> out;
+    const int n = drafter.draft(n_draft, out);
+    if (matched) *matched = n;
+    return out;
+}
+
+TEST(NgramDrafterTest, DraftsWhatFollowedTheTrailingNgram) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 4, 5, 6, 9, 9, 2, 3});
+    int matched = 0;
+    EXPECT_EQ(draftFrom(drafter, 3, &matched), (std::vector<llama_token>{4, 5, 6}));
+    EXPECT_EQ(matched, 2);
+}
+
+TEST(NgramDrafterTest, PrefersTheLongestMatch) {
+    NgramDrafter drafter(2, 4);
+    // "2 3" was last followed by 8, but "1 2 3" by 4
+    drafter.sync({1, 2, 3, 4, 7, 2, 3, 8, 1, 2, 3});
+    int matched = 0;
+    EXPECT_EQ(draftFrom(drafter, 2, &matched), (std::vector<llama_token>{4, 7}));
+    EXPECT_EQ(matched, 3);
+}
+
+TEST(NgramDrafterTest, LatestOccurrenceWins) {
+    NgramDrafter drafter(2, 2);
+    drafter.sync({5, 6, 1, 5, 6, 2, 5, 6});
+    EXPECT_EQ(draftFrom(drafter, 1), (std::vector<llama_token>{2}));
+}
+
+TEST(NgramDrafterTest, DraftStopsAtTheEndOfTheHistory) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 1, 2});
+    // Only "3 1 2" follows the earlier "1 2"
+    EXPECT_EQ(draftFrom(drafter, 10), (std::vector<llama_token>{3, 1, 2}));
+}
+
+TEST(NgramDrafterTest, NoMatchDraftsNothing) {
+    NgramDrafter drafter(2, 4);
+    int matched = -1;
+    EXPECT_TRUE(draftFrom(drafter, 4, &matched).empty());
+    EXPECT_EQ(matched, 0);
+
+    drafter.sync({1, 2, 3, 4, 5});
+    EXPECT_TRUE(draftFrom(drafter, 4, &matched).empty());
+    EXPECT_EQ(matched, 0);
+
+    // The trailing n-gram never matches itself
+    drafter.clear();
+    drafter.sync({1, 2});
+    EXPECT_TRUE(draftFrom(drafter, 4).empty());
+}
+
+TEST(NgramDrafterTest, PushExtendsTheIndex) {
+    NgramDrafter drafter(2, 3);
+    for (llama_token t : {10, 11, 12, 13, 10, 11}) drafter.push(t);
+    EXPECT_EQ(drafter.size(), 6u);
+    EXPECT_EQ(draftFrom(drafter, 2), (std::vector<llama_token>{12, 13}));
+
+    drafter.push(12);
+    EXPECT_EQ(draftFrom(drafter, 1), (std::vector<llama_token>{13}));
+}
+
+TEST(NgramDrafterTest, SyncAppendsToTheSameHistory) {
+    NgramDrafter drafter(2, 4);
+    std::vector<llama_token> tokens = {1, 2, 3, 4};
+    drafter.sync(tokens);
+    tokens.insert(tokens.end(), {9, 1, 2});
+    drafter.sync(tokens);
+    EXPECT_EQ(drafter.size(), tokens.size());
+    EXPECT_EQ(draftFrom(drafter, 2), (std::vector<llama_token>{3, 4}));
+}
+
+// An edited turn must not draft from the text it replaced once the edit is reported
+TEST(NgramDrafterTest, TruncateForgetsRewrittenHistory) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 4, 1, 2});
+    EXPECT_EQ(draftFrom(drafter, 1), (std::vector<llama_token>{3}));
+
+    drafter.truncate(2);
+    EXPECT_EQ(drafter.size(), 2u);
+    drafter.sync({1, 2, 7, 4, 1, 2});
+    EXPECT_EQ(drafter.size(), 6u);
+    EXPECT_EQ(draftFrom(drafter, 1), (std::vector<llama_token>{7}));
+
+    drafter.truncate(2);
+    EXPECT_TRUE(draftFrom(drafter, 1).empty());
+
+    // Past the end is a no-op
+    drafter.truncate(10);
+    EXPECT_EQ(drafter.size(), 2u);
+}
+
+// Tokens already indexed are trusted, so a sync costs only the new suffix
+TEST(NgramDrafterTest, SyncOnlyAppends) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 4, 1, 2});
+    drafter.sync({9, 9, 9, 9, 9, 9, 3});
+    EXPECT_EQ(drafter.size(), 7u);
+    EXPECT_EQ(draftFrom(drafter, 4), (std::vector<llama_token>{4, 1, 2, 3}));
+}
+
+TEST(NgramDrafterTest, SyncWithFewerTokensTruncates) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 1, 2});
+    drafter.sync({1, 2, 3});
+    EXPECT_EQ(drafter.size(), 3u);
+    EXPECT_TRUE(draftFrom(drafter, 2).empty());
+}
+
+// Drafting after a token that is not committed yet leaves the index untouched
+TEST(NgramDrafterTest, DraftAfterAnUncommittedToken) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 4, 5, 1});
+    std::vector<llama_token> out;
+    EXPECT_EQ(drafter.draft(2, 3, out), 2);
+    EXPECT_EQ(out, (std::vector<llama_token>{3, 4, 5}));
+    EXPECT_EQ(drafter.size(), 6u);
+
+    // The continuation can run into the uncommitted token itself
+    out.clear();
+    drafter.clear();
+    drafter.sync({7, 8, 7});
+    EXPECT_EQ(drafter.draft(8, 4, out), 2);
+    EXPECT_EQ(out, (std::vector<llama_token>{7, 8}));
+
+    // Matches what pushing the token would draft
+    NgramDrafter pushed(2, 4);
+    pushed.sync({1, 2, 3, 4, 5, 1, 2});
+    EXPECT_EQ(draftFrom(pushed, 3), (std::vector<llama_token>{3, 4, 5}));
+}
+
+TEST(NgramDrafterTest, ClearEmptiesTheIndex) {
+    NgramDrafter drafter(2, 4);
+    drafter.sync({1, 2, 3, 1, 2});
+    drafter.clear();
+    EXPECT_EQ(drafter.size(), 0u);
+    drafter.sync({1, 2});
+    EXPECT_TRUE(draftFrom(drafter, 3).empty());
+}
+
+TEST(NgramDrafterTest, LongHistory) {
+    NgramDrafter drafter(2, 4);
+    std::vector<llama_token> tokens;
+    for (int i = 0; i < 100000; ++i) tokens.push_back((llama_token) ((i * 7919) % 50021));
+    tokens.insert(tokens.end(), {tokens[500], tokens[501], tokens[502]});
+    drafter.sync(tokens);
+    EXPECT_EQ(draftFrom(drafter, 3), (std::vector<llama_token>{tokens[503], tokens[504], tokens[505]}));
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "repetition_detector.h"
+
+// Pushes tokens until the detector fires; returns how many were pushed, or 0 if it never did
+static size_t pushUntilLoop(RepetitionDetector& detector, const std::vector<llama_token>& tokens) {
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (detector.push(tokens[i])) return i + 1;
+    }
+    return 0;
+}
+
+static std::vector<llama_token> repeatBlock(const std::vector<llama_token>& block, size_t times) {
+    std::vector<llama_token> tokens;
+    for (size_t i = 0; i < times; ++i) tokens.insert(tokens.end(), block.begin(), block.end());
+    return tokens;
+}
+
+static std::vector<llama_token> distinctTokens(size_t n, llama_token first) {
+    std::vector<llama_token> tokens;
+    for (size_t i = 0; i < n; ++i) tokens.push_back(first + (llama_token) i);
+    return tokens;
+}
+
+TEST(RepetitionDetectorTest, SingleTokenLoopWaitsForMinSpan) {
+    RepetitionDetector detector(128, 3, 32);
+    EXPECT_EQ(pushUntilLoop(detector, std::vector<llama_token>(100, 7)), 32u);
+    EXPECT_EQ(detector.period(), 1u);
+    EXPECT_EQ(detector.repeatedTokens(), 31u);
+}
+
+TEST(RepetitionDetectorTest, FiresOnTheTokenThatCompletesTheLastRepeat) {
+    RepetitionDetector detector(128, 3, 0);
+    const std::vector<llama_token> block = {10, 11, 12, 13};
+    // The block plus three repeats of it
+    EXPECT_EQ(pushUntilLoop(detector, repeatBlock(block, 10)), 16u);
+    EXPECT_EQ(detector.period(), 4u);
+    EXPECT_EQ(detector.repeatedTokens(), 12u);
+}
+
+TEST(RepetitionDetectorTest, ReportsTheShortestPeriod) {
+    RepetitionDetector detector(128, 2, 0);
+    EXPECT_GT(pushUntilLoop(detector, repeatBlock({1, 2}, 20)), 0u);
+    EXPECT_EQ(detector.period(), 2u);
+}
+
+TEST(RepetitionDetectorTest, LoopAfterNormalText) {
+    RepetitionDetector detector(16, 3, 0);
+    std::vector<llama_token> tokens = distinctTokens(500, 1000);
+    const std::vector<llama_token> loop = repeatBlock({5, 6, 7, 8, 9}, 4);
+    tokens.insert(tokens.end(), loop.begin(), loop.end());
+
+    EXPECT_EQ(pushUntilLoop(detector, tokens), tokens.size());
+    EXPECT_EQ(detector.period(), 5u);
+    EXPECT_EQ(detector.repeatedTokens(), 15u);
+}
+
+TEST(RepetitionDetectorTest, DistinctTokensNeverFire) {
+    RepetitionDetector detector(128, 3, 0);
+    EXPECT_EQ(pushUntilLoop(detector, distinctTokens(10000, 0)), 0u);
+}
+
+TEST(RepetitionDetectorTest, BrokenLoopStartsOver) {
+    RepetitionDetector detector(128, 3, 0);
+    // Two repeats, a different token, then two more: never three in a row
+    std::vector<llama_token> tokens = repeatBlock({1, 2, 3}, 3);
+    tokens.push_back(99);
+    const std::vector<llama_token> again = repeatBlock({1, 2, 3}, 3);
+    tokens.insert(tokens.end(), again.begin(), again.end());
+    EXPECT_EQ(pushUntilLoop(detector, tokens), 0u);
+
+    // One more block completes the third repeat
+    EXPECT_EQ(pushUntilLoop(detector, {1, 2, 3}), 3u);
+    EXPECT_EQ(detector.period(), 3u);
+}
+
+TEST(RepetitionDetectorTest, PeriodsLongerThanMaxAreIgnored) {
+    RepetitionDetector detector(8, 3, 0);
+    EXPECT_EQ(pushUntilLoop(detector, repeatBlock(distinctTokens(9, 0), 10)), 0u);
+
+    RepetitionDetector wider(9, 3, 0);
+    EXPECT_EQ(pushUntilLoop(wider, repeatBlock(distinctTokens(9, 0), 10)), 36u);
+    EXPECT_EQ(wider.period(), 9u);
+}
+
+TEST(RepetitionDetectorTest, ResetForgetsHistory) {
+    RepetitionDetector detector(128, 3, 0);
+    const std::vector<llama_token> block = {4, 5};
+    EXPECT_EQ(pushUntilLoop(detector, repeatBlock(block, 3)), 0u);
+    detector.reset();
+    EXPECT_EQ(detector.period(), 0u);
+    EXPECT_EQ(detector.repeatedTokens(), 0u);
+
+    // Without the reset the next block would complete the loop
+    EXPECT_EQ(pushUntilLoop(detector, block), 0u);
+    EXPECT_EQ(pushUntilLoop(detector, repeatBlock(block, 3)), 6u);
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "session_codec.h"
+
+static std::vector<uint8_t> compress(const std::vector<uint8_t>& raw) {
+    std::vector<uint8_t> packed(session_codec_bound(raw.size()));
+    const size_t n = session_codec_compress(raw.data(), raw.size(), packed.data(), packed.size());
+    EXPECT_GT(n, 0u);
+    EXPECT_LE(n, packed.size());
+    packed.resize(n);
+    return packed;
+}
+
+static void expectRoundTrip(const std::vector<uint8_t>& raw, const std::string& what) {
+    const std::vector<uint8_t> packed = compress(raw);
+    std::vector<uint8_t> out(raw.size());
+    EXPECT_EQ(session_codec_decompress(packed.data(), packed.size(), out.data(), out.size()), raw.size()) << what;
+    EXPECT_EQ(out, raw) << what;
+}
+
+static std::vector<uint8_t> randomBytes(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> bytes(n);
+    for (uint8_t& b : bytes) b = (uint8_t) rng();
+    return bytes;
+}
+
+// Something like a KV cache: runs of repeated f16 values between noisy stretches
+static std::vector<uint8_t> kvLikeBytes(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> bytes(n);
+    for (size_t i = 0; i < n; ++i) {
+        bytes[i] = (i / 512) % 3 == 0 ? (uint8_t) rng() : (uint8_t) ((i % 64) < 32 ? 0x3c : 0x00);
+    }
+    return bytes;
+}
+
+TEST(SessionCodecTest, RoundTripsEdgeSizes) {
+    // Around the 15 / 15 + 255 literal and match length nibble extensions
+    for (size_t n : {0u, 1u, 4u, 5u, 12u, 13u, 14u, 15u, 16u, 269u, 270u, 271u, 525u, 4096u, 65536u, 65537u}) {
+        expectRoundTrip(randomBytes(n, (uint32_t) n), "random " + std::to_string(n));
+        expectRoundTrip(std::vector<uint8_t>(n, 0), "zeros " + std::to_string(n));
+        expectRoundTrip(kvLikeBytes(n, (uint32_t) n), "kv-like " + std::to_string(n));
+    }
+}
+
+TEST(SessionCodecTest, RoundTripsOverlappingMatches) {
+    std::vector<uint8_t> raw;
+    for (int i = 0; i < 10000; ++i) raw.push_back((uint8_t) "abc"[i % 3]);
+    expectRoundTrip(raw, "period 3");
+
+    raw.clear();
+    for (int i = 0; i < 10000; ++i) raw.push_back((uint8_t) (i % 7 == 0 ? 1 : 2));
+    expectRoundTrip(raw, "period 7");
+}
+
+TEST(SessionCodecTest, MatchesFartherThanTheWindowStillRoundTrip) {
+    std::vector<uint8_t> block = randomBytes(1000, 1);
+    std::vector<uint8_t> raw = block;
+    const std::vector<uint8_t> filler = randomBytes(70000, 2);
+    raw.insert(raw.end(), filler.begin(), filler.end());
+    raw.insert(raw.end(), block.begin(), block.end());
+    expectRoundTrip(raw, "repeat beyond 64 KiB");
+}
+
+TEST(SessionCodecTest, CompressesRepetitiveData) {
+    const std::vector<uint8_t> raw(1 << 20, 0x42);
+    EXPECT_LT(compress(raw).size(), raw.size() / 100);
+}
+
+TEST(SessionCodecTest, CompressFailsWhenOutputTooSmall) {
+    const std::vector<uint8_t> raw = randomBytes(1000, 3);
+    std::vector<uint8_t> packed(raw.size() / 2);
+    EXPECT_EQ(session_codec_compress(raw.data(), raw.size(), packed.data(), packed.size()), 0u);
+}
+
+TEST(SessionCodecTest, DecompressRejectsTooSmallOutput) {
+    const std::vector<uint8_t> raw = kvLikeBytes(5000, 4);
+    const std::vector<uint8_t> packed = compress(raw);
+    std::vector<uint8_t> out(raw.size() - 1);
+    EXPECT_EQ(session_codec_decompress(packed.data(), packed.size(), out.data(), out.size()), 0u);
+}
+
+TEST(SessionCodecTest, DecompressRejectsTruncatedInput) {
+    const std::vector<uint8_t> raw = kvLikeBytes(5000, 5);
+    const std::vector<uint8_t> packed = compress(raw);
+    std::vector<uint8_t> out(raw.size());
+    for (size_t n = 1; n < packed.size(); ++n) {
+        EXPECT_NE(session_codec_decompress(packed.data(), n, out.data(), out.size()), raw.size()) << "prefix " << n;
+    }
+}
+
+TEST(SessionCodecTest, DecompressRejectsBadOffsets) {
+    std::vector<uint8_t> out(64);
+    // 4 literals, then a match with offset 0
+    const uint8_t zero_offset[] = {0x40, 'a', 'b', 'c', 'd', 0x00, 0x00, 0x00};
+    EXPECT_EQ(session_codec_decompress(zero_offset, sizeof(zero_offset), out.data(), out.size()), 0u);
+    // Offset reaching before the start of the output
+    const uint8_t far_offset[] = {0x40, 'a', 'b', 'c', 'd', 0x05, 0x00, 0x00};
+    EXPECT_EQ(session_codec_decompress(far_offset, sizeof(far_offset), out.data(), out.size()), 0u);
+}
+
+TEST(SessionCodecTest, DecompressRejectsRunawayLengths) {
+    std::vector<uint8_t> out(64);
+    // Literal length extension that runs off the end of the input
+    const uint8_t runaway[] = {0xf0, 0xff, 0xff};
+    EXPECT_EQ(session_codec_decompress(runaway, sizeof(runaway), out.data(), out.size()), 0u);
+    // Literal length larger than the input holds
+    const uint8_t long_literal[] = {0xf0, 0x10, 'a'};
+    EXPECT_EQ(session_codec_decompress(long_literal, sizeof(long_literal), out.data(), out.size()), 0u);
+}
+
+// Flipped bytes must never write past the output; run under the sanitizers
+TEST(SessionCodecTest, CorruptedInputStaysInBounds) {
+    const std::vector<uint8_t> raw = kvLikeBytes(20000, 6);
+    const std::vector<uint8_t> packed = compress(raw);
+    std::mt19937 rng(7);
+    for (int round = 0; round < 2000; ++round) {
+        std::vector<uint8_t> corrupt = packed;
+        for (int flips = 0; flips < 3; ++flips) corrupt[rng() % corrupt.size()] = (uint8_t) rng();
+        std::vector<uint8_t> out(raw.size());
+        EXPECT_LE(session_codec_decompress(corrupt.data(), corrupt.size(), out.data(), out.size()), out.size());
+    }
+}
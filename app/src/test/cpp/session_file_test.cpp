@@ -0,0 +1,276 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "session_file.h"
+
+namespace fs = std::filesystem;
+
+// Byte offsets of SessionFileHeader fields (format version 1)
+static const size_t OFFSET_MAGIC = 0;
+static const size_t OFFSET_VERSION = 4;
+static const size_t OFFSET_STATE_SIZE = 16;
+static const size_t OFFSET_N_TOKENS = 40;
+static const size_t OFFSET_BLOCK_SIZE = 44;
+static const size_t OFFSET_N_BLOCKS = 48;
+static const size_t HEADER_SIZE = 56;
+static const size_t BLOCK_SIZE = 1u << 20;
+static const size_t MAX_TOKENS = 4096;
+
+class SessionFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::string pattern = (fs::temp_directory_path() / "session_file_XXXXXX").string();
+        ASSERT_NE(mkdtemp(&pattern[0]), nullptr);
+        m_dir = pattern;
+        m_path = (m_dir / "chat-0123456789abcdef.kvz").string();
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        fs::remove_all(m_dir, ec);
+    }
+
+    static SessionFileInfo makeInfo(size_t n_tokens) {
+        SessionFileInfo info;
+        info.model_hash = 0x1122334455667788ULL;
+        info.n_layer = 32;
+        info.n_head_kv = 8;
+        info.n_embd = 3072;
+        info.last_turn_start = (uint32_t) (n_tokens / 2);
+        for (size_t i = 0; i < n_tokens; ++i) info.tokens.push_back((llama_token) (i * 31 + 7));
+        return info;
+    }
+
+    // A compressible first block, an incompressible second one stored raw, and a short tail
+    static std::vector<uint8_t> makeState(size_t size) {
+        std::mt19937 rng(11);
+        std::vector<uint8_t> state(size);
+        for (size_t i = 0; i < size; ++i) {
+            state[i] = i < BLOCK_SIZE ? (uint8_t) (i % 16 < 8 ? 0x3c : 0) : (uint8_t) rng();
+        }
+        return state;
+    }
+
+    std::vector<uint8_t> readBytes() const {
+        std::ifstream in(m_path, std::ios::binary);
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void writeBytes(const std::vector<uint8_t>& bytes) const {
+        std::ofstream out(m_path, std::ios::binary | std::ios::trunc);
+        out.write((const char*) bytes.data(), (std::streamsize) bytes.size());
+    }
+
+    void patch32(size_t offset, uint32_t value) const {
+        std::vector<uint8_t> bytes = readBytes();
+        memcpy(bytes.data() + offset, &value, sizeof(value));
+        writeBytes(bytes);
+    }
+
+    void patch64(size_t offset, uint64_t value) const {
+        std::vector<uint8_t> bytes = readBytes();
+        memcpy(bytes.data() + offset, &value, sizeof(value));
+        writeBytes(bytes);
+    }
+
+    bool readBack(SessionFileInfo& info, std::vector<uint8_t>& state) const {
+        return readSessionFile(m_path, info, state, MAX_TOKENS);
+    }
+
+    fs::path m_dir;
+    std::string m_path;
+};
+
+TEST_F(SessionFileTest, RoundTripsTokensAndState) {
+    const SessionFileInfo info = makeInfo(300);
+    const std::vector<uint8_t> state = makeState(2 * BLOCK_SIZE + 12345);
+    const size_t written = writeSessionFile(m_path, info, state.data(), state.size());
+    ASSERT_GT(written, 0u);
+    EXPECT_EQ(written, (size_t) fs::file_size(m_path));
+    EXPECT_LT(written, state.size());  // the first block compresses
+    EXPECT_FALSE(fs::exists(m_path + ".tmp"));
+
+    SessionFileInfo header_only;
+    ASSERT_TRUE(readSessionFileInfo(m_path, header_only, MAX_TOKENS));
+    EXPECT_EQ(header_only.tokens, info.tokens);
+    EXPECT_EQ(header_only.model_hash, info.model_hash);
+    EXPECT_EQ(header_only.last_turn_start, info.last_turn_start);
+
+    SessionFileInfo loaded;
+    std::vector<uint8_t> loaded_state;
+    ASSERT_TRUE(readBack(loaded, loaded_state));
+    EXPECT_EQ(loaded.tokens, info.tokens);
+    EXPECT_EQ(loaded.n_layer, info.n_layer);
+    EXPECT_EQ(loaded.n_head_kv, info.n_head_kv);
+    EXPECT_EQ(loaded.n_embd, info.n_embd);
+    EXPECT_EQ(loaded_state, state);
+}
+
+TEST_F(SessionFileTest, RoundTripsEmptyState) {
+    const SessionFileInfo info = makeInfo(0);
+    ASSERT_GT(writeSessionFile(m_path, info, nullptr, 0), 0u);
+
+    SessionFileInfo loaded;
+    std::vector<uint8_t> state(10, 1);
+    ASSERT_TRUE(readBack(loaded, state));
+    EXPECT_TRUE(loaded.tokens.empty());
+    EXPECT_TRUE(state.empty());
+}
+
+TEST_F(SessionFileTest, RewriteReplacesTheOldFile) {
+    const std::vector<uint8_t> first = makeState(1000);
+    const std::vector<uint8_t> second = makeState(BLOCK_SIZE + 1);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(10), first.data(), first.size()), 0u);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(20), second.data(), second.size()), 0u);
+    EXPECT_FALSE(fs::exists(m_path + ".tmp"));
+
+    SessionFileInfo loaded;
+    std::vector<uint8_t> state;
+    ASSERT_TRUE(readBack(loaded, state));
+    EXPECT_EQ(loaded.tokens.size(), 20u);
+    EXPECT_EQ(state, second);
+}
+
+TEST_F(SessionFileTest, FailedWriteKeepsTheOldFile) {
+    const std::vector<uint8_t> state = makeState(1000);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(10), state.data(), state.size()), 0u);
+    // The temporary file cannot be created where a directory is in the way
+    fs::create_directory(m_path + ".tmp");
+    EXPECT_EQ(writeSessionFile(m_path, makeInfo(20), state.data(), state.size()), 0u);
+
+    SessionFileInfo loaded;
+    ASSERT_TRUE(readSessionFileInfo(m_path, loaded, MAX_TOKENS));
+    EXPECT_EQ(loaded.tokens.size(), 10u);
+}
+
+TEST_F(SessionFileTest, RejectsMoreTokensThanTheContext) {
+    const std::vector<uint8_t> state = makeState(100);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(300), state.data(), state.size()), 0u);
+
+    SessionFileInfo info;
+    std::vector<uint8_t> loaded;
+    EXPECT_FALSE(readSessionFileInfo(m_path, info, 299));
+    EXPECT_FALSE(readSessionFile(m_path, info, loaded, 299));
+    EXPECT_TRUE(readSessionFileInfo(m_path, info, 300));
+}
+
+TEST_F(SessionFileTest, RejectsWrongMagicVersionOrBlockSize) {
+    const std::vector<uint8_t> state = makeState(5000);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(10), state.data(), state.size()), 0u);
+    const std::vector<uint8_t> good = readBytes();
+
+    const std::pair<size_t, uint32_t> patches[] = {
+            {OFFSET_MAGIC, 0x12345678}, {OFFSET_VERSION, 2}, {OFFSET_BLOCK_SIZE, 4096}, {OFFSET_BLOCK_SIZE, 0},
+    };
+    for (const auto& patch : patches) {
+        writeBytes(good);
+        patch32(patch.first, patch.second);
+        SessionFileInfo info;
+        std::vector<uint8_t> loaded;
+        EXPECT_FALSE(readSessionFileInfo(m_path, info, MAX_TOKENS)) << "offset " << patch.first;
+        EXPECT_FALSE(readBack(info, loaded)) << "offset " << patch.first;
+        EXPECT_TRUE(loaded.empty());
+    }
+}
+
+// A header claiming huge sizes must be rejected before anything is allocated
+TEST_F(SessionFileTest, RejectsSizesTheFileCannotHold) {
+    const std::vector<uint8_t> state = makeState(5000);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(10), state.data(), state.size()), 0u);
+    const std::vector<uint8_t> good = readBytes();
+    SessionFileInfo info;
+    std::vector<uint8_t> loaded;
+
+    // Tokens past the end of the file
+    ASSERT_LT(good.size(), HEADER_SIZE + MAX_TOKENS * sizeof(llama_token));
+    patch32(OFFSET_N_TOKENS, (uint32_t) MAX_TOKENS);
+    EXPECT_FALSE(readSessionFileInfo(m_path, info, MAX_TOKENS));
+    EXPECT_FALSE(readBack(info, loaded));
+
+    // A multi-terabyte state with the matching block count
+    writeBytes(good);
+    const uint64_t huge = 1ULL << 42;
+    patch64(OFFSET_STATE_SIZE, huge);
+    patch32(OFFSET_N_BLOCKS, (uint32_t) (huge / BLOCK_SIZE));
+    EXPECT_FALSE(readBack(info, loaded));
+
+    // A state larger than its blocks
+    writeBytes(good);
+    patch64(OFFSET_STATE_SIZE, BLOCK_SIZE - 1);
+    EXPECT_FALSE(readBack(info, loaded));
+
+    // Block count that does not match the state size
+    writeBytes(good);
+    patch32(OFFSET_N_BLOCKS, 2);
+    EXPECT_FALSE(readBack(info, loaded));
+    EXPECT_TRUE(loaded.empty());
+}
+
+TEST_F(SessionFileTest, RejectsBadBlockTable) {
+    const std::vector<uint8_t> state = makeState(5000);
+    const SessionFileInfo written = makeInfo(10);
+    ASSERT_GT(writeSessionFile(m_path, written, state.data(), state.size()), 0u);
+    const size_t table = HEADER_SIZE + written.tokens.size() * sizeof(llama_token);
+    const std::vector<uint8_t> good = readBytes();
+    SessionFileInfo info;
+    std::vector<uint8_t> loaded;
+
+    const uint32_t bad_sizes[] = {0, 5001, 0xffffffffu};
+    for (uint32_t stored : bad_sizes) {
+        writeBytes(good);
+        patch32(table, stored);
+        EXPECT_FALSE(readBack(info, loaded)) << "stored " << stored;
+    }
+}
+
+TEST_F(SessionFileTest, RejectsTruncatedFiles) {
+    const std::vector<uint8_t> state = makeState(BLOCK_SIZE + 5000);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(100), state.data(), state.size()), 0u);
+    const std::vector<uint8_t> good = readBytes();
+
+    for (size_t size : {(size_t) 0, (size_t) 10, HEADER_SIZE, HEADER_SIZE + 100, good.size() / 2, good.size() - 1}) {
+        writeBytes(std::vector<uint8_t>(good.begin(), good.begin() + size));
+        SessionFileInfo info;
+        std::vector<uint8_t> loaded;
+        EXPECT_FALSE(readBack(info, loaded)) << "truncated to " << size;
+    }
+}
+
+// There is no checksum, so a flipped byte may still decode; what must never
+// happen is a state of the wrong size or a partially filled buffer
+TEST_F(SessionFileTest, CorruptCompressedBlockNeverLoadsPartially) {
+    const std::vector<uint8_t> state = makeState(BLOCK_SIZE);
+    ASSERT_GT(writeSessionFile(m_path, makeInfo(4), state.data(), state.size()), 0u);
+    const std::vector<uint8_t> good = readBytes();
+    const size_t blocks_pos = HEADER_SIZE + 4 * sizeof(llama_token) + sizeof(uint32_t);
+    ASSERT_LT(blocks_pos, good.size());
+
+    std::mt19937 rng(3);
+    for (int round = 0; round < 50; ++round) {
+        std::vector<uint8_t> bytes = good;
+        bytes[blocks_pos + rng() % (good.size() - blocks_pos)] ^= (uint8_t) (1 + rng() % 255);
+        writeBytes(bytes);
+
+        SessionFileInfo info;
+        std::vector<uint8_t> loaded;
+        if (readBack(info, loaded)) {
+            EXPECT_EQ(loaded.size(), state.size());
+        } else {
+            EXPECT_TRUE(loaded.empty());
+        }
+    }
+}
+
+TEST_F(SessionFileTest, MissingFile) {
+    SessionFileInfo info;
+    std::vector<uint8_t> state;
+    EXPECT_FALSE(readSessionFileInfo(m_path, info, MAX_TOKENS));
+    EXPECT_FALSE(readBack(info, state));
+}
@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "stop_matcher.h"
+
+// Earliest end of any stop string in text; the longest stop ending there wins.
+// Returns false when none occurs.
+static bool referenceMatch(const std::string& text, const std::vector<std::string>& stops,
+                           size_t& match_start, size_t& match_end) {
+    bool found = false;
+    for (const std::string& stop : stops) {
+        if (stop.empty()) continue;
+        // A stop's first occurrence is also where it ends first
+        const size_t pos = text.find(stop);
+        if (pos == std::string::npos) continue;
+        const size_t end = pos + stop.size();
+        if (!found || end < match_end || (end == match_end && pos < match_start)) {
+            match_start = pos;
+            match_end = end;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Feeds the pieces in order and returns how many were consumed before the match
+static size_t feedAll(StopMatcher& matcher, const std::vector<std::string>& pieces) {
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (matcher.feed(pieces[i])) return i + 1;
+    }
+    return pieces.size();
+}
+
+TEST(StopMatcherTest, MatchWithinOnePiece) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"<|im_end|>"});
+    EXPECT_TRUE(matcher.feed("Done.<|im_end|>ignored"));
+    EXPECT_TRUE(matcher.matched());
+    EXPECT_EQ(matcher.matchStart(), 5u);
+    EXPECT_EQ(matcher.safeLength(), 5u);
+}
+
+TEST(StopMatcherTest, MatchAcrossEveryChunkBoundary) {
+    const std::string stop = "\nUser:";
+    const std::string text = "The answer is 42." + stop + " next";
+    const size_t expected_start = text.find(stop);
+    for (size_t cut = 1; cut < text.size(); ++cut) {
+        StopMatcher matcher;
+        matcher.setStopStrings({stop});
+        const bool first = matcher.feed(text.substr(0, cut));
+        EXPECT_EQ(first, cut >= expected_start + stop.size()) << "cut " << cut;
+        EXPECT_TRUE(first || matcher.feed(text.substr(cut))) << "cut " << cut;
+        EXPECT_EQ(matcher.matchStart(), expected_start) << "cut " << cut;
+        EXPECT_EQ(matcher.safeLength(), expected_start) << "cut " << cut;
+    }
+}
+
+TEST(StopMatcherTest, MatchSpreadOverSingleBytePieces) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"###"});
+    std::vector<std::string> pieces;
+    for (char c : std::string("ab#c##d###e")) pieces.push_back(std::string(1, c));
+    EXPECT_EQ(feedAll(matcher, pieces), 10u);
+    EXPECT_EQ(matcher.matchStart(), 7u);
+}
+
+// A partial match at the end of a piece is held back until it resolves
+TEST(StopMatcherTest, SafeLengthHoldsBackPartialMatches) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"</s>"});
+    EXPECT_FALSE(matcher.feed("hello <"));
+    EXPECT_EQ(matcher.safeLength(), 6u);
+    EXPECT_FALSE(matcher.feed("/"));
+    EXPECT_EQ(matcher.safeLength(), 6u);
+    // Not a stop after all: everything is released
+    EXPECT_FALSE(matcher.feed("b>"));
+    EXPECT_EQ(matcher.safeLength(), 10u);
+    EXPECT_FALSE(matcher.feed(" </"));
+    EXPECT_EQ(matcher.safeLength(), 11u);
+    EXPECT_TRUE(matcher.feed("s>"));
+    EXPECT_EQ(matcher.safeLength(), 11u);
+}
+
+TEST(StopMatcherTest, OverlappingStopsPickTheEarliestEnd) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"abcd", "bc"});
+    EXPECT_FALSE(matcher.feed("xab"));
+    EXPECT_TRUE(matcher.feed("cd"));
+    EXPECT_EQ(matcher.matchStart(), 2u);
+
+    // Same end: the longer stop starts earlier
+    matcher.setStopStrings({"c", "abc"});
+    EXPECT_TRUE(matcher.feed("zzabc"));
+    EXPECT_EQ(matcher.matchStart(), 2u);
+}
+
+TEST(StopMatcherTest, SelfOverlappingStop) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"aab"});
+    EXPECT_FALSE(matcher.feed("aa"));
+    EXPECT_FALSE(matcher.feed("a"));
+    EXPECT_EQ(matcher.safeLength(), 1u);
+    EXPECT_TRUE(matcher.feed("b"));
+    EXPECT_EQ(matcher.matchStart(), 1u);
+}
+
+TEST(StopMatcherTest, FeedAfterMatchIsIgnored) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"end"});
+    EXPECT_TRUE(matcher.feed("the end"));
+    EXPECT_TRUE(matcher.feed("more end"));
+    EXPECT_EQ(matcher.matchStart(), 4u);
+}
+
+TEST(StopMatcherTest, EmptyListNeverMatches) {
+    StopMatcher matcher;
+    EXPECT_TRUE(matcher.empty());
+    EXPECT_FALSE(matcher.feed("anything at all"));
+    EXPECT_EQ(matcher.safeLength(), 15u);
+
+    matcher.setStopStrings({"", ""});
+    EXPECT_TRUE(matcher.empty());
+    EXPECT_FALSE(matcher.feed("x"));
+}
+
+TEST(StopMatcherTest, ResetStartsANewStream) {
+    StopMatcher matcher;
+    matcher.setStopStrings({"STOP"});
+    EXPECT_FALSE(matcher.feed("ST"));
+    matcher.reset();
+    EXPECT_FALSE(matcher.feed("OP"));
+    EXPECT_EQ(matcher.safeLength(), 2u);
+    EXPECT_TRUE(matcher.feed("STOP"));
+    EXPECT_EQ(matcher.matchStart(), 2u);
+}
+
+TEST(StopMatcherTest, MultibyteStopStrings) {
+    StopMatcher matcher;
+    const std::string stop = "\xE0\xA5\xA4";  // Devanagari danda
+    matcher.setStopStrings({stop});
+    EXPECT_FALSE(matcher.feed("\xE0\xA4\xA8\xE0"));
+    EXPECT_EQ(matcher.safeLength(), 3u);
+    EXPECT_FALSE(matcher.feed("\xA5"));
+    EXPECT_TRUE(matcher.feed("\xA4 more"));
+    EXPECT_EQ(matcher.matchStart(), 3u);
+}
+
+TEST(StopMatcherTest, RandomChunksMatchTheReference) {
+    const std::vector<std::string> stops = {"ab", "bab", "abba", "cc", "bcb"};
+    std::mt19937 rng(17);
+    for (int round = 0; round < 3000; ++round) {
+        std::string text;
+        const size_t length = 1 + rng() % 30;
+        for (size_t i = 0; i < length; ++i) text.push_back("abcd"[rng() % 4]);
+
+        StopMatcher matcher;
+        matcher.setStopStrings(stops);
+        size_t fed = 0;
+        size_t released = 0;
+        bool matched = false;
+        while (fed < text.size() && !matched) {
+            const size_t n = std::min<size_t>(1 + rng() % 4, text.size() - fed);
+            matched = matcher.feed(text.substr(fed, n));
+            fed += n;
+            if (!matched) {
+                EXPECT_GE(matcher.safeLength(), released) << text;
+                EXPECT_LE(matcher.safeLength(), fed) << text;
+                released = matcher.safeLength();
+            }
+        }
+
+        size_t start = 0, end = 0;
+        const bool expected = referenceMatch(text, stops, start, end);
+        ASSERT_EQ(matched, expected) << text;
+        if (expected) {
+            EXPECT_EQ(matcher.matchStart(), start) << text;
+            EXPECT_GE(fed, end) << text;
+            // Text shown before the match was found must not include any of it
+            EXPECT_LE(released, start) << text;
+        }
+    }
+}
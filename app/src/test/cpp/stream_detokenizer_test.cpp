@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "include/llama.h"
+#include "stream_detokenizer.h"
+
+// Stand-in for the llama.cpp vocabulary: token id i renders as pieces[i]
+struct llama_vocab {
+    std::vector<std::string> pieces;
+};
+
+// Same contract as llama.cpp: the negated size when buf is too small
+int32_t llama_token_to_piece(const llama_vocab* vocab, llama_token token, char* buf, int32_t length,
+                             int32_t /*lstrip*/, bool /*special*/) {
+    const std::string& piece = vocab->pieces.at((size_t) token);
+    if ((int32_t) piece.size() > length) return -(int32_t) piece.size();
+    memcpy(buf, piece.data(), piece.size());
+    return (int32_t) piece.size();
+}
+
+// "नमस्ते" is 18 bytes of 3-byte sequences, "😀" one 4-byte sequence
+static const std::string NAMASTE = "\xE0\xA4\xA8\xE0\xA4\xAE\xE0\xA4\xB8\xE0\xA5\x8D\xE0\xA4\xA4\xE0\xA5\x87";
+static const std::string EMOJI = "\xF0\x9F\x98\x80";
+
+// Feeds `pieces` as consecutive tokens and records what each push released
+static std::vector<std::string> stream(StreamDetokenizer& detok, llama_vocab& vocab,
+                                       const std::vector<std::string>& pieces) {
+    vocab.pieces = pieces;
+    std::vector<std::string> emitted;
+    for (size_t i = 0; i < pieces.size(); ++i) emitted.push_back(detok.push((llama_token) i));
+    return emitted;
+}
+
+static std::vector<std::string> splitEvery(const std::string& text, size_t n) {
+    std::vector<std::string> pieces;
+    for (size_t i = 0; i < text.size(); i += n) pieces.push_back(text.substr(i, n));
+    return pieces;
+}
+
+TEST(Utf8CompletePrefixTest, CompleteText) {
+    const std::string text = "abc" + NAMASTE + EMOJI;
+    EXPECT_EQ(utf8CompletePrefix(text.data(), text.size()), text.size());
+    EXPECT_EQ(utf8CompletePrefix("", 0), 0u);
+}
+
+TEST(Utf8CompletePrefixTest, StopsBeforeASplitSequence) {
+    const std::string text = "ab" + EMOJI;
+    for (size_t cut = 1; cut < EMOJI.size(); ++cut) {
+        EXPECT_EQ(utf8CompletePrefix(text.data(), 2 + cut), 2u) << "cut " << cut;
+    }
+    for (size_t cut = 1; cut < 3; ++cut) {
+        EXPECT_EQ(utf8CompletePrefix(NAMASTE.data(), 3 + cut), 3u) << "cut " << cut;
+    }
+    EXPECT_EQ(utf8CompletePrefix("\xC3", 1), 0u);
+}
+
+TEST(Utf8CompletePrefixTest, InvalidBytesAreNotHeldBack) {
+    // Stray continuation bytes and bytes that never start a sequence
+    EXPECT_EQ(utf8CompletePrefix("a\x80\x80\x80\x80", 5), 5u);
+    EXPECT_EQ(utf8CompletePrefix("a\xFF", 2), 2u);
+    EXPECT_EQ(utf8CompletePrefix("a\xF8\x80", 3), 3u);
+}
+
+TEST(StreamDetokenizerTest, AsciiPassesStraightThrough) {
+    llama_vocab vocab;
+    StreamDetokenizer detok(&vocab);
+    EXPECT_EQ(stream(detok, vocab, {"Hello", ",", " world"}), (std::vector<std::string>{"Hello", ",", " world"}));
+    EXPECT_EQ(detok.text(), "Hello, world");
+    EXPECT_EQ(detok.pendingBytes(), 0u);
+}
+
+TEST(StreamDetokenizerTest, DevanagariSplitByByte) {
+    llama_vocab vocab;
+    StreamDetokenizer detok(&vocab);
+    const std::vector<std::string> emitted = stream(detok, vocab, splitEvery(NAMASTE, 1));
+    for (size_t i = 0; i < emitted.size(); ++i) {
+        // Every third byte completes a character
+        EXPECT_EQ(emitted[i], i % 3 == 2 ? NAMASTE.substr(i - 2, 3) : "") << "byte " << i;
+    }
+    EXPECT_EQ(detok.text(), NAMASTE);
+    EXPECT_EQ(detok.pendingBytes(), 0u);
+}
+
+TEST(StreamDetokenizerTest, EmojiSplitAtEveryPoint) {
+    for (size_t cut = 1; cut < EMOJI.size(); ++cut) {
+        llama_vocab vocab;
+        StreamDetokenizer detok(&vocab);
+        const std::vector<std::string> emitted =
+                stream(detok, vocab, {"ok " + EMOJI.substr(0, cut), EMOJI.substr(cut) + "!"});
+        EXPECT_EQ(emitted[0], "ok ") << "cut " << cut;
+        EXPECT_EQ(emitted[1], EMOJI + "!") << "cut " << cut;
+        EXPECT_EQ(detok.text(), "ok " + EMOJI + "!");
+    }
+}
+
+TEST(StreamDetokenizerTest, SplitSequenceAcrossThreeTokens) {
+    llama_vocab vocab;
+    StreamDetokenizer detok(&vocab);
+    const std::vector<std::string> emitted =
+            stream(detok, vocab, {EMOJI.substr(0, 1), EMOJI.substr(1, 2), EMOJI.substr(3) + NAMASTE.substr(0, 2)});
+    EXPECT_EQ(emitted, (std::vector<std::string>{"", "", EMOJI}));
+    EXPECT_EQ(detok.pendingBytes(), 2u);
+}
+
+TEST(StreamDetokenizerTest, GrowsThePieceBuffer) {
+    llama_vocab vocab;
+    StreamDetokenizer detok(&vocab);
+    std::string long_piece;
+    for (int i = 0; i < 50; ++i) long_piece += EMOJI;
+    EXPECT_EQ(stream(detok, vocab, {long_piece, "x"}), (std::vector<std::string>{long_piece, "x"}));
+}
+
+TEST(StreamDetokenizerTest, EmptyPiecesAndMissingVocab) {
+    llama_vocab vocab;
+    StreamDetokenizer detok(&vocab);
+    EXPECT_EQ(stream(detok, vocab, {"", "a"}), (std::vector<std::string>{"", "a"}));
+
+    StreamDetokenizer no_vocab;
+    EXPECT_EQ(no_vocab.push(0), "");
+    EXPECT_EQ(no_vocab.text(), "");
+}
+
+TEST(StreamDetokenizerTest, ResetDropsTheCarry) {
+    llama_vocab vocab;
+    StreamDetokenizer detok(&vocab);
+    stream(detok, vocab, {"a", EMOJI.substr(0, 2)});
+    EXPECT_EQ(detok.pendingBytes(), 2u);
+
+    detok.reset();
+    EXPECT_EQ(detok.pendingBytes(), 0u);
+    EXPECT_EQ(detok.text(), "");
+    EXPECT_EQ(stream(detok, vocab, {"b"}), (std::vector<std::string>{"b"}));
+}
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "text_encoding.h"
+
+static std::string roundTrip(const std::string& utf8) {
+    const std::u16string utf16 = utf8ToUtf16(utf8);
+    return utf16ToUtf8(utf16.data(), utf16.size());
+}
+
+TEST(TextEncodingTest, AsciiAndBmp) {
+    EXPECT_EQ(utf8ToUtf16("Hello"), u"Hello");
+    EXPECT_EQ(utf8ToUtf16("\xE0\xA4\xA8\xE0\xA4\xAE\xE0\xA4\xB8\xE0\xA5\x8D\xE0\xA4\xA4\xE0\xA5\x87"), u"नमस्ते");
+    EXPECT_EQ(utf8ToUtf16("caf\xC3\xA9"), u"café");
+    EXPECT_EQ(utf8ToUtf16(""), u"");
+}
+
+// The case NewStringUTF gets wrong: 4-byte UTF-8 becomes a surrogate pair
+TEST(TextEncodingTest, SupplementaryCharactersUseSurrogatePairs) {
+    EXPECT_EQ(utf8ToUtf16("\xF0\x9F\x98\x80"), (std::u16string{0xD83D, 0xDE00}));
+    EXPECT_EQ(utf8ToUtf16("a\xF4\x8F\xBF\xBF" "b"), (std::u16string{u'a', 0xDBFF, 0xDFFF, u'b'}));
+
+    const std::u16string emoji = {0xD83D, 0xDE00};
+    EXPECT_EQ(utf16ToUtf8(emoji.data(), emoji.size()), "\xF0\x9F\x98\x80");
+}
+
+TEST(TextEncodingTest, RoundTrips) {
+    for (const std::string& text : {std::string("plain"), std::string("\xE0\xA4\xA8\xE0\xA4\xAE"),
+                                    std::string("mixed \xF0\x9F\x99\x8F \xE0\xA5\xA4 end"),
+                                    std::string("\x7F\xC2\x80\xDF\xBF\xE0\xA0\x80\xEF\xBF\xBF\xF0\x90\x80\x80")}) {
+        EXPECT_EQ(roundTrip(text), text);
+    }
+}
+
+TEST(TextEncodingTest, MalformedUtf8BecomesReplacementCharacters) {
+    // Truncated at the end and in the middle
+    EXPECT_EQ(utf8ToUtf16("ab\xF0\x9F\x98"), u"ab�");
+    EXPECT_EQ(utf8ToUtf16("\xE0\xA4" "x"), u"�x");
+    // Stray continuation and invalid lead bytes
+    EXPECT_EQ(utf8ToUtf16("\x80\xBF"), u"��");
+    EXPECT_EQ(utf8ToUtf16("\xFF\xF8"), u"��");
+    // Overlong encodings, encoded surrogates and code points past U+10FFFF
+    EXPECT_EQ(utf8ToUtf16("\xC0\xAF"), u"�");
+    EXPECT_EQ(utf8ToUtf16("\xE0\x80\xAF"), u"�");
+    EXPECT_EQ(utf8ToUtf16("\xED\xA0\x80"), u"�");
+    EXPECT_EQ(utf8ToUtf16("\xF4\x90\x80\x80"), u"�");
+}
+
+TEST(TextEncodingTest, UnpairedSurrogatesBecomeReplacementCharacters) {
+    const std::u16string lone_high = {u'a', 0xD83D};
+    EXPECT_EQ(utf16ToUtf8(lone_high.data(), lone_high.size()), "a\xEF\xBF\xBD");
+    const std::u16string lone_low = {0xDE00, u'b'};
+    EXPECT_EQ(utf16ToUtf8(lone_low.data(), lone_low.size()), "\xEF\xBF\xBD" "b");
+    const std::u16string reversed = {0xDE00, 0xD83D};
+    EXPECT_EQ(utf16ToUtf8(reversed.data(), reversed.size()), "\xEF\xBF\xBD\xEF\xBF\xBD");
+}